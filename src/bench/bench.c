@@ -0,0 +1,112 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Allocations are counted by interposing on glibc's allocator, which catches
+// every call made by the program, including from libraries such as
+// libstdc++, as the executable's definitions take precedence over libc's.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+static uint64_t allocs = 0;
+
+void *malloc(size_t size) {
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+size_t read_corpus(const char *path, bench_case_t **cases) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Can't read corpus: %s\n", path);
+        exit(1);
+    }
+    size_t n = 0;
+    size_t capacity = 16;
+    *cases = malloc(capacity * sizeof(bench_case_t));
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, file) != -1) {
+        char *category = strtok(line, " \t\r\n");
+        char *term = strtok(NULL, " \t\r\n");
+        if (category == NULL || category[0] == '#') {
+            continue;
+        }
+        if (term == NULL) {
+            fprintf(stderr, "Corpus line has no term: %s\n", category);
+            exit(1);
+        }
+        if (n == capacity) {
+            capacity *= 2;
+            *cases = realloc(*cases, capacity * sizeof(bench_case_t));
+        }
+        (*cases)[n].category = strdup(category);
+        (*cases)[n].term = strdup(term);
+        n++;
+    }
+    free(line);
+    fclose(file);
+    return n;
+}
+
+void free_corpus(bench_case_t *cases, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        free(cases[i].category);
+        free(cases[i].term);
+    }
+    free(cases);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void run_bench(const char *impl, const char *op, const bench_case_t *c,
+               void (*fn)(void *arg), void *arg) {
+    const char *env = getenv("BENCH_SECONDS");
+    double min_time = env != NULL ? atof(env) : 0.2;
+
+    // Warm up once, so that caches and free lists are in their steady state,
+    // and then double the number of runs until they take long enough:
+    fn(arg);
+    uint64_t runs = 1;
+    double elapsed;
+    uint64_t allocated;
+    for (;;) {
+        uint64_t start_allocs = allocs;
+        double start = now();
+        for (uint64_t i = 0; i < runs; i++) {
+            fn(arg);
+        }
+        elapsed = now() - start;
+        allocated = allocs - start_allocs;
+        if (elapsed >= min_time) {
+            break;
+        }
+        runs *= 2;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"impl\": \"%s\", \"op\": \"%s\", \"category\": \"%s\", "
+           "\"term\": \"%s\", \"runs\": %llu, \"ns_per_op\": %.1f, "
+           "\"allocs_per_op\": %.2f, \"peak_rss_kb\": %ld}\n",
+           impl, op, c->category, c->term, (unsigned long long) runs,
+           elapsed * 1e9 / runs, (double) allocated / runs, usage.ru_maxrss);
+    fflush(stdout);
+}
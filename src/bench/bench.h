@@ -0,0 +1,45 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* A small harness shared by the benchmarks of every implementation, so that
+ * they run the same corpus of terms and report in the same format.
+ *
+ * The corpus is a text file with one term per line, preceded by the name of
+ * its category, with blank lines and lines starting with '#' ignored. Only
+ * combinators and brackets are used, as not every implementation supports
+ * variables.
+ *
+ * Each benchmark is an operation run on a single term of the corpus, as many
+ * times as it takes to fill a minimum amount of time, which is given in
+ * seconds by the BENCH_SECONDS environment variable, or 0.2 by default. Each
+ * one prints a line of JSON to stdout, with the time and number of calls to
+ * malloc, calloc and realloc per operation, and the peak resident set size of
+ * the process so far. The peak only ever grows, so the Makefile runs each
+ * operation in a process of its own.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bench_case {
+    char *category;
+    char *term;
+} bench_case_t;
+
+// Reads the corpus at the given path into *cases, and returns the number of
+// cases, exiting if the file can't be read. The caller is responsible for
+// freeing the cases with free_corpus.
+size_t read_corpus(const char *path, bench_case_t **cases);
+void free_corpus(bench_case_t *cases, size_t n);
+
+// Runs the given operation on the given case of the corpus, and prints the
+// result as coming from the given implementation. The operation is passed
+// arg each time it is called, and must leave it ready to be called again.
+void run_bench(const char *impl, const char *op, const bench_case_t *c,
+               void (*fn)(void *arg), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
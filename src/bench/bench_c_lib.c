@@ -0,0 +1,97 @@
+#include "bench.h"
+#include "../c_lib/comb.h"
+#include "../c_lib/graph.h"
+#include <stdio.h>
+#include <string.h>
+
+// Full reductions stop after this many steps, or once the term has this many
+// leaves, as not every term in the corpus has a normal form:
+#define MAX_STEPS 1000
+#define MAX_SYMBOLS (1 << 16)
+
+typedef struct bench_term {
+    const char *str;
+    term_t *term;
+} bench_term_t;
+
+static void bench_parse(void *arg) {
+    bench_term_t *t = arg;
+    free_term(parse_term(t->str));
+}
+
+static void bench_print(void *arg) {
+    bench_term_t *t = arg;
+    free(print_term(t->term));
+}
+
+static void bench_step(void *arg) {
+    bench_term_t *t = arg;
+    free_term(reduce_term(t->term));
+}
+
+// Reduces every redex at once in each step, so the number of steps isn't
+// comparable with reducing one redex at a time.
+static void bench_reduce(void *arg) {
+    bench_term_t *t = arg;
+    term_t *term = copy_term(t->term);
+    for (int i = 0; i < MAX_STEPS && !term->normal; i++) {
+        if (term->size > MAX_SYMBOLS) {
+            break;
+        }
+        term_t *reduced = reduce_term(term);
+        free_term(term);
+        term = reduced;
+    }
+    free_term(term);
+}
+
+static void bench_graph(void *arg) {
+    bench_term_t *t = arg;
+    budget_t budget = { .max_steps = MAX_STEPS, .max_nodes = MAX_SYMBOLS };
+    term_t *normal = NULL;
+    graph_normal_form(t->term, &budget, &normal);
+    if (normal != NULL) {
+        free_term(normal);
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(void *arg);
+} ops[] = {
+    { "parse", bench_parse },
+    { "print", bench_print },
+    { "step", bench_step },
+    { "reduce", bench_reduce },
+    { "graph", bench_graph },
+};
+#define OPS (sizeof(ops) / sizeof(ops[0]))
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s CORPUS [OP...]\n", argv[0]);
+        return 1;
+    }
+    bench_case_t *cases;
+    size_t n = read_corpus(argv[1], &cases);
+    for (size_t i = 0; i < OPS; i++) {
+        int selected = argc == 2;
+        for (int j = 2; j < argc; j++) {
+            selected |= strcmp(argv[j], ops[i].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        for (size_t j = 0; j < n; j++) {
+            bench_term_t t = { cases[j].term, parse_term(cases[j].term) };
+            if (t.term == NULL) {
+                fprintf(stderr, "Invalid term: %s\n", cases[j].term);
+                return 1;
+            }
+            run_bench("c_lib", ops[i].name, &cases[j], ops[i].fn, &t);
+            free_term(t.term);
+        }
+    }
+    free_corpus(cases, n);
+    return 0;
+}
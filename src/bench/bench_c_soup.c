@@ -0,0 +1,89 @@
+#include "bench.h"
+#include "../c_soup/soup.h"
+
+// Full reductions stop after this many steps, or once the term has this many
+// symbols, as not every term in the corpus has a normal form:
+#define MAX_STEPS 1000
+#define MAX_SYMBOLS (1 << 16)
+
+// Each operation starts from the corpus term, or its normal form for those
+// that need it, and works on a copy:
+typedef struct {
+  const char *str;
+  term_t normalised;
+  state_t *s;
+} bench_term_t;
+
+static void bench_parse(void *arg) {
+  bench_term_t *t = arg;
+  term_t_free(term_t_new(t->str));
+}
+
+static void bench_normalise(void *arg) {
+  bench_term_t *t = arg;
+  term_t term = term_t_new(t->str);
+  normalise(term, t->s);
+  term_t_free(term);
+}
+
+static void bench_redexes(void *arg) {
+  bench_term_t *t = arg;
+  redexes(t->normalised, t->s);
+}
+
+static void bench_step(void *arg) {
+  bench_term_t *t = arg;
+  term_t term = term_t_new(t->normalised);
+  if (redexes(term, t->s)) {
+    term = apply(term, subterms_t_top(t->s->redexes), t->s);
+  }
+  term_t_free(term);
+}
+
+static void bench_reduce(void *arg) {
+  bench_term_t *t = arg;
+  budget_t budget = { .max_steps = MAX_STEPS, .max_symbols = MAX_SYMBOLS };
+  term_t_free(reduce(term_t_new(t->normalised), t->s, &budget, NULL));
+}
+
+static const struct {
+  const char *name;
+  void (*fn)(void *arg);
+} ops[] = {
+  { "parse", bench_parse },
+  { "normalise", bench_normalise },
+  { "redexes", bench_redexes },
+  { "step", bench_step },
+  { "reduce", bench_reduce },
+};
+#define OPS (sizeof(ops) / sizeof(ops[0]))
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s CORPUS [OP...]\n", argv[0]);
+    return 1;
+  }
+  state_t *s = malloc(sizeof(state_t));
+  state_t_init(s);
+  bench_case_t *cases;
+  size_t n = read_corpus(argv[1], &cases);
+  for (size_t i = 0; i < OPS; i++) {
+    bool selected = argc == 2;
+    for (int j = 2; j < argc; j++) {
+      selected |= strcmp(argv[j], ops[i].name) == 0;
+    }
+    if (!selected) {
+      continue;
+    }
+    for (size_t j = 0; j < n; j++) {
+      bench_term_t t = { cases[j].term, term_t_new(cases[j].term), s };
+      normalise(t.normalised, s);
+      run_bench("c_soup", ops[i].name, &cases[j], ops[i].fn, &t);
+      term_t_free(t.normalised);
+    }
+  }
+  free_corpus(cases, n);
+  state_t_free(s);
+  free(s);
+  return 0;
+}
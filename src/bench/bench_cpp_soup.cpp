@@ -0,0 +1,88 @@
+#include "bench.h"
+#include "../cpp_soup/soup.h"
+#include <cstdio>
+#include <cstring>
+
+// Full reductions stop after this many steps, or once the term has this many
+// symbols, as not every term in the corpus has a normal form:
+const int MAX_STEPS = 1000;
+const size_t MAX_SYMBOLS = 1 << 16;
+
+// Each operation works on the corpus term, reusing the same storage for its
+// outputs from one run to the next, as the soup would:
+struct BenchTerm {
+	Term term;
+	vector<Redex> redexes;
+	Term current, next;
+};
+
+static void benchParse(void *arg) {
+	BenchTerm *t = (BenchTerm *) arg;
+	validateTerm(t->term);
+}
+
+static void benchRedexes(void *arg) {
+	BenchTerm *t = (BenchTerm *) arg;
+	listRedexes(t->term, t->redexes);
+}
+
+static void benchStep(void *arg) {
+	BenchTerm *t = (BenchTerm *) arg;
+	listRedexes(t->term, t->redexes);
+	if (!t->redexes.empty()) {
+		applyRedex(t->term, t->redexes.back(), t->next);
+	}
+}
+
+// Always applies the last redex, as cpp_soup's main does.
+static void benchReduce(void *arg) {
+	BenchTerm *t = (BenchTerm *) arg;
+	t->current = t->term;
+	for (int i = 0; i < MAX_STEPS && t->current.size() <= MAX_SYMBOLS; i++) {
+		listRedexes(t->current, t->redexes);
+		if (t->redexes.empty()) {
+			break;
+		}
+		applyRedex(t->current, t->redexes.back(), t->next);
+		swap(t->current, t->next);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(void *arg);
+} ops[] = {
+	{"parse", benchParse},
+	{"redexes", benchRedexes},
+	{"step", benchStep},
+	{"reduce", benchReduce},
+};
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s CORPUS [OP...]\n", argv[0]);
+		return 1;
+	}
+	bench_case_t *cases;
+	size_t n = read_corpus(argv[1], &cases);
+	for (const auto &op : ops) {
+		bool selected = argc == 2;
+		for (int j = 2; j < argc; j++) {
+			selected |= strcmp(argv[j], op.name) == 0;
+		}
+		if (!selected) {
+			continue;
+		}
+		for (size_t j = 0; j < n; j++) {
+			BenchTerm t;
+			t.term = cases[j].term;
+			if (!validateTerm(t.term)) {
+				fprintf(stderr, "Invalid term: %s\n", cases[j].term);
+				return 1;
+			}
+			run_bench("cpp_soup", op.name, &cases[j], op.fn, &t);
+		}
+	}
+	free_corpus(cases, n);
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include "batch.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+void parse_terms(const char *strs, size_t n, term_t **out) {
+    assert(strs != NULL || n == 0);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = parse_term(strs);
+        strs += strlen(strs) + 1;
+    }
+}
+
+char *print_terms(term_t **terms, size_t n, size_t *len) {
+    size_t capacity = 64;
+    size_t used = 0;
+    char *buffer = malloc(capacity);
+    assert(buffer != NULL);
+    for (size_t i = 0; i < n; i++) {
+        char *str = print_term(terms[i]);
+        size_t str_len = strlen(str) + 1;
+        if (used + str_len > capacity) {
+            while (used + str_len > capacity) {
+                capacity *= 2;
+            }
+            buffer = realloc(buffer, capacity);
+            assert(buffer != NULL);
+        }
+        memcpy(buffer + used, str, str_len);
+        used += str_len;
+        free(str);
+    }
+    *len = used;
+    return buffer;
+}
+
+void reduce_terms(term_t **terms, size_t n, const budget_t *budget,
+                  term_t **out, int *results) {
+    assert(budget != NULL);
+    for (size_t i = 0; i < n; i++) {
+        budget_t used = *budget;
+        int result = reduce_term_within(terms[i], &used, &out[i]);
+        if (results != NULL) {
+            results[i] = result;
+        }
+    }
+}
+
+void reduce_terms_n(term_t **terms, size_t n, const budget_t *budget,
+                    term_t **out, int *steps, int *results) {
+    assert(budget != NULL);
+    for (size_t i = 0; i < n; i++) {
+        budget_t used = *budget;
+        term_t *term = copy_term(terms[i]);
+        int j = 0;
+        int result;
+        for (;; j++) {
+            term_t *reduced = NULL;
+            result = reduce_term_within(term, &used, &reduced);
+            if (result != REDUCE_DONE) {
+                break;
+            }
+            free_term(term);
+            if (reduced == term) {
+                break;
+            }
+            term = reduced;
+        }
+        out[i] = term;
+        if (steps != NULL) {
+            steps[i] = j;
+        }
+        if (results != NULL) {
+            results[i] = result;
+        }
+    }
+}
+
+void beta_normal_terms(normal_cache_t *cache, term_t **terms, size_t n,
+                       const budget_t *budget, term_t **out, int *results) {
+    assert(budget != NULL);
+    for (size_t i = 0; i < n; i++) {
+        budget_t used = *budget;
+        int result = beta_normal(cache, terms[i], &used, &out[i]);
+        if (results != NULL) {
+            results[i] = result;
+        }
+    }
+}
+
+void hash_terms(term_t **terms, size_t n, uint64_t *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = hash_term(terms[i]);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "comb.h"
+#include "normal.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Batch versions of the term operations, which each work on an array of
+ * terms in a single call, so that callers going through an FFI cross the
+ * boundary once per batch rather than once per term. Each output term is a
+ * new reference, and the caller is responsible for freeing it.
+ */
+
+// Parses n terms from a buffer holding their strings one after the other,
+// each terminated by a '\0'. Invalid terms are returned as NULL.
+void parse_terms(const char *strs, size_t n, term_t **out);
+
+// Prints n terms into a single buffer, one after the other, each terminated
+// by a '\0'. Returns the buffer, and its total length including the '\0's in
+// *len. The caller is responsible for freeing the returned buffer.
+char *print_terms(term_t **terms, size_t n, size_t *len);
+
+// Reduces each of the n terms by a single step, as by reduce_term_within,
+// with a fresh copy of the given budget each. Terms whose budget runs out are
+// returned as NULL. If results isn't NULL, each term's REDUCE_ result is
+// written to it.
+void reduce_terms(term_t **terms, size_t n, const budget_t *budget,
+                  term_t **out, int *results);
+
+// Reduces each of the n terms until it stops changing, with a fresh copy of
+// the given budget each, and returns the last term reached, so that terms
+// whose budget runs out are returned as far as they got. If steps isn't NULL,
+// the number of reductions that changed each term is written to it, and if
+// results isn't NULL, so is each term's REDUCE_ result.
+void reduce_terms_n(term_t **terms, size_t n, const budget_t *budget,
+                    term_t **out, int *steps, int *results);
+
+// Finds the beta normal form of each of the n terms, as by beta_normal, with
+// a fresh copy of the given budget each. Terms whose budget runs out are
+// returned as NULL. If results isn't NULL, each term's REDUCE_ result is
+// written to it.
+void beta_normal_terms(normal_cache_t *cache, term_t **terms, size_t n,
+                       const budget_t *budget, term_t **out, int *results);
+
+// Writes the hash of each of the n terms, as by hash_term.
+void hash_terms(term_t **terms, size_t n, uint64_t *out);
@@ -0,0 +1,536 @@
+#include "checkpoint.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAGIC "COMBSOUP"
+#define BYTE_ORDER_MARK 0x0102030405060708ull
+#define APP '@'
+
+// The fixed header of a checkpoint. Every field is eight bytes wide, or packed
+// with another into eight bytes, so the struct has no padding.
+typedef struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t byte_order; // BYTE_ORDER_MARK, as the writer stored it
+    uint64_t file_size;
+    double p_action;
+    double p_reduce;
+    double p_fission;
+    double p_fusion;
+    double p_break;
+    int64_t max_steps;
+    uint64_t max_nodes;
+    uint64_t max_bytes;
+    int32_t on_exhausted;
+    int32_t reserved;
+    char alphabet[8];
+    uint64_t rng;
+    uint64_t steps;
+    double time;
+    uint64_t events;
+    uint64_t exhausted;
+    uint64_t counts[COMBINATORS];
+    uint64_t reactions[REACTIONS];
+    uint64_t results[4];
+    uint64_t redexes[COMBINATORS];
+    uint64_t topped_up[COMBINATORS];
+    double seconds[PHASES];
+    uint64_t size; // terms in the soup
+    uint64_t nodes; // distinct nodes of all the terms together
+} header_t;
+
+// Offsets of the sections of a checkpoint, and of its end.
+typedef struct layout {
+    size_t lefts; // uint32_t per node
+    size_t rights; // uint32_t per node
+    size_t slots; // uint32_t per term of the soup
+    size_t tags; // char per node
+    size_t end;
+} layout_t;
+
+static size_t pad(size_t n) {
+    return (n + 7) & ~(size_t) 7;
+}
+
+static layout_t layout_of(const header_t *header) {
+    layout_t layout;
+    layout.lefts = sizeof(header_t);
+    layout.rights = layout.lefts + pad(header->nodes * sizeof(uint32_t));
+    layout.slots = layout.rights + pad(header->nodes * sizeof(uint32_t));
+    layout.tags = layout.slots + pad(header->size * sizeof(uint32_t));
+    layout.end = layout.tags + pad(header->nodes);
+    return layout;
+}
+
+// Numbers the distinct nodes of a soup's terms so that children come before
+// their parents, with an open-addressed hash table from each node to its
+// number + 1, or 0 if the entry is empty. Nodes are hash-consed, so they are
+// compared by pointer.
+typedef struct numbering {
+    term_t **nodes;
+    size_t count;
+    size_t capacity;
+    uint32_t *table;
+    size_t table_size; // always a power of two, at least twice the count
+    term_t **stack; // nodes waiting for their children to be numbered
+    size_t stack_capacity;
+} numbering_t;
+
+// Returns the number of the given node, or -1 if it hasn't got one yet.
+static int64_t find_node(numbering_t *numbering, term_t *node) {
+    size_t mask = numbering->table_size - 1;
+    for (size_t b = node->hash & mask; numbering->table[b] != 0;
+         b = (b + 1) & mask) {
+        if (numbering->nodes[numbering->table[b] - 1] == node) {
+            return numbering->table[b] - 1;
+        }
+    }
+    return -1;
+}
+
+static void add_node(numbering_t *numbering, term_t *node) {
+    size_t mask = numbering->table_size - 1;
+    size_t b = node->hash & mask;
+    while (numbering->table[b] != 0) {
+        b = (b + 1) & mask;
+    }
+    numbering->table[b] = numbering->count + 1;
+    numbering->nodes[numbering->count++] = node;
+    if (numbering->count < numbering->capacity) {
+        return;
+    }
+
+    numbering->capacity *= 2;
+    numbering->nodes = realloc(numbering->nodes,
+                               numbering->capacity * sizeof(term_t *));
+    free(numbering->table);
+    numbering->table_size *= 2;
+    numbering->table = calloc(numbering->table_size, sizeof(uint32_t));
+    mask = numbering->table_size - 1;
+    for (size_t i = 0; i < numbering->count; i++) {
+        b = numbering->nodes[i]->hash & mask;
+        while (numbering->table[b] != 0) {
+            b = (b + 1) & mask;
+        }
+        numbering->table[b] = i + 1;
+    }
+}
+
+// Returns the number of the given term's root, numbering it and every node
+// under it that hasn't got one yet, children first.
+static uint64_t number_term(numbering_t *numbering, term_t *term) {
+    int64_t found = find_node(numbering, term);
+    if (found >= 0) {
+        return found;
+    }
+    size_t depth = 0;
+    numbering->stack[depth++] = term;
+    while (depth > 0) {
+        term_t *node = numbering->stack[depth - 1];
+        if (find_node(numbering, node) >= 0) {
+            depth--;
+            continue;
+        }
+        if (numbering->stack_capacity < depth + 2) {
+            numbering->stack_capacity *= 2;
+            numbering->stack = realloc(numbering->stack,
+                numbering->stack_capacity * sizeof(term_t *));
+        }
+        int ready = 1;
+        if (!node->is_leaf && find_node(numbering, node->right) < 0) {
+            numbering->stack[depth++] = node->right;
+            ready = 0;
+        }
+        if (!node->is_leaf && find_node(numbering, node->left) < 0) {
+            numbering->stack[depth++] = node->left;
+            ready = 0;
+        }
+        if (ready) {
+            add_node(numbering, node);
+            depth--;
+        }
+    }
+    return numbering->count - 1;
+}
+
+// Encodes the soup into a new buffer, and sets *bytes to its size. Returns
+// NULL, with errno set, if the soup has more distinct nodes than can be
+// numbered.
+static char *encode_soup(soup_t *soup, size_t *bytes) {
+    numbering_t numbering = {
+        .capacity = 16,
+        .table_size = 32,
+        .stack_capacity = 64,
+    };
+    numbering.nodes = malloc(numbering.capacity * sizeof(term_t *));
+    numbering.table = calloc(numbering.table_size, sizeof(uint32_t));
+    numbering.stack = malloc(numbering.stack_capacity * sizeof(term_t *));
+    uint32_t *slots = malloc((soup->size ? soup->size : 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < soup->size; i++) {
+        slots[i] = number_term(&numbering, soup->terms[i]);
+        if (numbering.count >= UINT32_MAX) {
+            free(numbering.nodes);
+            free(numbering.table);
+            free(numbering.stack);
+            free(slots);
+            errno = EOVERFLOW;
+            return NULL;
+        }
+    }
+    free(numbering.stack);
+
+    header_t header = {
+        .version = CHECKPOINT_VERSION,
+        .header_size = sizeof(header_t),
+        .byte_order = BYTE_ORDER_MARK,
+        .p_action = soup->params.p_action,
+        .p_reduce = soup->params.p_reduce,
+        .p_fission = soup->params.p_fission,
+        .p_fusion = soup->params.p_fusion,
+        .p_break = soup->params.p_break,
+        .max_steps = soup->params.budget.max_steps,
+        .max_nodes = soup->params.budget.max_nodes,
+        .max_bytes = soup->params.budget.max_bytes,
+        .on_exhausted = soup->params.on_exhausted,
+        .rng = soup->rng.state,
+        .steps = soup->steps,
+        .time = soup->time,
+        .events = soup->events,
+        .exhausted = soup->exhausted,
+        .size = soup->size,
+        .nodes = numbering.count,
+    };
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    strcpy(header.alphabet, soup->alphabet);
+    for (int i = 0; i < COMBINATORS; i++) {
+        header.counts[i] = soup->counts[i];
+        header.redexes[i] = soup->stats.redexes[i];
+        header.topped_up[i] = soup->stats.topped_up[i];
+    }
+    memcpy(header.reactions, soup->stats.reactions, sizeof(header.reactions));
+    memcpy(header.results, soup->stats.results, sizeof(header.results));
+    memcpy(header.seconds, soup->stats.seconds, sizeof(header.seconds));
+    layout_t layout = layout_of(&header);
+    header.file_size = layout.end;
+
+    char *data = calloc(layout.end, 1);
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + layout.slots, slots, soup->size * sizeof(uint32_t));
+    free(slots);
+    uint32_t *lefts = (uint32_t *) (data + layout.lefts);
+    uint32_t *rights = (uint32_t *) (data + layout.rights);
+    char *tags = data + layout.tags;
+    for (size_t i = 0; i < numbering.count; i++) {
+        term_t *node = numbering.nodes[i];
+        if (node->is_leaf) {
+            tags[i] = node->c;
+        } else {
+            tags[i] = APP;
+            lefts[i] = find_node(&numbering, node->left);
+            rights[i] = find_node(&numbering, node->right);
+        }
+    }
+    free(numbering.nodes);
+    free(numbering.table);
+    *bytes = layout.end;
+    return data;
+}
+
+// Syncs the directory holding the given path, so that a rename into it is
+// durable. This is only best effort, as not every file system supports it.
+static void sync_directory(const char *path) {
+    char *copy = strdup(path);
+    int fd = open(dirname(copy), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(copy);
+}
+
+// Writes the given bytes to a temporary file next to the path, and renames it
+// over the path once it is synced. Returns 0, or an errno on failure, in which
+// case the temporary file is removed and the path left as it was.
+static int write_file(const char *path, const char *data, size_t bytes) {
+    size_t len = strlen(path);
+    char *tmp = malloc(len + sizeof(".tmp"));
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        int error = errno;
+        free(tmp);
+        return error;
+    }
+    int error = 0;
+    for (size_t done = 0; done < bytes && error == 0;) {
+        ssize_t n = write(fd, data + done, bytes - done);
+        if (n >= 0) {
+            done += n;
+        } else if (errno != EINTR) {
+            error = errno;
+        }
+    }
+    if (error == 0 && fsync(fd) != 0) {
+        error = errno;
+    }
+    if (close(fd) != 0 && error == 0) {
+        error = errno;
+    }
+    if (error == 0 && rename(tmp, path) != 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        unlink(tmp);
+    } else {
+        sync_directory(path);
+    }
+    free(tmp);
+    return error;
+}
+
+// A checkpoint being written by a background thread, which owns the data.
+struct checkpoint {
+    pthread_t thread;
+    char *path;
+    char *data;
+    size_t bytes;
+    int error; // errno of the write, or 0 if it succeeded
+};
+
+static void *write_checkpoint(void *arg) {
+    struct checkpoint *checkpoint = arg;
+    checkpoint->error = write_file(checkpoint->path, checkpoint->data,
+                                   checkpoint->bytes);
+    free(checkpoint->data);
+    return NULL;
+}
+
+int soup_checkpoint_wait(soup_t *soup) {
+    struct checkpoint *checkpoint = soup->checkpoint;
+    if (checkpoint == NULL) {
+        return 1;
+    }
+    pthread_join(checkpoint->thread, NULL);
+    soup->checkpoint = NULL;
+    int error = checkpoint->error;
+    free(checkpoint->path);
+    free(checkpoint);
+    if (error != 0) {
+        errno = error;
+        return 0;
+    }
+    return 1;
+}
+
+int save_soup(soup_t *soup, const char *path) {
+    int ok = soup_checkpoint_wait(soup);
+    size_t bytes;
+    char *data = encode_soup(soup, &bytes);
+    if (data == NULL) {
+        return 0;
+    }
+    int error = write_file(path, data, bytes);
+    free(data);
+    if (error != 0) {
+        errno = error;
+        return 0;
+    }
+    return ok;
+}
+
+int soup_checkpoint(soup_t *soup, const char *path) {
+    int ok = soup_checkpoint_wait(soup);
+    int error = ok ? 0 : errno;
+    struct checkpoint *checkpoint = malloc(sizeof(struct checkpoint));
+    checkpoint->data = encode_soup(soup, &checkpoint->bytes);
+    if (checkpoint->data == NULL) {
+        free(checkpoint);
+        return 0;
+    }
+    checkpoint->path = strdup(path);
+    checkpoint->error = 0;
+    error = pthread_create(&checkpoint->thread, NULL, write_checkpoint,
+                           checkpoint);
+    if (error != 0) {
+        free(checkpoint->data);
+        free(checkpoint->path);
+        free(checkpoint);
+        errno = error;
+        return 0;
+    }
+    soup->checkpoint = checkpoint;
+    if (!ok) {
+        errno = error;
+    }
+    return ok;
+}
+
+// Returns 1 if the header is that of a checkpoint of the given size that can
+// be read, with a valid alphabet, or 0 otherwise.
+static int valid_header(const header_t *header, size_t bytes) {
+    if (memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CHECKPOINT_VERSION ||
+        header->header_size != sizeof(header_t) ||
+        header->byte_order != BYTE_ORDER_MARK ||
+        header->file_size != bytes) {
+        return 0;
+    }
+    // Each count is bounded by the size of the file, so the layout can't
+    // overflow:
+    if (header->size > bytes || header->nodes > bytes ||
+        layout_of(header).end != bytes) {
+        return 0;
+    }
+    size_t n = strnlen(header->alphabet, sizeof(header->alphabet));
+    if (n == 0 || n > COMBINATORS) {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (combinator_index(header->alphabet[i]) < 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Builds a soup from the given checkpoint. Returns NULL, with errno set to
+// EINVAL, if it isn't valid.
+static soup_t *decode_soup(const char *data, size_t bytes) {
+    const header_t *header = (const header_t *) data;
+    if (bytes < sizeof(header_t) || !valid_header(header, bytes)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    layout_t layout = layout_of(header);
+    const uint32_t *lefts = (const uint32_t *) (data + layout.lefts);
+    const uint32_t *rights = (const uint32_t *) (data + layout.rights);
+    const uint32_t *slots = (const uint32_t *) (data + layout.slots);
+    const char *tags = data + layout.tags;
+
+    // The nodes are built straight from the mapped arrays, each only once.
+    // Children always come before their parents, which also rules out
+    // cycles:
+    term_t **nodes = malloc((header->nodes + 1) * sizeof(term_t *));
+    size_t built = 0;
+    int valid = 1;
+    for (; built < header->nodes; built++) {
+        if (tags[built] == APP) {
+            if (lefts[built] >= built || rights[built] >= built) {
+                valid = 0;
+                break;
+            }
+            nodes[built] = new_node(copy_term(nodes[lefts[built]]),
+                                    copy_term(nodes[rights[built]]));
+        } else if (combinator_index(tags[built]) >= 0) {
+            nodes[built] = new_leaf(tags[built]);
+        } else {
+            valid = 0;
+            break;
+        }
+    }
+
+    soup_t *soup = NULL;
+    if (valid) {
+        char alphabet[sizeof(header->alphabet) + 1] = { 0 };
+        memcpy(alphabet, header->alphabet, sizeof(header->alphabet));
+        soup = new_soup(0, alphabet, 0);
+        if (header->size > soup->capacity) {
+            soup->capacity = soup->next_capacity = header->size;
+            soup->terms = realloc(soup->terms,
+                                  soup->capacity * sizeof(term_t *));
+            soup->next = realloc(soup->next, soup->capacity * sizeof(term_t *));
+        }
+        for (; soup->size < header->size; soup->size++) {
+            uint32_t slot = slots[soup->size];
+            if (slot >= header->nodes) {
+                valid = 0;
+                break;
+            }
+            term_t *term = copy_term(nodes[slot]);
+            soup->terms[soup->size] = term;
+            for (int i = 0; i < COMBINATORS; i++) {
+                soup->counts[i] += term->counts[i];
+            }
+        }
+        // The tallies are recounted from the terms, and must agree:
+        for (int i = 0; i < COMBINATORS; i++) {
+            valid = valid && soup->counts[i] == header->counts[i];
+        }
+    }
+    for (size_t i = 0; i < built; i++) {
+        free_term(nodes[i]);
+    }
+    free(nodes);
+    if (!valid) {
+        free_soup(soup);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    soup->params.p_action = header->p_action;
+    soup->params.p_reduce = header->p_reduce;
+    soup->params.p_fission = header->p_fission;
+    soup->params.p_fusion = header->p_fusion;
+    soup->params.p_break = header->p_break;
+    soup->params.budget.max_steps = header->max_steps;
+    soup->params.budget.max_nodes = header->max_nodes;
+    soup->params.budget.max_bytes = header->max_bytes;
+    soup->params.on_exhausted = header->on_exhausted;
+    soup->rng.state = header->rng;
+    soup->steps = header->steps;
+    soup->time = header->time;
+    soup->events = header->events;
+    soup->exhausted = header->exhausted;
+    for (int i = 0; i < COMBINATORS; i++) {
+        soup->stats.redexes[i] = header->redexes[i];
+        soup->stats.topped_up[i] = header->topped_up[i];
+    }
+    memcpy(soup->stats.reactions, header->reactions,
+           sizeof(soup->stats.reactions));
+    memcpy(soup->stats.results, header->results, sizeof(soup->stats.results));
+    memcpy(soup->stats.seconds, header->seconds, sizeof(soup->stats.seconds));
+    return soup;
+}
+
+soup_t *load_soup(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+    if ((size_t) st.st_size < sizeof(header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // The mapping outlives the descriptor, and is only read front to back:
+    size_t bytes = st.st_size;
+    char *data = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, bytes, MADV_SEQUENTIAL);
+    soup_t *soup = decode_soup(data, bytes);
+    int error = errno;
+    munmap(data, bytes);
+    errno = error;
+    return soup;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "soup.h"
+
+/* Checkpoints of a whole soup, so that a long run can be resumed after a
+ * crash, or an experiment started from where another one left off. A
+ * checkpoint holds the soup's parameters, alphabet, random state, counters,
+ * combinator tallies and statistics, and its terms.
+ *
+ * The terms are stored as flat arrays of nodes, rather than in the flat
+ * encoding of flat.h, which spells out every leaf: terms in a soup share so
+ * many subterms that one with hundreds of millions of leaves may only have a
+ * few thousand distinct nodes. As nodes are hash-consed, each distinct node of
+ * the whole soup is stored once, as a tag that is either its combinator or '@'
+ * for an application, and the numbers of its children, which always come
+ * before it. The soup itself is then an array of node numbers, so a soup of
+ * mostly atoms takes little more than four bytes a term.
+ *
+ * The layout is a fixed header, followed by the left and right children of
+ * each node, the node of each term of the soup, and the tags of the nodes,
+ * each section padded to a multiple of eight bytes. Numbers are stored in the
+ * byte order of the machine that wrote them, and the header records it along
+ * with a version, so that checkpoints that can't be read are rejected rather
+ * than misread. Loading maps the file into memory and builds each node once,
+ * straight from the mapped arrays, without copying or parsing anything.
+ *
+ * Functions that touch files return 1 on success, or 0 on failure with errno
+ * set, where EINVAL means that the file isn't a checkpoint that can be read.
+ */
+
+#define CHECKPOINT_VERSION 1
+
+// Writes a checkpoint of the soup to the given path. It is first written to
+// the path with ".tmp" appended, and only renamed over the path once it is
+// complete and synced to disk, so the path always holds a whole checkpoint,
+// even if the program dies part way through.
+int save_soup(soup_t *soup, const char *path);
+
+// As save_soup, but only encodes the soup on the calling thread, and leaves
+// writing it to a background thread, so the soup can carry on being stepped
+// in the meantime. Waits for the soup's previous checkpoint to be written
+// first, if there is one, and returns 0 if that failed, although this one is
+// still started. Also returns 0 if this one couldn't be started.
+int soup_checkpoint(soup_t *soup, const char *path);
+
+// Waits for the soup's checkpoint in progress, if there is one, to be written.
+// Returns 0 if writing it failed. free_soup also waits for it.
+int soup_checkpoint_wait(soup_t *soup);
+
+// Loads a soup from a checkpoint, running on a single thread. Returns NULL on
+// failure, with errno set. The caller is responsible for freeing the returned
+// soup with free_soup.
+soup_t *load_soup(const char *path);
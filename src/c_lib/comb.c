@@ -1,50 +1,354 @@
 #include "comb.h"
+#include "pool.h"
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Creates a new leaf node. The caller is responsible for freeing the
-// returned node.
+// Terms are hash-consed: every leaf and internal node is interned, so that
+// structurally identical terms are always the same pointer. Internal nodes
+// are keyed by the identity of their children, which is sound precisely
+// because the children are interned too. Leaves are interned for the lifetime
+// of the process, and internal nodes are removed from the table when their
+// last reference is dropped.
+static term_t *leaves[256];
+static term_t **table = NULL; // buckets, chained through node->next
+static size_t table_size = 0; // number of buckets, always a power of two
+static size_t table_count = 0; // number of interned internal nodes
+static _Thread_local size_t allocated = 0; // nodes this thread has created
+
+// In threaded mode, buckets are protected by a fixed set of striped locks,
+// and the table is never resized. A node whose count has dropped to zero
+// stays in its bucket until the thread that freed it unlinks it, and lookups
+// must never revive such a node.
+#define STRIPES 1024
+static pthread_mutex_t stripes[STRIPES];
+static pthread_mutex_t leaf_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+static void init_stripes(void) {
+    for (int i = 0; i < STRIPES; i++) {
+        pthread_mutex_init(&stripes[i], NULL);
+    }
+}
+
+// Returns the structural hash of a node with the given children, which is
+// mixed well enough that the nodes don't end up concentrated in a fraction
+// of the buckets, and that swapping the children changes it.
+static uint64_t hash_node(term_t *left, term_t *right) {
+    uint64_t h = left->hash * 0x9E3779B97F4A7C15ull;
+    h ^= right->hash + 0x632BE59BD9B4E019ull;
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+// Returns the structural hash of a leaf with the given character.
+static uint64_t hash_leaf(char c) {
+    uint64_t h = ((uint64_t) (unsigned char) c + 1) * 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    h *= 0x9E3779B97F4A7C15ull;
+    h ^= h >> 32;
+    return h;
+}
+
+static size_t bucket(uint64_t hash) {
+    return hash & (table_size - 1);
+}
+
+// Resizes the table to the given number of buckets, rehashing every node.
+static void resize_table(size_t size) {
+    size_t old_size = table_size;
+    term_t **old_table = table;
+    table_size = size;
+    table = calloc(table_size, sizeof(term_t *));
+    assert(table != NULL);
+    for (size_t i = 0; i < old_size; i++) {
+        term_t *node = old_table[i];
+        while (node != NULL) {
+            term_t *next = node->next;
+            size_t b = bucket(node->hash);
+            node->next = table[b];
+            table[b] = node;
+            node = next;
+        }
+    }
+    free(old_table);
+}
+
+// Takes a new reference to the given node.
+static inline void retain(term_t *term) {
+    if (threaded) {
+        __atomic_fetch_add(&term->refs, 1, __ATOMIC_RELAXED);
+    } else {
+        term->refs++;
+    }
+}
+
+// Drops a reference to the given node, returning how many are left.
+static inline int drop(term_t *term) {
+    if (threaded) {
+        return __atomic_sub_fetch(&term->refs, 1, __ATOMIC_ACQ_REL);
+    }
+    return --term->refs;
+}
+
+// Takes a new reference to the given node if it is still alive, for lookups
+// in threaded mode. Returns 0 if the node is dead.
+static inline int try_retain(term_t *term) {
+    int refs = __atomic_load_n(&term->refs, __ATOMIC_RELAXED);
+    while (refs > 0) {
+        if (__atomic_compare_exchange_n(&term->refs, &refs, refs + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void begin_threaded(void) {
+    assert(!threaded);
+    pthread_once(&stripes_once, init_stripes);
+
+    // The table can't grow while other threads are using it, so we give it
+    // plenty of headroom up front:
+    size_t size = table_size ? table_size : 1024;
+    while (size < 4 * table_count) {
+        size *= 2;
+    }
+    if (size != table_size) {
+        resize_table(size);
+    }
+    threaded = 1;
+}
+
+void end_threaded(void) {
+    assert(threaded);
+    flush_thread();
+    threaded = 0;
+    size_t size = table_size;
+    while (size <= table_count) {
+        size *= 2;
+    }
+    if (size != table_size) {
+        resize_table(size);
+    }
+}
+
+// Returns the index of the given combinator in "SKIBCW", or -1 if the given
+// character isn't a combinator.
+int combinator_index(char c) {
+    switch (c) {
+        case 'S': return 0;
+        case 'K': return 1;
+        case 'I': return 2;
+        case 'B': return 3;
+        case 'C': return 4;
+        case 'W': return 5;
+        default: return -1;
+    }
+}
+
+// Returns a new reference to the leaf node for the given character. The
+// caller is responsible for freeing the returned node.
 term_t *new_leaf(char c) {
-    term_t *leaf = malloc(sizeof(term_t));
-    leaf->c = c;
-    leaf->is_leaf = 1;
-    leaf->left = NULL;
-    leaf->right = NULL;
+    term_t **slot = &leaves[(unsigned char) c];
+    term_t *leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+        if (threaded) {
+            pthread_mutex_lock(&leaf_lock);
+        }
+        leaf = *slot;
+        if (leaf == NULL) {
+            leaf = alloc_node();
+            leaf->c = c;
+            leaf->is_leaf = 1;
+            leaf->args = 0;
+            leaf->normal = 1;
+            leaf->splits = 0;
+            leaf->refs = 1; // held by the leaf table
+            leaf->left = NULL;
+            leaf->right = NULL;
+            leaf->next = NULL;
+            leaf->size = 1;
+            leaf->hash = hash_leaf(c);
+            memset(leaf->counts, 0, sizeof(leaf->counts));
+            if (combinator_index(c) >= 0) {
+                leaf->counts[combinator_index(c)] = 1;
+            }
+            __atomic_store_n(slot, leaf, __ATOMIC_RELEASE);
+        }
+        if (threaded) {
+            pthread_mutex_unlock(&leaf_lock);
+        }
+    }
+    retain(leaf);
     return leaf;
 }
 
-// Creates a new internal node. The caller is responsible for freeing the
-// returned node.
+// Returns the number of arguments the given combinator needs to reduce, or 0
+// if the given character isn't a combinator.
+static int arity(char c) {
+    switch (c) {
+        case 'S': return 3;
+        case 'K': return 2;
+        case 'I': return 1;
+        case 'B': return 3;
+        case 'C': return 3;
+        case 'W': return 2;
+        default: return 0;
+    }
+}
+
+// Returns whether the given node is itself a redex, meaning its head is a
+// combinator applied to exactly as many arguments as it needs.
+static int is_redex(term_t *node) {
+    if (node->args > 3) {
+        return 0;
+    }
+    term_t *head = node;
+    for (int i = 0; i < node->args; i++) {
+        head = head->left;
+    }
+    return arity(head->c) == node->args;
+}
+
+// Returns a new reference to the internal node with the given children,
+// taking ownership of the caller's references to them. The caller is
+// responsible for freeing the returned node.
 term_t *new_node(term_t *left, term_t *right) {
     assert(left != NULL);
     assert(right != NULL);
-    term_t *node = malloc(sizeof(term_t));
+    if (!threaded && table_count >= table_size) {
+        resize_table(table_size ? table_size * 2 : 1024);
+    }
+
+    // If the node already exists then the references we were given to its
+    // children are redundant, as it already holds its own:
+    uint64_t hash = hash_node(left, right);
+    size_t b = bucket(hash);
+    pthread_mutex_t *stripe = threaded ? &stripes[b % STRIPES] : NULL;
+    if (stripe) {
+        pthread_mutex_lock(stripe);
+    }
+    for (term_t *node = table[b]; node != NULL; node = node->next) {
+        if (node->left == left && node->right == right) {
+            if (!threaded) {
+                node->refs++;
+            } else if (!try_retain(node)) {
+                continue;
+            }
+            if (stripe) {
+                pthread_mutex_unlock(stripe);
+            }
+            free_term(left);
+            free_term(right);
+            return node;
+        }
+    }
+
+    term_t *node = alloc_node();
+    allocated++;
     node->c = '\0';
     node->is_leaf = 0;
+    node->refs = 1;
     node->left = left;
     node->right = right;
+    node->next = table[b];
+    for (int i = 0; i < COMBINATORS; i++) {
+        node->counts[i] = left->counts[i] + right->counts[i];
+    }
+    node->size = left->size + right->size;
+    node->hash = hash;
+    node->args = left->args < UINT8_MAX ? left->args + 1 : UINT8_MAX;
+    node->normal = left->normal && right->normal && !is_redex(node);
+    node->splits = left->splits || (!left->is_leaf && left->right->is_leaf);
+    table[b] = node;
+    if (stripe) {
+        pthread_mutex_unlock(stripe);
+        __atomic_fetch_add(&table_count, 1, __ATOMIC_RELAXED);
+    } else {
+        table_count++;
+    }
     return node;
 }
 
-// Copies the given term. The caller is responsible for freeing the
-// returned term.
+// Copies the given term. As terms are immutable and shared, this just takes
+// a new reference to it. The caller is responsible for freeing the returned
+// term.
 term_t *copy_term(term_t *term) {
-    if (term->is_leaf) {
-        return new_leaf(term->c);
+    assert(term != NULL);
+    retain(term);
+    return term;
+}
+
+// Drops a reference to the given node, and if it was the last one, removes
+// it from the intern table and pushes it onto the list of dead nodes, which
+// is threaded through node->next now that the node is out of the table.
+static void drop_node(term_t *term, term_t **dead) {
+    if (term == NULL || drop(term) > 0) {
+        return;
+    }
+    assert(!term->is_leaf); // leaves are owned by the leaf table
+
+    size_t b = bucket(term->hash);
+    pthread_mutex_t *stripe = threaded ? &stripes[b % STRIPES] : NULL;
+    if (stripe) {
+        pthread_mutex_lock(stripe);
+    }
+    term_t **link = &table[b];
+    while (*link != term) {
+        link = &(*link)->next;
+    }
+    *link = term->next;
+    if (stripe) {
+        pthread_mutex_unlock(stripe);
+        __atomic_fetch_sub(&table_count, 1, __ATOMIC_RELAXED);
     } else {
-        return new_node(copy_term(term->left), copy_term(term->right));
+        table_count--;
     }
+    term->next = *dead;
+    *dead = term;
 }
 
-// Frees the given term node and all of its children.
+// Drops a reference to the given term, freeing it and releasing its children
+// if it was the last one. This works through a list of dead nodes rather than
+// recursing, so freeing arbitrarily deep terms can't overflow the stack.
 void free_term(term_t *term) {
-    if (term == NULL) {
-        return;
+    term_t *dead = NULL;
+    drop_node(term, &dead);
+    while (dead != NULL) {
+        term_t *node = dead;
+        dead = node->next;
+        drop_node(node->left, &dead);
+        drop_node(node->right, &dead);
+        release_node(node);
+    }
+}
+
+uint64_t hash_term(term_t *term) {
+    return term->hash;
+}
+
+// An item on the stack used to print a term: either a subterm to print, with
+// or without surrounding brackets, or the closing bracket of one that was.
+typedef struct print_item {
+    term_t *term; // NULL for a closing bracket
+    int bracket;
+} print_item_t;
+
+// Makes sure there is room for at least extra more bytes in the buffer.
+static void reserve_str(char **str, size_t len, size_t *capacity,
+                        size_t extra) {
+    if (len + extra > *capacity) {
+        while (len + extra > *capacity) {
+            *capacity *= 2;
+        }
+        *str = realloc(*str, *capacity);
+        assert(*str != NULL);
     }
-    free_term(term->left);
-    free_term(term->right);
-    free(term);
 }
 
 // Prints the given term node and all of its children. The output is a
@@ -52,163 +356,206 @@ void free_term(term_t *term) {
 // brackets used to override this. For example, 'Sa(bc)' is the same term as
 // '((Sa)(bc))', with the latter including all of the implied brackets.
 // The caller is responsible for freeing the returned string.
+//
+// The left child is never bracketed, but the right child is if it isn't a
+// leaf. The term is printed iteratively into a single growing buffer, with
+// an explicit stack of the arguments still to be printed, so this is linear
+// in the length of the output and doesn't recurse however deep the term is.
 char *print_term(term_t *term) {
     assert(term != NULL);
+    size_t capacity = 64;
+    size_t len = 0;
+    char *str = malloc(capacity);
+    assert(str != NULL);
 
-    // If the term is a leaf, then it is an atomic term:
-    if (term->is_leaf) {
-        char *str = malloc(2);
-        str[0] = term->c;
-        str[1] = '\0';
-        return str;
-    }
+    scratch_mark_t mark = scratch_mark();
+    size_t stack_capacity = 64;
+    size_t stack_size = 0;
+    print_item_t *stack = scratch_alloc(stack_capacity * sizeof(print_item_t));
+    stack[stack_size++] = (print_item_t) { term, 0 };
+    while (stack_size > 0) {
+        print_item_t item = stack[--stack_size];
+        if (item.term == NULL) {
+            reserve_str(&str, len, &capacity, 1);
+            str[len++] = ')';
+            continue;
+        }
 
-    // Left child is never bracketed, but right child needs to be bracketed 
-    // if it is longer than a single character, by left-associativity.
-    char *left = print_term(term->left);
-    char *right = term->right ? print_term(term->right) : NULL;
-    int len = strlen(left) + (right ? strlen(right) : 0) + 1;
-    if (right && strlen(right) > 1) {
-        len += 2;
-    }
+        // Push the arguments of the spine in reverse, so that the first one is
+        // printed first, along with a closing bracket if this needs one:
+        size_t spine = 0;
+        for (term_t *t = item.term; !t->is_leaf; t = t->left) {
+            spine++;
+        }
+        if (stack_size + spine + 1 > stack_capacity) {
+            while (stack_size + spine + 1 > stack_capacity) {
+                stack_capacity *= 2;
+            }
+            print_item_t *grown = scratch_alloc(stack_capacity *
+                                                sizeof(print_item_t));
+            memcpy(grown, stack, stack_size * sizeof(print_item_t));
+            stack = grown;
+        }
+        if (item.bracket) {
+            stack[stack_size++] = (print_item_t) { NULL, 0 };
+        }
+        term_t *head = item.term;
+        for (; !head->is_leaf; head = head->left) {
+            stack[stack_size++] = (print_item_t) { head->right,
+                                                   !head->right->is_leaf };
+        }
 
-    char *str = malloc(len);
-    strcpy(str, left);
-    if (right && strlen(right) > 1) {
-        strcat(str, "(");
-    }
-    if (right) {
-        strcat(str, right);
-    }
-    if (right && strlen(right) > 1) {
-        strcat(str, ")");
+        reserve_str(&str, len, &capacity, 2);
+        if (item.bracket) {
+            str[len++] = '(';
+        }
+        str[len++] = head->c;
     }
+    scratch_release(mark);
 
-    free(left);
-    free(right);
+    reserve_str(&str, len, &capacity, 1);
+    str[len] = '\0';
     return str;
 }
 
-int validate(const char *str) {
-    assert(str != NULL);
+// Classes of characters in the string representation of terms:
+enum { INVALID, SYMBOL, OPEN, CLOSE };
 
-    // The str must have balanced parentheses, and never close a bracket
-    // before opening one:
-    int count = 0;
-    for (int i = 0; str[i] != '\0'; i++) {
-        if (str[i] == '(') {
-            count++;
-        } else if (str[i] == ')') {
-            count--;
-            if (count < 0) {
-                return 0;
-            }
+static const unsigned char char_class[256] = {
+    ['S'] = SYMBOL, ['K'] = SYMBOL, ['I'] = SYMBOL,
+    ['B'] = SYMBOL, ['C'] = SYMBOL, ['W'] = SYMBOL,
+    ['a' ... 'z'] = SYMBOL,
+    ['('] = OPEN, [')'] = CLOSE,
+};
+
+// Parses the given string into a term node. The caller is responsible for
+// freeing the returned node. Returns NULL if the string is invalid, meaning
+// that it is empty, has unbalanced or empty brackets, or has characters other
+// than combinators, variables and brackets.
+//
+// The string is parsed in a single pass, keeping the term built so far for
+// each open bracket on an explicit stack, and is validated along the way.
+term_t *parse_term(const char *str) {
+    assert(str != NULL);
+    size_t n = strlen(str);
+    scratch_mark_t mark = scratch_mark();
+    term_t **stack = scratch_alloc((n + 1) * sizeof(term_t *));
+    size_t depth = 0;
+    term_t *term = NULL; // the term built so far in the innermost bracket
+    int valid = 1;
+    for (size_t i = 0; valid && i < n; i++) {
+        term_t *item = NULL;
+        switch (char_class[(unsigned char) str[i]]) {
+            case SYMBOL:
+                item = new_leaf(str[i]);
+                break;
+            case OPEN:
+                stack[depth++] = term;
+                term = NULL;
+                break;
+            case CLOSE:
+                valid = depth > 0 && term != NULL;
+                if (valid) {
+                    item = term;
+                    term = stack[--depth];
+                }
+                break;
+            default:
+                valid = 0;
         }
-        if (count < 0) {
-            return 0;
+        if (item != NULL) {
+            term = term == NULL ? item : new_node(term, item);
         }
     }
-    if (count != 0) {
-        return 0;
-    }
 
-    // The str must only contain the allowed characters:
-    for (int i = 0; str[i] != '\0'; i++) {
-        if (str[i] != 'S' && str[i] != 'K' && str[i] != 'I' &&
-            str[i] != 'B' && str[i] != 'C' && str[i] != 'W' &&
-            str[i] != '(' && str[i] != ')' && str[i] != 'a' &&
-            str[i] != 'b' && str[i] != 'c' && str[i] != 'd' &&
-            str[i] != 'e' && str[i] != 'f' && str[i] != 'g' &&
-            str[i] != 'h' && str[i] != 'i' && str[i] != 'j' &&
-            str[i] != 'k' && str[i] != 'l' && str[i] != 'm' &&
-            str[i] != 'n' && str[i] != 'o' && str[i] != 'p' &&
-            str[i] != 'q' && str[i] != 'r' && str[i] != 's' &&
-            str[i] != 't' && str[i] != 'u' && str[i] != 'v' &&
-            str[i] != 'w' && str[i] != 'x' && str[i] != 'y' &&
-            str[i] != 'z') {
-            return 0;
+    if (!valid || depth > 0 || term == NULL) {
+        free_term(term);
+        while (depth > 0) {
+            free_term(stack[--depth]);
         }
+        term = NULL;
     }
-
-    return 1;
+    scratch_release(mark);
+    return term;
 }
 
-// Parses the given string into a term node. The caller is responsible for
-// freeing the returned node. Returns NULL if the string is invalid.
-term_t *parse_term(const char *str) {
-    assert(validate(str));
+// The state of a reduction with a budget. The nodes and bytes used are only
+// added to the budget at the end, and limits are checked against the running
+// totals at each level of the reduction.
+typedef struct reduction {
+    budget_t *budget;
+    size_t allocated; // value of allocated when the reduction started
+    size_t bytes; // bytes of working memory used
+    int result;
+} reduction_t;
 
-    // If the string is empty, then it is an invalid term:
-    if (strlen(str) == 0) {
-        return NULL;
+// Returns whether the reduction has used up its budget, recording why.
+static int exhausted(reduction_t *r) {
+    if (r->result != REDUCE_DONE) {
+        return 1;
     }
-
-    // We walk the string, parsing the terms left-to-right. If we encounter
-    // a bracket, then we parse the contents of the brackets recursively.
-    term_t *term = NULL;
-    for (int i = 0; str[i] != '\0'; i++) {
-        if (str[i] == '(') {
-            // Find the matching closing bracket:
-            int count = 1;
-            int j = i + 1;
-            while (count > 0) {
-                if (str[j] == '(') {
-                    count++;
-                } else if (str[j] == ')') {
-                    count--;
-                }
-                j++;
-            }
-
-            // Parse the contents of the brackets:
-            char *sub = malloc(j - i);
-            strncpy(sub, str + i + 1, j - i - 2);
-            sub[j - i - 2] = '\0';
-            term_t *sub_term = parse_term(sub);
-            free(sub);
-
-            // If the term is empty, then the brackets were invalid:
-            if (sub_term == NULL) {
-                free_term(term);
-                return NULL;
-            }
-
-            // Append the parsed term to the current term:
-            if (term == NULL) {
-                term = sub_term;
-            } else {
-                term_t *node = new_node(term, sub_term);
-                term = node;
-            }
-
-            // Skip the contents of the brackets:
-            i = j - 1;
-        } else {
-            // Create a new leaf node for the current character:
-            term_t *leaf = new_leaf(str[i]);
-
-            // Append the leaf to the current term:
-            if (term == NULL) {
-                term = leaf;
-            } else {
-                term_t *node = new_node(term, leaf);
-                term = node;
-            }
-        }
+    budget_t *b = r->budget;
+    size_t nodes = b->nodes + (allocated - r->allocated);
+    size_t bytes = b->bytes + r->bytes + (allocated - r->allocated) * sizeof(term_t);
+    if (b->max_nodes && nodes > b->max_nodes) {
+        r->result = REDUCE_OUT_OF_NODES;
+    } else if (b->max_bytes && bytes > b->max_bytes) {
+        r->result = REDUCE_OUT_OF_BYTES;
     }
-
-    return term;
+    return r->result != REDUCE_DONE;
 }
 
+static term_t *reduce_node(term_t *term, reduction_t *r);
+
 // Reduces every redex in the given term by a single step, starting from the
 // right-most redex. This function does not mutate the given term, but instead
-// returns a new term. The caller is responsible for freeing the returned term.
+// returns a new term. Arguments that are duplicated by S and W are shared with
+// the original, so this costs time proportional to the spines of the redexes
+// rather than to the size of their arguments. The caller is responsible for
+// freeing the returned term.
 term_t *reduce_term(term_t *term) {
-    assert(term != NULL);
+    budget_t budget = { 0 };
+    term_t *reduced = NULL;
+    reduce_term_within(term, &budget, &reduced);
+    return reduced;
+}
+
+int reduce_term_within(term_t *term, budget_t *budget, term_t **out) {
+    assert(term != NULL && budget != NULL && out != NULL);
+    *out = NULL;
+    if (budget->max_steps && budget->steps >= budget->max_steps) {
+        return REDUCE_OUT_OF_STEPS;
+    }
+    reduction_t r = { budget, allocated, 0, REDUCE_DONE };
+    *out = reduce_node(term, &r);
+    budget->steps++;
+    budget->nodes += allocated - r.allocated;
+    budget->bytes += r.bytes + (allocated - r.allocated) * sizeof(term_t);
+    return r.result;
+}
+
+// Reduces the given term as reduce_term does, returning NULL if the budget
+// runs out partway.
+static term_t *reduce_node(term_t *term, reduction_t *r) {
+    // Terms in normal form, which includes most arguments of a typical
+    // redex, reduce to themselves:
+    if (term->normal) {
+        return copy_term(term);
+    }
 
     // We walk the tree down to the left-most leaf using a stack to keep track
-    // of the right-hand children.
-    term_t **stack = malloc(sizeof(term_t *));
+    // of the right-hand children. The spine is measured first so that the
+    // stack can be taken from the scratch arena in one go.
+    int spine = 0;
+    for (term_t *n = term; !n->is_leaf; n = n->left) {
+        spine++;
+    }
+    r->bytes += spine * sizeof(term_t *);
+    if (exhausted(r)) {
+        return NULL;
+    }
+    scratch_mark_t mark = scratch_mark();
+    term_t **stack = scratch_alloc(spine * sizeof(term_t *));
     term_t *node = term;
     int stack_size = 0;
     while (node != NULL) {
@@ -216,26 +563,21 @@ term_t *reduce_term(term_t *term) {
             break;
         }
 
-        stack = realloc(stack, (stack_size + 1) * sizeof(term_t *));
-        stack[stack_size] = reduce_term(node->right);
+        stack[stack_size] = reduce_node(node->right, r);
+        if (stack[stack_size] == NULL) {
+            while (stack_size > 0) {
+                free_term(stack[--stack_size]);
+            }
+            scratch_release(mark);
+            return NULL;
+        }
         stack_size++;
         node = node->left;
     }
 
-    // If the leaf-node is not a combinator, then we simply reconstruct the
-    // tree from the stack and return it, as we cannot reduce anything:
-    if (node->c != 'S' && node->c != 'K' && node->c != 'I' &&
-        node->c != 'B' && node->c != 'C' && node->c != 'W') {
-        term_t *result = copy_term(node);
-        for (int i = stack_size - 1; i >= 0; i--) {
-            result = new_node(result, stack[i]);
-        }
-        free(stack);
-        return result;
-    }
-
     // If the leaf-node is a combinator, then we can reduce it, assuming there
-    // are enough arguments to apply the corresponding derivation rule:
+    // are enough arguments to apply the corresponding derivation rule.
+    // Otherwise we simply reconstruct the tree from the stack:
     //   Sxyz -> xz(yz)
     //   Kxy  -> x
     //   Ix   -> x
@@ -243,6 +585,7 @@ term_t *reduce_term(term_t *term) {
     //   Cxyz -> xzy
     //   Wxy  -> xyy
     term_t *result;
+    int redex = 1;
     if (node->c == 'S' && stack_size >= 3) {
         result = new_node(
             new_node(
@@ -257,6 +600,7 @@ term_t *reduce_term(term_t *term) {
         stack_size -= 3;
     } else if (node->c == 'K' && stack_size >= 2) {
         result = stack[stack_size - 1];
+        free_term(stack[stack_size - 2]); // K discards its second argument
         stack_size -= 2;
     } else if (node->c == 'I' && stack_size >= 1) {
         result = stack[stack_size - 1];
@@ -290,12 +634,20 @@ term_t *reduce_term(term_t *term) {
         stack_size -= 2;
     } else {
         result = copy_term(node);
+        redex = 0;
+    }
+    if (redex) {
+        r->budget->redexes[combinator_index(node->c)]++;
     }
 
     // Finally, we reconstruct the tree from the remaining stack and return it:
     for (int i = stack_size - 1; i >= 0; i--) {
         result = new_node(result, stack[i]);
     }
-    free(stack);
+    scratch_release(mark);
+    if (exhausted(r)) {
+        free_term(result);
+        return NULL;
+    }
     return result;
 }
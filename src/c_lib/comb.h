@@ -1,4 +1,6 @@
 #pragma once
+#include <stddef.h>
+#include <stdint.h>
 
 /* Terms are represented as strings over the alphabet 'SKIBCW()abc...z', and
  * are required to have balanced parentheses. Uppercase characters are
@@ -18,13 +20,42 @@
  * is either a combinator or a variable. The tree is constructed by parsing
  * the string representation of the term, and then evaluated by traversing
  * the tree left-to-right and applying the appropriate combinators.
+ *
+ * Nodes are allocated from a slab pool and recycled through a free list, so
+ * in steady state creating and freeing terms doesn't touch malloc at all.
+ *
+ * Nodes are also immutable and hash-consed, meaning that structurally equal
+ * terms are always represented by the same node. Two terms are equal if and
+ * only if their pointers are equal, copying a term just takes another
+ * reference to it, and freeing a term drops that reference.
+ *
+ * Every node caches the number of each combinator in it, which is computed
+ * once when the node is created, so that counting never walks the tree. It
+ * also caches the shape of its left spine, whether the term is in normal
+ * form, and whether fission can split it, so that finding out whether a term
+ * can react takes constant time.
+ * Finally, it caches its size and a structural (Merkle) hash, made from its
+ * children's hashes, which depends only on the term and not on where it was
+ * allocated, so it is the same from one run of the program to the next.
  */
 
+// The combinators in the order used to index per-combinator arrays:
+#define COMBINATORS 6
+int combinator_index(char c); // -1 if c isn't a combinator
+
 typedef struct term {
 		char c; // '\0' unless is_leaf
-	  int is_leaf; // 0 if internal node, 1 if leaf
+		char is_leaf; // 0 if internal node, 1 if leaf
+		uint8_t args; // arguments on the left spine, saturating at 255
+		uint8_t normal : 1; // 1 if no subterm is a redex, 0 otherwise
+		uint8_t splits : 1; // 1 if fission can split the term, 0 otherwise
+		int refs; // number of references held to this node
 		struct term *left; // NULL if leaf, not NULL otherwise
 		struct term *right; // NULL if leaf, not NULL otherwise
+		struct term *next; // next node in the same bucket of the intern table
+		uint32_t counts[COMBINATORS]; // number of each combinator in the term
+		uint64_t size; // number of leaves in the term
+		uint64_t hash; // structural hash of the term
 } term_t;
 
 term_t *new_leaf(char c);
@@ -33,7 +64,66 @@ term_t *copy_term(term_t *term);
 void free_term(term_t *term);
 char *print_term(term_t *term);
 term_t *parse_term(const char *str);
+
+// Reduces every redex in the given term by a single step. As terms are
+// hash-consed, the result is the same node as the given term if and only if
+// the step is a fixed point, which includes but isn't limited to normal forms:
+// WWW contracts a redex and comes back as itself. The caller is responsible
+// for freeing the returned term.
 term_t *reduce_term(term_t *term);
 
+// Limits on the resources a reduction may use, along with how much of each
+// has been used so far. Every reduction entry point that takes a budget adds
+// what it uses to the counters, and stops cleanly as soon as a limit would be
+// exceeded, without leaking anything it had built. A limit of 0 means there
+// is no limit. Passing the same budget to several calls limits them in total.
+// The redexes contracted are also counted by combinator, although they aren't
+// limited, as a step of reduce_term can contract many at once.
+typedef struct budget {
+		long max_steps; // reduction steps
+		size_t max_nodes; // nodes allocated
+		size_t max_bytes; // bytes allocated, including working memory
+		long steps;
+		size_t nodes;
+		size_t bytes;
+		long redexes[COMBINATORS]; // redexes contracted of each combinator
+} budget_t;
+
+// Results of a reduction with a budget, which is either done, or has stopped
+// because the limit on steps, nodes or bytes was reached:
+#define REDUCE_DONE 0
+#define REDUCE_OUT_OF_STEPS 1
+#define REDUCE_OUT_OF_NODES 2
+#define REDUCE_OUT_OF_BYTES 3
+
+// As reduce_term, which counts as a single step, but within the given budget.
+// Returns one of the REDUCE_ results, and sets *out to the reduced term if it
+// is REDUCE_DONE, or to NULL otherwise. The caller is responsible for freeing
+// the returned term.
+int reduce_term_within(term_t *term, budget_t *budget, term_t **out);
+
+// Returns the structural hash of the given term, which is equal for equal
+// terms, and the same in every run of the program.
+uint64_t hash_term(term_t *term);
+
+// Memory accounting for the node pool and scratch arena, so that callers can
+// check that allocation has reached a steady state:
+typedef struct term_stats {
+    size_t nodes_alive; // nodes currently owned by some term
+    size_t bytes_alive; // bytes used by those nodes
+    size_t nodes_reserved; // nodes carved out of slabs, alive or free
+    size_t bytes_reserved; // bytes held by slabs
+    size_t scratch_reserved; // bytes held by the scratch arena
+    size_t system_allocs; // number of calls made to malloc so far
+} term_stats_t;
+void term_stats(term_stats_t *stats);
+
+// Scratch memory used while parsing and reducing is normally released at the
+// end of each call. Between these two calls it is instead kept around and
+// dropped all at once, which is cheaper when doing lots of small operations,
+// such as a single step of a soup. Generations may be nested.
+void begin_generation(void);
+void end_generation(void);
+
 // We need to be able to free strings returned by print_term:
 void free(void *ptr);
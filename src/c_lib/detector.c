@@ -0,0 +1,552 @@
+#include "detector.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SKETCH_DEPTH 4
+// What each term is counted by, in both the table and the sketches:
+#define COPIES 0
+#define GAINS 1 // copies gained over the window
+#define LOSSES 2 // copies lost over the window
+#define FIELDS 3
+// The kind of the change in copies of an atom that is topped up:
+#define TOP_UP -1
+
+// Odd multipliers that give each row of a sketch its own hash of a term:
+static const uint64_t ROW_KEYS[SKETCH_DEPTH] = {
+    0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full,
+    0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull,
+};
+
+detector_params_t default_detector_params(void) {
+    return (detector_params_t) {
+        .window = 32,
+        .min_growth = 64,
+        .min_ratio = 2.0,
+        .min_before = 8,
+        .max_exact = 1 << 16,
+        .sketch_width = 1 << 18,
+    };
+}
+
+// A change in the copies of a term in a step, and the reaction that made it.
+typedef struct event {
+    uint64_t hash;
+    int64_t change;
+    int kind; // REACTION_ kind, or TOP_UP
+    uint64_t inputs[2];
+} event_t;
+
+// The events of a step in the window.
+typedef struct slot {
+    event_t *events;
+    size_t count;
+    size_t capacity;
+} slot_t;
+
+// An open-addressed hash table of counts by the hash of their term. Entries
+// are never removed, but the table is rebuilt without those that have dropped
+// to nothing whenever it fills up.
+typedef struct count {
+    uint64_t hash;
+    int64_t fields[FIELDS];
+    int used;
+} count_t;
+
+typedef struct counts {
+    count_t *entries;
+    size_t size; // always a power of two, more than twice the entries used
+    size_t used;
+} counts_t;
+
+// The reactions that produced a replicator, keyed by the replicator, the kind
+// of the reaction and its inputs.
+typedef struct tally {
+    size_t replicator;
+    source_t source;
+    int used;
+} tally_t;
+
+typedef struct found {
+    term_t *term;
+    uint64_t hash;
+    uint64_t first_step;
+    size_t sources;
+} found_t;
+
+struct detector {
+    detector_params_t params;
+    counts_t counts; // exact counts, while entries isn't NULL
+    int64_t *sketch; // [SKETCH_DEPTH][width][FIELDS] otherwise
+    int width_bits;
+    slot_t *window; // events of the last params.window steps
+    uint64_t steps; // steps watched since the window started
+    found_t *found; // replicators, in the order they were flagged
+    size_t found_count;
+    size_t found_capacity;
+    size_t *flagged; // index + 1 of each replicator by hash, or 0 if empty
+    size_t flagged_size; // always a power of two, more than twice found_count
+    tally_t *tallies;
+    size_t tallies_size; // always a power of two
+    size_t tallies_used;
+};
+
+static size_t power_of_two(size_t n) {
+    size_t size = 64;
+    while (size < n) {
+        size *= 2;
+    }
+    return size;
+}
+
+static count_t *find_count(counts_t *counts, uint64_t hash) {
+    size_t mask = counts->size - 1;
+    size_t b = hash & mask;
+    while (counts->entries[b].used && counts->entries[b].hash != hash) {
+        b = (b + 1) & mask;
+    }
+    return &counts->entries[b];
+}
+
+static int live(const count_t *count) {
+    return count->used && (count->fields[COPIES] != 0 ||
+                           count->fields[GAINS] != 0 ||
+                           count->fields[LOSSES] != 0);
+}
+
+static size_t sketch_cell(struct detector *detector, int row, uint64_t hash) {
+    size_t column = (hash * ROW_KEYS[row]) >> (64 - detector->width_bits);
+    return ((size_t) row << detector->width_bits | column) * FIELDS;
+}
+
+static void add_sketch(struct detector *detector, uint64_t hash,
+                       const int64_t *fields) {
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        int64_t *cell = &detector->sketch[sketch_cell(detector, row, hash)];
+        for (int f = 0; f < FIELDS; f++) {
+            cell[f] += fields[f];
+        }
+    }
+}
+
+// Moves the exact counts into sketches, once there are too many of them.
+static void start_sketch(struct detector *detector) {
+    size_t width = power_of_two(detector->params.sketch_width);
+    detector->width_bits = __builtin_ctzll(width);
+    detector->sketch = calloc(SKETCH_DEPTH * width * FIELDS, sizeof(int64_t));
+    assert(detector->sketch != NULL);
+    for (size_t i = 0; i < detector->counts.size; i++) {
+        count_t *count = &detector->counts.entries[i];
+        if (live(count)) {
+            add_sketch(detector, count->hash, count->fields);
+        }
+    }
+    free(detector->counts.entries);
+    detector->counts.entries = NULL;
+}
+
+// Rebuilds the exact counts without the entries that have dropped to nothing,
+// with room to grow, or moves them into sketches if there are too many.
+static void rebuild_counts(struct detector *detector) {
+    counts_t *counts = &detector->counts;
+    size_t n = 0;
+    for (size_t i = 0; i < counts->size; i++) {
+        n += live(&counts->entries[i]);
+    }
+    if (n > detector->params.max_exact) {
+        start_sketch(detector);
+        return;
+    }
+    counts_t rebuilt = { .size = power_of_two(4 * (n + 1)), .used = n };
+    rebuilt.entries = calloc(rebuilt.size, sizeof(count_t));
+    assert(rebuilt.entries != NULL);
+    for (size_t i = 0; i < counts->size; i++) {
+        if (live(&counts->entries[i])) {
+            *find_count(&rebuilt, counts->entries[i].hash) = counts->entries[i];
+        }
+    }
+    free(counts->entries);
+    *counts = rebuilt;
+}
+
+static void add_counts(struct detector *detector, uint64_t hash,
+                       const int64_t *fields) {
+    if (detector->counts.entries == NULL) {
+        add_sketch(detector, hash, fields);
+        return;
+    }
+    count_t *count = find_count(&detector->counts, hash);
+    if (!count->used) {
+        if (2 * (detector->counts.used + 1) > detector->counts.size) {
+            rebuild_counts(detector);
+            add_counts(detector, hash, fields);
+            return;
+        }
+        count->used = 1;
+        count->hash = hash;
+        detector->counts.used++;
+    }
+    for (int f = 0; f < FIELDS; f++) {
+        count->fields[f] += fields[f];
+    }
+}
+
+// Sets fields to the counts of the given term, or to estimates that are
+// never lower than them, once the counts are sketched.
+static void get_counts(struct detector *detector, uint64_t hash,
+                       int64_t *fields) {
+    if (detector->counts.entries != NULL) {
+        count_t *count = find_count(&detector->counts, hash);
+        for (int f = 0; f < FIELDS; f++) {
+            fields[f] = count->used ? count->fields[f] : 0;
+        }
+        return;
+    }
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        int64_t *cell = &detector->sketch[sketch_cell(detector, row, hash)];
+        for (int f = 0; f < FIELDS; f++) {
+            if (row == 0 || cell[f] < fields[f]) {
+                fields[f] = cell[f];
+            }
+        }
+    }
+}
+
+// Adds an event to the current step, or takes one leaving the window away.
+static void count_event(struct detector *detector, const event_t *event,
+                        int sign) {
+    int64_t fields[FIELDS] = { 0 };
+    if (sign > 0) {
+        fields[COPIES] = event->change;
+    }
+    if (event->change > 0) {
+        fields[GAINS] = sign * event->change;
+    } else {
+        fields[LOSSES] = -sign * event->change;
+    }
+    add_counts(detector, event->hash, fields);
+}
+
+// Recounts the soup's terms from scratch, exactly if there are few enough
+// distinct ones, and empties the window.
+static void count_soup(struct detector *detector, soup_t *soup) {
+    free(detector->counts.entries);
+    free(detector->sketch);
+    detector->sketch = NULL;
+    detector->counts.size = 64;
+    detector->counts.used = 0;
+    detector->counts.entries = calloc(detector->counts.size, sizeof(count_t));
+    assert(detector->counts.entries != NULL);
+    for (size_t i = 0; i < soup->size; i++) {
+        int64_t fields[FIELDS] = { 1, 0, 0 };
+        add_counts(detector, soup->terms[i]->hash, fields);
+    }
+    for (int i = 0; i < detector->params.window; i++) {
+        detector->window[i].count = 0;
+    }
+    detector->steps = 0;
+}
+
+// Returns the index of the replicator with the given hash, or -1 if it hasn't
+// been flagged.
+static int64_t find_flagged(struct detector *detector, uint64_t hash) {
+    size_t mask = detector->flagged_size - 1;
+    for (size_t b = hash & mask; detector->flagged[b] != 0;
+         b = (b + 1) & mask) {
+        if (detector->found[detector->flagged[b] - 1].hash == hash) {
+            return detector->flagged[b] - 1;
+        }
+    }
+    return -1;
+}
+
+static uint64_t tally_hash(size_t replicator, const source_t *source) {
+    uint64_t h = replicator * ROW_KEYS[0] ^ (uint64_t) source->kind;
+    h = (h ^ source->inputs[0]) * ROW_KEYS[1];
+    h = (h ^ source->inputs[1]) * ROW_KEYS[2];
+    return h ^ (h >> 29);
+}
+
+static tally_t *find_tally(struct detector *detector, size_t replicator,
+                           const source_t *source) {
+    size_t mask = detector->tallies_size - 1;
+    size_t b = tally_hash(replicator, source) & mask;
+    while (detector->tallies[b].used) {
+        tally_t *tally = &detector->tallies[b];
+        if (tally->replicator == replicator &&
+            tally->source.kind == source->kind &&
+            tally->source.inputs[0] == source->inputs[0] &&
+            tally->source.inputs[1] == source->inputs[1]) {
+            break;
+        }
+        b = (b + 1) & mask;
+    }
+    return &detector->tallies[b];
+}
+
+// Credits a copy of a replicator to the reaction that produced it.
+static void add_source(struct detector *detector, size_t replicator,
+                       const event_t *event) {
+    if (2 * (detector->tallies_used + 1) > detector->tallies_size) {
+        tally_t *tallies = detector->tallies;
+        size_t size = detector->tallies_size;
+        detector->tallies_size *= 2;
+        detector->tallies = calloc(detector->tallies_size, sizeof(tally_t));
+        assert(detector->tallies != NULL);
+        for (size_t i = 0; i < size; i++) {
+            if (tallies[i].used) {
+                *find_tally(detector, tallies[i].replicator,
+                            &tallies[i].source) = tallies[i];
+            }
+        }
+        free(tallies);
+    }
+    source_t source = {
+        .kind = event->kind,
+        .inputs = { event->inputs[0], event->inputs[1] },
+    };
+    tally_t *tally = find_tally(detector, replicator, &source);
+    if (!tally->used) {
+        tally->used = 1;
+        tally->replicator = replicator;
+        tally->source = source;
+        detector->tallies_used++;
+        detector->found[replicator].sources++;
+    }
+    tally->source.copies += event->change;
+}
+
+// Flags the given term as a replicator, crediting the reactions in the window
+// that produced it.
+static void flag(struct detector *detector, soup_t *soup, term_t *term) {
+    if (2 * (detector->found_count + 1) > detector->flagged_size) {
+        free(detector->flagged);
+        detector->flagged_size *= 2;
+        detector->flagged = calloc(detector->flagged_size, sizeof(size_t));
+        assert(detector->flagged != NULL);
+        size_t mask = detector->flagged_size - 1;
+        for (size_t i = 0; i < detector->found_count; i++) {
+            size_t b = detector->found[i].hash & mask;
+            while (detector->flagged[b] != 0) {
+                b = (b + 1) & mask;
+            }
+            detector->flagged[b] = i + 1;
+        }
+    }
+    if (detector->found_count == detector->found_capacity) {
+        detector->found_capacity *= 2;
+        detector->found = realloc(detector->found,
+                                  detector->found_capacity * sizeof(found_t));
+        assert(detector->found != NULL);
+    }
+    size_t i = detector->found_count++;
+    detector->found[i] = (found_t) {
+        .term = copy_term(term),
+        .hash = term->hash,
+        .first_step = soup->steps,
+    };
+    size_t mask = detector->flagged_size - 1;
+    size_t b = term->hash & mask;
+    while (detector->flagged[b] != 0) {
+        b = (b + 1) & mask;
+    }
+    detector->flagged[b] = i + 1;
+
+    int window = detector->params.window;
+    for (int s = 0; s < window; s++) {
+        slot_t *slot = &detector->window[s];
+        for (size_t e = 0; e < slot->count; e++) {
+            event_t *event = &slot->events[e];
+            if (event->hash == term->hash && event->change > 0 &&
+                event->kind != TOP_UP) {
+                add_source(detector, i, event);
+            }
+        }
+    }
+}
+
+static void push_event(slot_t *slot, uint64_t hash, int64_t change, int kind,
+                       const uint64_t *inputs) {
+    if (slot->count == slot->capacity) {
+        slot->capacity = slot->capacity ? 2 * slot->capacity : 64;
+        slot->events = realloc(slot->events, slot->capacity * sizeof(event_t));
+        assert(slot->events != NULL);
+    }
+    event_t *event = &slot->events[slot->count++];
+    event->hash = hash;
+    event->change = change;
+    event->kind = kind;
+    event->inputs[0] = inputs != NULL ? inputs[0] : 0;
+    event->inputs[1] = inputs != NULL ? inputs[1] : 0;
+}
+
+void detect_step(soup_t *soup, size_t reactions, const uint64_t *topped_up) {
+    struct detector *detector = soup->detector;
+    if (detector == NULL) {
+        return;
+    }
+
+    // The oldest step leaves the window, and its slot is reused:
+    slot_t *slot = &detector->window[detector->steps % detector->params.window];
+    for (size_t e = 0; e < slot->count; e++) {
+        count_event(detector, &slot->events[e], -1);
+    }
+    slot->count = 0;
+
+    // Reactions that leave a term as it was, like reducing a term in normal
+    // form, change nothing, and would only water down the sources:
+    for (size_t i = 0; i < reactions; i++) {
+        reaction_t *r = &soup->reactions[i];
+        if (r->inputs[1] == NULL && r->outputs[1] == NULL &&
+            r->outputs[0] != NULL && r->outputs[0]->hash == r->hashes[0]) {
+            continue;
+        }
+        for (int j = 0; j < 2 && r->inputs[j] != NULL; j++) {
+            push_event(slot, r->hashes[j], -1, r->kind, NULL);
+        }
+        for (int j = 0; j < 2 && r->outputs[j] != NULL; j++) {
+            push_event(slot, r->outputs[j]->hash, 1, r->kind, r->hashes);
+        }
+    }
+    for (const char *c = soup->alphabet; *c != '\0'; c++) {
+        uint64_t k = topped_up[combinator_index(*c)];
+        if (k > 0) {
+            // Leaves are never freed, so this one outlives the reference:
+            term_t *leaf = new_leaf(*c);
+            push_event(slot, leaf->hash, k, TOP_UP, NULL);
+            free_term(leaf);
+        }
+    }
+    for (size_t e = 0; e < slot->count; e++) {
+        event_t *event = &slot->events[e];
+        count_event(detector, event, 1);
+        int64_t found = event->change > 0 && event->kind != TOP_UP
+                            ? find_flagged(detector, event->hash) : -1;
+        if (found >= 0) {
+            add_source(detector, found, event);
+        }
+    }
+    detector->steps++;
+
+    // Only terms that gained copies in this step can have started growing
+    // fast enough to be flagged. Until a whole window has passed since the
+    // detector started counting, the soup is still settling from whatever it
+    // was then, and the terms it has only just started making, such as the
+    // first fusions of its atoms, would all look like they were growing:
+    detector_params_t *p = &detector->params;
+    if (detector->steps < 2 * (uint64_t) p->window) {
+        return;
+    }
+    for (size_t i = 0; i < reactions; i++) {
+        reaction_t *r = &soup->reactions[i];
+        for (int j = 0; j < 2 && r->outputs[j] != NULL; j++) {
+            term_t *term = r->outputs[j];
+            if (term->is_leaf || find_flagged(detector, term->hash) >= 0) {
+                continue;
+            }
+            int64_t fields[FIELDS];
+            get_counts(detector, term->hash, fields);
+            int64_t growth = fields[GAINS] - fields[LOSSES];
+            int64_t before = fields[COPIES] - growth;
+            // A term with next to no copies at the start of the window grows
+            // by any ratio at all, so it needs a few to be measured against:
+            if (growth >= (int64_t) p->min_growth &&
+                before >= (int64_t) p->min_before &&
+                fields[COPIES] >= p->min_ratio * before) {
+                flag(detector, soup, term);
+            }
+        }
+    }
+}
+
+void detect_restart(soup_t *soup) {
+    if (soup->detector != NULL) {
+        count_soup(soup->detector, soup);
+    }
+}
+
+void soup_detect(soup_t *soup, detector_params_t params) {
+    assert(soup != NULL && params.window > 0 && params.sketch_width > 0);
+    soup_detect_stop(soup);
+    struct detector *detector = calloc(1, sizeof(struct detector));
+    assert(detector != NULL);
+    detector->params = params;
+    detector->window = calloc(params.window, sizeof(slot_t));
+    detector->found_capacity = 16;
+    detector->found = malloc(detector->found_capacity * sizeof(found_t));
+    detector->flagged_size = 64;
+    detector->flagged = calloc(detector->flagged_size, sizeof(size_t));
+    detector->tallies_size = 64;
+    detector->tallies = calloc(detector->tallies_size, sizeof(tally_t));
+    assert(detector->window != NULL && detector->found != NULL &&
+           detector->flagged != NULL && detector->tallies != NULL);
+    count_soup(detector, soup);
+    soup->detector = detector;
+}
+
+void soup_detect_stop(soup_t *soup) {
+    struct detector *detector = soup->detector;
+    if (detector == NULL) {
+        return;
+    }
+    for (int i = 0; i < detector->params.window; i++) {
+        free(detector->window[i].events);
+    }
+    for (size_t i = 0; i < detector->found_count; i++) {
+        free_term(detector->found[i].term);
+    }
+    free(detector->window);
+    free(detector->counts.entries);
+    free(detector->sketch);
+    free(detector->found);
+    free(detector->flagged);
+    free(detector->tallies);
+    free(detector);
+    soup->detector = NULL;
+}
+
+size_t soup_replicators(soup_t *soup) {
+    return soup->detector != NULL ? soup->detector->found_count : 0;
+}
+
+void soup_replicator(soup_t *soup, size_t i, replicator_t *out) {
+    struct detector *detector = soup->detector;
+    assert(detector != NULL && i < detector->found_count);
+    found_t *found = &detector->found[i];
+    int64_t fields[FIELDS];
+    get_counts(detector, found->hash, fields);
+    out->term = copy_term(found->term);
+    out->first_step = found->first_step;
+    out->copies = fields[COPIES] > 0 ? fields[COPIES] : 0;
+    out->growth = fields[GAINS] - fields[LOSSES];
+    out->sources = found->sources;
+}
+
+static int by_copies(const void *a, const void *b) {
+    uint64_t x = ((const source_t *) a)->copies;
+    uint64_t y = ((const source_t *) b)->copies;
+    return (x < y) - (x > y);
+}
+
+size_t soup_replicator_sources(soup_t *soup, size_t i, source_t *out,
+                               size_t max) {
+    struct detector *detector = soup->detector;
+    assert(detector != NULL && i < detector->found_count);
+    size_t n = detector->found[i].sources;
+    source_t *sources = malloc((n ? n : 1) * sizeof(source_t));
+    assert(sources != NULL);
+    size_t count = 0;
+    for (size_t t = 0; t < detector->tallies_size; t++) {
+        if (detector->tallies[t].used && detector->tallies[t].replicator == i) {
+            sources[count++] = detector->tallies[t].source;
+        }
+    }
+    assert(count == n);
+    qsort(sources, count, sizeof(source_t), by_copies);
+    count = count < max ? count : max;
+    if (count > 0) {
+        memcpy(out, sources, count * sizeof(source_t));
+    }
+    free(sources);
+    return count;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "soup.h"
+
+/* Incremental detection of self-replicators in a soup, by watching how many
+ * copies of each distinct term it holds, rather than by reducing every term
+ * to find the ones that never normalise.
+ *
+ * After each step, the detector adds up the change in copies of each term,
+ * by structural hash, from the step's reactions and top-ups, so it costs time
+ * in proportion to the reactions rather than to the soup. The changes of the
+ * last few steps are kept in a ring, and a term is flagged as a replicator
+ * when, over that window, it has gained at least min_growth copies, and its
+ * copies have grown by at least a factor of min_ratio from at least
+ * min_before. Nothing is flagged until two windows have passed since the
+ * detector started, as terms the soup has only just started making, like the
+ * first fusions of its atoms, grow from nothing in the first. Atoms are never
+ * flagged, as they are topped up regardless.
+ *
+ * Copies, and the copies gained and lost over the window, are counted
+ * exactly in a hash table while the soup has few distinct terms. Once it has
+ * more than max_exact, which a soup of large terms soon does, they are moved
+ * into count-min sketches of a fixed size instead. Their estimates are only
+ * off by a small fraction of all the copies counted, which matters little for
+ * the abundant terms that replicators make, but may get the odd rare term
+ * flagged by mistake.
+ *
+ * Each replicator also records the reactions that produced its copies, from
+ * the window before it was flagged onwards, as the kind of the reaction and
+ * the hashes of its inputs, which have usually been used up by then. The
+ * inputs of a replicator's sources are often replicators themselves.
+ *
+ * soup_run isn't watched reaction by reaction. Instead, when it returns, the
+ * detector recounts the soup and starts its window again.
+ */
+
+// Tunable parameters of the detector.
+typedef struct detector_params {
+		int window; // steps over which growth is measured
+		uint64_t min_growth; // fewest copies gained over the window
+		double min_ratio; // least factor by which copies grow over it
+		uint64_t min_before; // fewest copies at the start of the window
+		size_t max_exact; // most distinct terms to count exactly
+		size_t sketch_width; // counters in each row of the sketches
+} detector_params_t;
+
+// A term flagged as a replicator. Copies and growth are those at the time it
+// is returned, and may be estimates.
+typedef struct replicator {
+		term_t *term;
+		uint64_t first_step; // step it was flagged in
+		uint64_t copies; // copies in the soup
+		int64_t growth; // net copies gained over the window
+		size_t sources; // distinct reactions that produced it
+} replicator_t;
+
+// Reactions that produced copies of a replicator, with the same kind and
+// inputs. Inputs that aren't there, as for fission, have a hash of 0.
+typedef struct source {
+		int kind; // one of the REACTION_ kinds
+		uint64_t inputs[2]; // structural hashes of the inputs
+		uint64_t copies; // copies of the replicator produced
+} source_t;
+
+// Returns the default parameters of the detector.
+detector_params_t default_detector_params(void);
+
+// Starts detecting replicators in the soup, counting its current terms.
+// Replaces any detector the soup already has, forgetting its replicators.
+void soup_detect(soup_t *soup, detector_params_t params);
+
+// Stops detecting replicators in the soup, if it is, and forgets them.
+// free_soup also stops it.
+void soup_detect_stop(soup_t *soup);
+
+// Returns the number of replicators flagged so far, which is 0 if the soup
+// has no detector.
+size_t soup_replicators(soup_t *soup);
+
+// Sets *out to the ith replicator, in the order they were flagged. The caller
+// is responsible for freeing out->term.
+void soup_replicator(soup_t *soup, size_t i, replicator_t *out);
+
+// Sets out to up to max of the reactions that produced the ith replicator,
+// those that produced the most copies first. Returns the number set.
+size_t soup_replicator_sources(soup_t *soup, size_t i, source_t *out,
+                               size_t max);
+
+// These are called by the soup itself: detect_step after each step, with the
+// number of its reactions and the atoms of each combinator topped up, and
+// detect_restart whenever the soup has changed in some other way.
+void detect_step(soup_t *soup, size_t reactions, const uint64_t *topped_up);
+void detect_restart(soup_t *soup);
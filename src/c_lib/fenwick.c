@@ -0,0 +1,46 @@
+#include "fenwick.h"
+#include <assert.h>
+#include <stdlib.h>
+
+void init_fenwick(fenwick_t *fenwick, size_t capacity) {
+    fenwick->capacity = 1;
+    while (fenwick->capacity < capacity) {
+        fenwick->capacity *= 2;
+    }
+    fenwick->tree = calloc(fenwick->capacity + 1, sizeof(uint64_t));
+    assert(fenwick->tree != NULL);
+    fenwick->total = 0;
+}
+
+void free_fenwick(fenwick_t *fenwick) {
+    free(fenwick->tree);
+    fenwick->tree = NULL;
+}
+
+void add_fenwick(fenwick_t *fenwick, size_t i, uint64_t delta) {
+    assert(i < fenwick->capacity);
+    for (i++; i <= fenwick->capacity; i += i & -i) {
+        fenwick->tree[i] += delta;
+    }
+    fenwick->total += delta;
+}
+
+uint64_t prefix_fenwick(const fenwick_t *fenwick, size_t n) {
+    uint64_t sum = 0;
+    for (; n > 0; n -= n & -n) {
+        sum += fenwick->tree[n];
+    }
+    return sum;
+}
+
+size_t find_fenwick(const fenwick_t *fenwick, uint64_t r) {
+    assert(r < fenwick->total);
+    size_t pos = 0;
+    for (size_t step = fenwick->capacity; step > 0; step >>= 1) {
+        if (pos + step <= fenwick->capacity && fenwick->tree[pos + step] <= r) {
+            pos += step;
+            r -= fenwick->tree[pos];
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* A Fenwick tree of integer weights, for drawing an index at random with
+ * probability proportional to its weight. Updating a weight and drawing an
+ * index both take time logarithmic in the capacity.
+ */
+
+typedef struct fenwick {
+		uint64_t *tree; // partial sums, indexed from 1
+		size_t capacity; // number of weights, always a power of two
+		uint64_t total; // sum of all the weights
+} fenwick_t;
+
+// Initialises a tree with room for at least the given number of weights, all
+// of which start at zero, or resets an existing tree that was freed.
+void init_fenwick(fenwick_t *fenwick, size_t capacity);
+void free_fenwick(fenwick_t *fenwick);
+
+// Adds delta to the ith weight. Weights are unsigned, but adding a delta that
+// has wrapped around subtracts it, as long as the weight doesn't go negative.
+void add_fenwick(fenwick_t *fenwick, size_t i, uint64_t delta);
+
+// Returns the sum of the first n weights.
+uint64_t prefix_fenwick(const fenwick_t *fenwick, size_t n);
+
+// Returns the index whose weight covers r, meaning the smallest i such that
+// the sum of the first i + 1 weights is more than r. Drawing r uniformly from
+// [0, total) draws each index with probability proportional to its weight.
+size_t find_fenwick(const fenwick_t *fenwick, uint64_t r);
@@ -0,0 +1,473 @@
+#include "flat.h"
+#include "pool.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define APP '@'
+
+flat_t *new_flat(void) {
+    flat_t *flat = malloc(sizeof(flat_t));
+    assert(flat != NULL);
+    flat->tags = NULL;
+    flat->sizes = NULL;
+    flat->len = 0;
+    flat->capacity = 0;
+    return flat;
+}
+
+void free_flat(flat_t *flat) {
+    if (flat == NULL) {
+        return;
+    }
+    free(flat->tags);
+    free(flat->sizes);
+    free(flat);
+}
+
+// Makes room for at least n more cells at the end of the given term.
+static void reserve(flat_t *flat, int n) {
+    if (flat->len + n <= flat->capacity) {
+        return;
+    }
+    int capacity = flat->capacity ? flat->capacity : 16;
+    while (capacity < flat->len + n) {
+        capacity *= 2;
+    }
+    flat->tags = realloc(flat->tags, capacity);
+    flat->sizes = realloc(flat->sizes, capacity * sizeof(int));
+    assert(flat->tags != NULL && flat->sizes != NULL);
+    flat->capacity = capacity;
+}
+
+// Appends a cell to the given term, which must have room for it.
+static void push(flat_t *flat, char tag, int size) {
+    assert(flat->len < flat->capacity);
+    flat->tags[flat->len] = tag;
+    flat->sizes[flat->len] = size;
+    flat->len++;
+}
+
+static int is_symbol(char c) {
+    return c == 'S' || c == 'K' || c == 'I' || c == 'B' || c == 'C' ||
+        c == 'W' || (c >= 'a' && c <= 'z');
+}
+
+// A bracketed group of k items is laid out as k - 1 applications followed by
+// the items themselves. The outermost application covers all k items, and
+// the innermost only the first two.
+typedef struct group {
+    int apps; // offset of the group's first application
+    int items; // number of items in the group
+    int seen; // number of items emitted so far
+} group_t;
+
+// Marks another item of the given group as complete, which completes the
+// application that covers it as the last item.
+static void item_done(group_t *group, flat_t *out) {
+    group->seen++;
+    if (group->seen >= 2) {
+        int app = group->apps + group->items - group->seen;
+        out->sizes[app] = out->len - app;
+    }
+}
+
+int parse_flat(const char *str, flat_t *out) {
+    assert(str != NULL);
+    out->len = 0;
+    int n = strlen(str);
+
+    // The first pass validates the string and counts the items in each group,
+    // where groups are numbered by the order their brackets open in, and the
+    // top-level of the term is group 0:
+    scratch_mark_t mark = scratch_mark();
+    int *items = scratch_alloc((n + 1) * sizeof(int));
+    int *stack = scratch_alloc((n + 1) * sizeof(int));
+    int depth = 0, groups = 1, leaves = 0;
+    stack[0] = 0;
+    items[0] = 0;
+    for (int i = 0; i < n; i++) {
+        if (str[i] == '(') {
+            items[stack[depth]]++;
+            stack[++depth] = groups;
+            items[groups++] = 0;
+        } else if (str[i] == ')') {
+            if (depth == 0 || items[stack[depth]] == 0) {
+                scratch_release(mark);
+                return 0;
+            }
+            depth--;
+        } else if (is_symbol(str[i])) {
+            items[stack[depth]]++;
+            leaves++;
+        } else {
+            scratch_release(mark);
+            return 0;
+        }
+    }
+    if (depth != 0 || items[0] == 0) {
+        scratch_release(mark);
+        return 0;
+    }
+
+    // Every group of k items needs k - 1 applications, so there's one less
+    // application than there are items overall, per group:
+    int cells = leaves;
+    for (int g = 0; g < groups; g++) {
+        cells += items[g] - 1;
+    }
+    reserve(out, cells);
+
+    // The second pass emits the cells, using the counts to lay out each group
+    // as soon as it opens:
+    group_t *open = scratch_alloc((n + 1) * sizeof(group_t));
+    depth = 0;
+    groups = 1;
+    open[0] = (group_t) { out->len, items[0], 0 };
+    for (int a = 1; a < items[0]; a++) {
+        push(out, APP, 0);
+    }
+    for (int i = 0; i < n; i++) {
+        if (str[i] == '(') {
+            int g = groups++;
+            open[++depth] = (group_t) { out->len, items[g], 0 };
+            for (int a = 1; a < items[g]; a++) {
+                push(out, APP, 0);
+            }
+        } else if (str[i] == ')') {
+            depth--;
+            item_done(&open[depth], out);
+        } else {
+            push(out, str[i], 1);
+            item_done(&open[depth], out);
+        }
+    }
+
+    assert(out->len == cells);
+    scratch_release(mark);
+    return 1;
+}
+
+char *print_flat(const flat_t *flat) {
+    assert(flat != NULL && flat->len > 0);
+
+    // Right children that are applications need brackets. We mark them as we
+    // pass their parents, and keep a stack of where the open brackets end:
+    scratch_mark_t mark = scratch_mark();
+    char *bracketed = scratch_alloc(flat->len);
+    int *ends = scratch_alloc(flat->len * sizeof(int));
+    memset(bracketed, 0, flat->len);
+    int depth = 0;
+
+    // There are at most half as many applications as cells, and each one adds
+    // at most two brackets to the leaves:
+    char *str = malloc(flat->len + flat->len / 2 + 2);
+    int pos = 0;
+    for (int i = 0; i < flat->len; i++) {
+        if (bracketed[i]) {
+            str[pos++] = '(';
+            ends[depth++] = i + flat->sizes[i];
+        }
+        if (flat->tags[i] == APP) {
+            int right = i + 1 + flat->sizes[i + 1];
+            if (flat->tags[right] == APP) {
+                bracketed[right] = 1;
+            }
+        } else {
+            str[pos++] = flat->tags[i];
+            while (depth > 0 && ends[depth - 1] == i + 1) {
+                str[pos++] = ')';
+                depth--;
+            }
+        }
+    }
+    str[pos] = '\0';
+
+    scratch_release(mark);
+    return str;
+}
+
+int walk_flat_spine(const flat_t *flat, int offset, int *args) {
+    int n = 0;
+    while (flat->tags[offset + n] == APP) {
+        n++;
+    }
+    if (args != NULL) {
+        // The head is a leaf, so the first argument comes right after it and
+        // the rest follow one after the other:
+        int arg = offset + n + 1;
+        for (int i = 0; i < n; i++) {
+            args[i] = arg;
+            arg += flat->sizes[arg];
+        }
+    }
+    return n;
+}
+
+// Returns the preorder layout of the result of the given combinator, where
+// digits refer to its arguments, and sets arity to the number of arguments
+// it consumes. Returns NULL if the character isn't a combinator.
+static const char *rule(char c, int *arity) {
+    switch (c) {
+        case 'S': *arity = 3; return "@@02@12"; // Sxyz -> xz(yz)
+        case 'K': *arity = 2; return "0"; // Kxy  -> x
+        case 'I': *arity = 1; return "0"; // Ix   -> x
+        case 'B': *arity = 3; return "@0@12"; // Bxyz -> x(yz)
+        case 'C': *arity = 3; return "@@021"; // Cxyz -> xzy
+        case 'W': *arity = 2; return "@@011"; // Wxy  -> xyy
+        default: return NULL;
+    }
+}
+
+// The state of a reduction of a flat term with a budget. Once the budget runs
+// out, nothing more is written to the output, which is discarded.
+typedef struct reduction {
+    const flat_t *flat;
+    budget_t *budget;
+    int result;
+} reduction_t;
+
+// Makes room for n more cells at the end of out, as reserve does, if the
+// budget allows for them. Returns 0 if it doesn't, or has already run out.
+static int grow(reduction_t *r, flat_t *out, int n) {
+    if (r->result != REDUCE_DONE) {
+        return 0;
+    }
+    budget_t *b = r->budget;
+    size_t cells = out->len + n;
+    if (b->max_nodes && b->nodes + cells > b->max_nodes) {
+        r->result = REDUCE_OUT_OF_NODES;
+        return 0;
+    }
+    if (b->max_bytes && b->bytes + cells * (1 + sizeof(int)) > b->max_bytes) {
+        r->result = REDUCE_OUT_OF_BYTES;
+        return 0;
+    }
+    reserve(out, n);
+    return 1;
+}
+
+static void reduce_at(reduction_t *r, int offset, flat_t *out);
+
+// Emits the subtree of a rule's layout starting at layout, and returns the
+// remainder of the layout. Each argument is reduced the first time it is
+// emitted, and copied from that first emission after that. The whole layout
+// is walked even once the budget has run out, so that the remainder is right.
+static const char *emit_rule(reduction_t *r, const int *args,
+                             const char *layout, int *emitted, flat_t *out) {
+    if (*layout == APP) {
+        int app = out->len;
+        int grown = grow(r, out, 1);
+        if (grown) {
+            push(out, APP, 0);
+        }
+        layout = emit_rule(r, args, layout + 1, emitted, out);
+        layout = emit_rule(r, args, layout, emitted, out);
+        if (grown) {
+            out->sizes[app] = out->len - app;
+        }
+        return layout;
+    }
+
+    int i = *layout - '0';
+    if (emitted[i] < 0) {
+        emitted[i] = out->len;
+        reduce_at(r, args[i], out);
+    } else if (r->result == REDUCE_DONE) {
+        int len = out->sizes[emitted[i]];
+        if (grow(r, out, len)) {
+            memcpy(out->tags + out->len, out->tags + emitted[i], len);
+            memcpy(out->sizes + out->len, out->sizes + emitted[i],
+                   len * sizeof(int));
+            out->len += len;
+        }
+    }
+    return layout + 1;
+}
+
+// Appends the reduction of the subterm at the given offset to out.
+static void reduce_at(reduction_t *r, int offset, flat_t *out) {
+    const flat_t *flat = r->flat;
+    if (r->result != REDUCE_DONE) {
+        return;
+    }
+    scratch_mark_t mark = scratch_mark();
+    int n = walk_flat_spine(flat, offset, NULL);
+    int *args = scratch_alloc(n * sizeof(int));
+    walk_flat_spine(flat, offset, args);
+
+    int arity = 0;
+    const char *layout = rule(flat->tags[offset + n], &arity);
+    if (layout == NULL || n < arity) {
+        layout = NULL;
+        arity = 0;
+    } else {
+        r->budget->redexes[combinator_index(flat->tags[offset + n])]++;
+    }
+
+    // Arguments that aren't consumed by the head are applied to its result,
+    // so they need an application each in front of it:
+    int rest = n - arity;
+    if (!grow(r, out, rest + 1)) {
+        scratch_release(mark);
+        return;
+    }
+    int apps = out->len;
+    for (int i = 0; i < rest; i++) {
+        push(out, APP, 0);
+    }
+    if (layout != NULL) {
+        int emitted[3] = { -1, -1, -1 };
+        emit_rule(r, args, layout, emitted, out);
+    } else {
+        push(out, flat->tags[offset + n], 1);
+    }
+    for (int i = 0; i < rest; i++) {
+        reduce_at(r, args[arity + i], out);
+        int app = apps + rest - 1 - i;
+        out->sizes[app] = out->len - app;
+    }
+
+    scratch_release(mark);
+}
+
+int reduce_flat(const flat_t *flat, budget_t *budget, flat_t *out) {
+    assert(flat != NULL && out != NULL && flat != out);
+    assert(flat->len > 0 && budget != NULL);
+    out->len = 0;
+    if (budget->max_steps && budget->steps >= budget->max_steps) {
+        return REDUCE_OUT_OF_STEPS;
+    }
+    reduction_t r = { flat, budget, REDUCE_DONE };
+    reduce_at(&r, 0, out);
+    budget->steps++;
+    if (r.result != REDUCE_DONE) {
+        out->len = 0;
+        return r.result;
+    }
+    budget->nodes += out->len;
+    budget->bytes += out->len * (1 + sizeof(int));
+    return REDUCE_DONE;
+}
+
+void copy_flat(const flat_t *src, int offset, flat_t *dst) {
+    assert(src != dst);
+    int len = src->sizes[offset];
+    dst->len = 0;
+    reserve(dst, len);
+    memcpy(dst->tags, src->tags + offset, len);
+    memcpy(dst->sizes, src->sizes + offset, len * sizeof(int));
+    dst->len = len;
+}
+
+void fuse_flat(const flat_t *left, const flat_t *right, flat_t *out) {
+    assert(out != left && out != right);
+    assert(left->len > 0 && right->len > 0);
+
+    // Fusing 'a' with 'h b1 ... bm' gives 'a h b1 ... bm', i.e. the right
+    // term's spine is extended by one application of the left term to its
+    // head. In preorder that's the right term's applications, a new one, the
+    // left term, and then the rest of the right term:
+    int m = walk_flat_spine(right, 0, NULL);
+    out->len = 0;
+    reserve(out, left->len + right->len + 1);
+    for (int i = 0; i < m; i++) {
+        push(out, APP, right->sizes[i] + left->len + 1);
+    }
+    push(out, APP, left->len + 2);
+    memcpy(out->tags + out->len, left->tags, left->len);
+    memcpy(out->sizes + out->len, left->sizes, left->len * sizeof(int));
+    out->len += left->len;
+    memcpy(out->tags + out->len, right->tags + m, right->len - m);
+    memcpy(out->sizes + out->len, right->sizes + m, (right->len - m) * sizeof(int));
+    out->len += right->len - m;
+}
+
+void split_flat(const flat_t *flat, int k, flat_t *left, flat_t *right) {
+    assert(left != flat && right != flat && left != right);
+    scratch_mark_t mark = scratch_mark();
+    int n = walk_flat_spine(flat, 0, NULL);
+    assert(k >= 0 && k < n);
+    int *args = scratch_alloc(n * sizeof(int));
+    walk_flat_spine(flat, 0, args);
+
+    // The left half is the subterm rooted at the kth application from the
+    // bottom of the spine:
+    copy_flat(flat, n - k, left);
+
+    // The right half is the arguments a(k+1) to an, which are contiguous at
+    // the end of the term, with enough applications in front to apply the
+    // first of them to the rest:
+    int apps = n - k - 1;
+    int start = args[k];
+    right->len = 0;
+    reserve(right, apps + flat->len - start);
+    for (int i = 0; i < apps; i++) {
+        int last = args[n - 1 - i];
+        push(right, APP, apps - i + last + flat->sizes[last] - start);
+    }
+    memcpy(right->tags + right->len, flat->tags + start, flat->len - start);
+    memcpy(right->sizes + right->len, flat->sizes + start,
+           (flat->len - start) * sizeof(int));
+    right->len += flat->len - start;
+
+    scratch_release(mark);
+}
+
+void flatten_term(term_t *term, flat_t *out) {
+    assert(term != NULL);
+    out->len = 0;
+
+    // Preorder traversal with an explicit stack. Applications are pushed back
+    // on after their children, tagged with their offset, so that their sizes
+    // can be filled in once the children have been emitted:
+    typedef struct { term_t *term; int app; } frame_t;
+    int capacity = 64, depth = 0;
+    frame_t *stack = malloc(capacity * sizeof(frame_t));
+    stack[depth++] = (frame_t) { term, -1 };
+    while (depth > 0) {
+        frame_t frame = stack[--depth];
+        if (frame.app >= 0) {
+            out->sizes[frame.app] = out->len - frame.app;
+            continue;
+        }
+
+        reserve(out, 1);
+        if (frame.term->is_leaf) {
+            push(out, frame.term->c, 1);
+            continue;
+        }
+        if (depth + 3 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(frame_t));
+        }
+        stack[depth++] = (frame_t) { NULL, out->len };
+        stack[depth++] = (frame_t) { frame.term->right, -1 };
+        stack[depth++] = (frame_t) { frame.term->left, -1 };
+        push(out, APP, 0);
+    }
+    free(stack);
+}
+
+term_t *unflatten_term(const flat_t *flat) {
+    assert(flat != NULL && flat->len > 0);
+
+    // Walking the cells backwards, both children of an application have been
+    // built by the time we reach it, with the left one on top of the stack:
+    scratch_mark_t mark = scratch_mark();
+    term_t **stack = scratch_alloc(flat->len * sizeof(term_t *));
+    int depth = 0;
+    for (int i = flat->len - 1; i >= 0; i--) {
+        if (flat->tags[i] == APP) {
+            term_t *left = stack[--depth];
+            term_t *right = stack[--depth];
+            stack[depth++] = new_node(left, right);
+        } else {
+            stack[depth++] = new_leaf(flat->tags[i]);
+        }
+    }
+    assert(depth == 1);
+    term_t *term = stack[0];
+    scratch_release(mark);
+    return term;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "comb.h"
+
+/* An alternative, contiguous representation of terms. A flat term is the
+ * preorder traversal of the term's tree, stored as two parallel arrays: a tag
+ * per cell, which is either the character of a leaf or '@' for an
+ * application, and the number of cells in the subtree rooted at that cell.
+ *
+ * Since an application is immediately followed by its left child, the right
+ * child of an application at i is at i + 1 + sizes[i + 1], so skipping over
+ * a subtree is O(1). Sizes are relative, so any subtree is itself a valid
+ * flat term, and copying, splitting and fusing terms are all slice copies.
+ *
+ * The left spine of a term also has a convenient shape: a term h a1 ... an
+ * with a leaf head h is laid out as n applications, then h, then a1 to an in
+ * order, so the head of the term at i is at i + n.
+ */
+
+typedef struct flat {
+		char *tags; // leaf character, or '@' for applications
+		int *sizes; // number of cells in the subtree rooted at each cell
+		int len; // number of cells in the term
+		int capacity; // number of cells allocated
+} flat_t;
+
+flat_t *new_flat(void);
+void free_flat(flat_t *flat);
+
+// Parses the given string into out, replacing its contents. Returns 1 on
+// success, or 0 if the string isn't a valid term.
+int parse_flat(const char *str, flat_t *out);
+
+// Prints the given term in the same format as print_term. The caller is
+// responsible for freeing the returned string.
+char *print_flat(const flat_t *flat);
+
+// Reduces every redex in the given term by a single step, writing the result
+// into out, exactly as reduce_term_within does for trees, except that nodes
+// and bytes are those of the cells written. Returns one of the REDUCE_
+// results, and leaves out empty unless it is REDUCE_DONE. The input and
+// output must be different terms.
+int reduce_flat(const flat_t *flat, budget_t *budget, flat_t *out);
+
+// Writes the offsets of the arguments on the left spine of the subterm at the
+// given offset into args, leftmost first, and returns how many there are. The
+// head of the subterm is at offset + the returned count. If args is NULL,
+// only the count is returned.
+int walk_flat_spine(const flat_t *flat, int offset, int *args);
+
+// Copies the subterm of src at the given offset into dst.
+void copy_flat(const flat_t *src, int offset, flat_t *dst);
+
+// Concatenates two terms the way the soup fuses them, so that fusing 'Sa'
+// and 'b(cd)' results in 'Sab(cd)'.
+void fuse_flat(const flat_t *left, const flat_t *right, flat_t *out);
+
+// Splits a term h a1 ... an into h a1 ... ak and a(k+1) ... an, which is the
+// inverse of fuse_flat whenever a(k+1) is a leaf. The split point k must be
+// between 0 and n - 1.
+void split_flat(const flat_t *flat, int k, flat_t *left, flat_t *right);
+
+// Conversions to and from the tree representation. The caller is responsible
+// for freeing the returned term.
+void flatten_term(term_t *term, flat_t *out);
+term_t *unflatten_term(const flat_t *flat);
@@ -0,0 +1,431 @@
+#include "graph.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { LEAF, APP, IND };
+
+typedef struct gnode {
+    char kind; // LEAF, APP or IND
+    char c; // the character of a leaf
+    unsigned visited; // epoch of the last traversal that visited this node
+    struct gnode *left; // function of an application, or indirection target
+    struct gnode *right; // argument of an application
+} gnode_t;
+
+// Number of nodes allocated at a time. Nodes are never freed individually,
+// only all at once with the graph.
+#define CHUNK_NODES 4096
+
+typedef struct gchunk {
+    struct gchunk *next;
+    gnode_t nodes[CHUNK_NODES];
+} gchunk_t;
+
+// A growable array of node pointers, used as a stack.
+typedef struct gstack {
+    gnode_t **items;
+    size_t size;
+    size_t capacity;
+} gstack_t;
+
+struct graph {
+    gnode_t *root;
+    gchunk_t *chunks; // newest first
+    int chunk_used; // nodes used in the newest chunk
+    size_t nodes; // nodes allocated in total
+    long steps; // reductions performed
+    unsigned epoch; // incremented for every traversal
+    gnode_t *leaves[256]; // leaves are never updated, so they're shared
+    gstack_t spine; // spine of the node being reduced, outermost first
+    gstack_t todo; // nodes still to be normalised
+};
+
+static void push(gstack_t *stack, gnode_t *node) {
+    if (stack->size == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->items = realloc(stack->items,
+                               stack->capacity * sizeof(gnode_t *));
+        assert(stack->items != NULL);
+    }
+    stack->items[stack->size++] = node;
+}
+
+static gnode_t *alloc_gnode(graph_t *graph) {
+    if (graph->chunks == NULL || graph->chunk_used == CHUNK_NODES) {
+        gchunk_t *chunk = malloc(sizeof(gchunk_t));
+        assert(chunk != NULL);
+        chunk->next = graph->chunks;
+        graph->chunks = chunk;
+        graph->chunk_used = 0;
+    }
+    graph->nodes++;
+    gnode_t *node = &graph->chunks->nodes[graph->chunk_used++];
+    node->visited = 0;
+    return node;
+}
+
+static gnode_t *new_gleaf(graph_t *graph, char c) {
+    gnode_t **leaf = &graph->leaves[(unsigned char) c];
+    if (*leaf == NULL) {
+        *leaf = alloc_gnode(graph);
+        (*leaf)->kind = LEAF;
+        (*leaf)->c = c;
+        (*leaf)->left = NULL;
+        (*leaf)->right = NULL;
+    }
+    return *leaf;
+}
+
+static gnode_t *new_gapp(graph_t *graph, gnode_t *left, gnode_t *right) {
+    gnode_t *node = alloc_gnode(graph);
+    node->kind = APP;
+    node->c = '\0';
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+// Follows indirections to the node they end at.
+static gnode_t *deref(gnode_t *node) {
+    while (node->kind == IND) {
+        node = node->left;
+    }
+    return node;
+}
+
+// An open-addressing map from pointers to pointers, used to preserve sharing
+// when converting between terms and graphs.
+typedef struct ptr_map {
+    const void **keys;
+    void **values;
+    size_t capacity; // always a power of two
+    size_t size;
+} ptr_map_t;
+
+static size_t ptr_slot(ptr_map_t *map, const void *key) {
+    uint64_t h = (uint64_t) (uintptr_t) key * 0x9E3779B97F4A7C15ull;
+    size_t i = (h ^ (h >> 32)) & (map->capacity - 1);
+    while (map->keys[i] != NULL && map->keys[i] != key) {
+        i = (i + 1) & (map->capacity - 1);
+    }
+    return i;
+}
+
+static void init_map(ptr_map_t *map, size_t capacity) {
+    map->capacity = capacity;
+    map->size = 0;
+    map->keys = calloc(capacity, sizeof(void *));
+    map->values = malloc(capacity * sizeof(void *));
+    assert(map->keys != NULL && map->values != NULL);
+}
+
+static void *map_get(ptr_map_t *map, const void *key) {
+    size_t i = ptr_slot(map, key);
+    return map->keys[i] != NULL ? map->values[i] : NULL;
+}
+
+static void map_put(ptr_map_t *map, const void *key, void *value) {
+    if (2 * (map->size + 1) > map->capacity) {
+        ptr_map_t grown;
+        init_map(&grown, map->capacity * 2);
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (map->keys[i] != NULL) {
+                map_put(&grown, map->keys[i], map->values[i]);
+            }
+        }
+        free(map->keys);
+        free(map->values);
+        *map = grown;
+    }
+    size_t i = ptr_slot(map, key);
+    if (map->keys[i] == NULL) {
+        map->keys[i] = key;
+        map->size++;
+    }
+    map->values[i] = value;
+}
+
+graph_t *new_graph(term_t *term) {
+    assert(term != NULL);
+    graph_t *graph = calloc(1, sizeof(graph_t));
+    assert(graph != NULL);
+
+    // Convert the term bottom-up, so that each distinct node of the term
+    // becomes exactly one node of the graph. Term nodes are kept on a stack
+    // until both of their children have been converted:
+    ptr_map_t map;
+    init_map(&map, 1024);
+    size_t size = 0, capacity = 64;
+    term_t **stack = malloc(capacity * sizeof(term_t *));
+    assert(stack != NULL);
+    stack[size++] = term;
+    while (size > 0) {
+        term_t *node = stack[size - 1];
+        if (map_get(&map, node) != NULL) {
+            size--;
+        } else if (node->is_leaf) {
+            map_put(&map, node, new_gleaf(graph, node->c));
+            size--;
+        } else {
+            gnode_t *left = map_get(&map, node->left);
+            gnode_t *right = map_get(&map, node->right);
+            if (left != NULL && right != NULL) {
+                map_put(&map, node, new_gapp(graph, left, right));
+                size--;
+                continue;
+            }
+            if (size + 2 > capacity) {
+                capacity *= 2;
+                stack = realloc(stack, capacity * sizeof(term_t *));
+                assert(stack != NULL);
+            }
+            if (right == NULL) {
+                stack[size++] = node->right;
+            }
+            if (left == NULL) {
+                stack[size++] = node->left;
+            }
+        }
+    }
+    graph->root = map_get(&map, term);
+    free(stack);
+    free(map.keys);
+    free(map.values);
+    return graph;
+}
+
+void free_graph(graph_t *graph) {
+    if (graph == NULL) {
+        return;
+    }
+    while (graph->chunks != NULL) {
+        gchunk_t *chunk = graph->chunks;
+        graph->chunks = chunk->next;
+        free(chunk);
+    }
+    free(graph->spine.items);
+    free(graph->todo.items);
+    free(graph);
+}
+
+long graph_steps(graph_t *graph) {
+    return graph->steps;
+}
+
+size_t graph_nodes(graph_t *graph) {
+    return graph->nodes;
+}
+
+term_t *graph_term(graph_t *graph) {
+    assert(graph != NULL);
+
+    // As in new_graph, but the other way around. Indirections are skipped, so
+    // they never show up in the term:
+    ptr_map_t map;
+    init_map(&map, 1024);
+    gstack_t *stack = &graph->todo;
+    stack->size = 0;
+    gnode_t *root = deref(graph->root);
+    push(stack, root);
+    while (stack->size > 0) {
+        gnode_t *node = stack->items[stack->size - 1];
+        if (map_get(&map, node) != NULL) {
+            stack->size--;
+        } else if (node->kind == LEAF) {
+            map_put(&map, node, new_leaf(node->c));
+            stack->size--;
+        } else {
+            node->left = deref(node->left);
+            node->right = deref(node->right);
+            term_t *left = map_get(&map, node->left);
+            term_t *right = map_get(&map, node->right);
+            if (left != NULL && right != NULL) {
+                map_put(&map, node,
+                        new_node(copy_term(left), copy_term(right)));
+                stack->size--;
+                continue;
+            }
+            if (right == NULL) {
+                push(stack, node->right);
+            }
+            if (left == NULL) {
+                push(stack, node->left);
+            }
+        }
+    }
+
+    // The map holds a reference to every term it converted:
+    term_t *term = copy_term(map_get(&map, root));
+    for (size_t i = 0; i < map.capacity; i++) {
+        if (map.keys[i] != NULL) {
+            free_term(map.values[i]);
+        }
+    }
+    free(map.keys);
+    free(map.values);
+    return term;
+}
+
+// Returns the number of arguments the given combinator needs to reduce, or 0
+// if the given character isn't a combinator.
+static int arity(char c) {
+    switch (c) {
+        case 'S': return 3;
+        case 'K': return 2;
+        case 'I': return 1;
+        case 'B': return 3;
+        case 'C': return 3;
+        case 'W': return 2;
+        default: return 0;
+    }
+}
+
+// Overwrites the redex r, whose head is the combinator c and whose arguments
+// are x, y and z as needed, with the result of reducing it:
+//   Sxyz -> xz(yz)
+//   Kxy  -> x
+//   Ix   -> x
+//   Bxyz -> x(yz)
+//   Cxyz -> xzy
+//   Wxy  -> xyy
+static void contract(graph_t *graph, gnode_t *r, char c, gnode_t *x,
+                     gnode_t *y, gnode_t *z) {
+    switch (c) {
+        case 'S':
+            r->left = new_gapp(graph, x, z);
+            r->right = new_gapp(graph, y, z);
+            break;
+        case 'K':
+        case 'I':
+            r->kind = IND;
+            r->left = x;
+            r->right = NULL;
+            break;
+        case 'B':
+            r->left = x;
+            r->right = new_gapp(graph, y, z);
+            break;
+        case 'C':
+            r->left = new_gapp(graph, x, z);
+            r->right = y;
+            break;
+        case 'W':
+            r->left = new_gapp(graph, x, y);
+            r->right = y;
+            break;
+    }
+}
+
+// Reduces the given node to weak head normal form, leaving its spine on the
+// graph's spine stack, from the outermost application down to the head.
+static int whnf(graph_t *graph, gnode_t *node, budget_t *budget) {
+    gstack_t *spine = &graph->spine;
+    spine->size = 0;
+    push(spine, deref(node));
+    for (;;) {
+        gnode_t *top = spine->items[spine->size - 1];
+        if (top->kind == APP) {
+            top->left = deref(top->left);
+            push(spine, top->left);
+            continue;
+        }
+
+        // The head is a leaf, and the application of it to its ith argument
+        // is spine->items[spine->size - 1 - i]:
+        int k = arity(top->c);
+        if (k == 0 || spine->size - 1 < (size_t) k) {
+            return REDUCE_DONE;
+        }
+
+        // A contraction allocates at most two nodes:
+        if (budget->max_steps && budget->steps >= budget->max_steps) {
+            return REDUCE_OUT_OF_STEPS;
+        }
+        if (budget->max_nodes && budget->nodes + 2 > budget->max_nodes) {
+            return REDUCE_OUT_OF_NODES;
+        }
+        if (budget->max_bytes &&
+            budget->bytes + 2 * sizeof(gnode_t) > budget->max_bytes) {
+            return REDUCE_OUT_OF_BYTES;
+        }
+
+        gnode_t **apps = &spine->items[spine->size - 1];
+        gnode_t *x = deref(apps[-1]->right);
+        gnode_t *y = k > 1 ? deref(apps[-2]->right) : NULL;
+        gnode_t *z = k > 2 ? deref(apps[-3]->right) : NULL;
+        gnode_t *r = apps[-k];
+        size_t nodes = graph->nodes;
+        contract(graph, r, top->c, x, y, z);
+        graph->steps++;
+        budget->steps++;
+        budget->redexes[combinator_index(top->c)]++;
+        budget->nodes += graph->nodes - nodes;
+        budget->bytes += (graph->nodes - nodes) * sizeof(gnode_t);
+
+        // Carry on unwinding from the updated redex:
+        spine->size -= k;
+        spine->items[spine->size - 1] = deref(r);
+    }
+}
+
+int graph_whnf(graph_t *graph, budget_t *budget) {
+    assert(graph != NULL && budget != NULL);
+    return whnf(graph, graph->root, budget);
+}
+
+int graph_normalise(graph_t *graph, budget_t *budget) {
+    assert(graph != NULL && budget != NULL);
+
+    // Once a node is in weak head normal form, its spine can't change, so it
+    // is normal once its arguments are. Arguments are normalised leftmost
+    // first, which keeps the order of reductions leftmost-outermost, and a
+    // shared node is only normalised the first time it's reached:
+    graph->epoch++;
+    gstack_t *todo = &graph->todo;
+    todo->size = 0;
+    push(todo, graph->root);
+    while (todo->size > 0) {
+        gnode_t *node = deref(todo->items[--todo->size]);
+        if (node->visited == graph->epoch) {
+            continue;
+        }
+        int result = whnf(graph, node, budget);
+        if (result != REDUCE_DONE) {
+            return result;
+        }
+        gstack_t *spine = &graph->spine;
+        for (size_t i = 0; i + 1 < spine->size; i++) {
+            spine->items[i]->visited = graph->epoch;
+            push(todo, spine->items[i]->right);
+        }
+        spine->items[spine->size - 1]->visited = graph->epoch;
+    }
+    return REDUCE_DONE;
+}
+
+int graph_step(graph_t *graph) {
+    // Normalising with a budget of a single step reduces exactly the
+    // leftmost-outermost redex, if there is one:
+    budget_t budget = { .max_steps = 1 };
+    graph_normalise(graph, &budget);
+    return budget.steps > 0;
+}
+
+int graph_normal_form(term_t *term, budget_t *budget, term_t **out) {
+    assert(budget != NULL && out != NULL);
+    *out = NULL;
+
+    // The nodes of the graph that the term is copied into count against the
+    // budget too, although it's only checked once reduction starts:
+    graph_t *graph = new_graph(term);
+    budget->nodes += graph->nodes;
+    budget->bytes += graph->nodes * sizeof(gnode_t);
+    int result = graph_normalise(graph, budget);
+    if (result == REDUCE_DONE) {
+        *out = graph_term(graph);
+    }
+    free_graph(graph);
+    return result;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "comb.h"
+#include <stddef.h>
+
+/* A graph-reduction engine, as an alternative to reduce_term. A term is
+ * copied into a graph of mutable application nodes, which are overwritten in
+ * place with the result of reducing them. A node that reduces to one of its
+ * arguments, as with K and I, becomes an indirection to it. Since arguments
+ * duplicated by S and W are shared rather than copied, and every reference to
+ * a node sees its update, shared arguments are only ever reduced once.
+ *
+ * Reduction is leftmost-outermost (normal order), one redex at a time, so a
+ * term that has a normal form always reaches it. This is unlike reduce_term,
+ * which reduces redexes throughout the term at once, so step counts from the
+ * two aren't comparable. Every mode of evaluation is bounded by a budget, as
+ * reduction needn't terminate, and returns one of the REDUCE_ results. Each
+ * reduction counts as a step, and the nodes and bytes are those of the graph
+ * nodes it allocates.
+ */
+
+typedef struct graph graph_t;
+
+// Creates a graph of the given term, preserving its sharing. The caller is
+// responsible for freeing the returned graph with free_graph.
+graph_t *new_graph(term_t *term);
+void free_graph(graph_t *graph);
+
+// Returns the number of reductions performed on the graph so far, and the
+// number of nodes it has allocated.
+long graph_steps(graph_t *graph);
+size_t graph_nodes(graph_t *graph);
+
+// Reads the graph back into a term. The caller is responsible for freeing the
+// returned term.
+term_t *graph_term(graph_t *graph);
+
+// Reduces the leftmost-outermost redex of the graph. Returns 1 if there was
+// one, or 0 if the graph is in normal form.
+int graph_step(graph_t *graph);
+
+// Reduces the graph to weak head normal form, meaning that its head can't be
+// reduced, or to normal form, meaning that nothing in it can. Either stops
+// early, leaving the graph as far as it got, once the next reduction would
+// go over the given budget.
+int graph_whnf(graph_t *graph, budget_t *budget);
+int graph_normalise(graph_t *graph, budget_t *budget);
+
+// Finds the normal form of the given term by graph reduction, within the
+// given budget, which also pays for copying the term into a graph. Sets *out
+// to the normal form if the result is REDUCE_DONE, or to NULL otherwise. The
+// caller is responsible for freeing the returned term.
+int graph_normal_form(term_t *term, budget_t *budget, term_t **out);
@@ -0,0 +1,404 @@
+#include "multiset.h"
+#include "pool.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of slots a soup starts out with room for.
+#define INITIAL_SLOTS 16
+
+// The copies of a term that react in the current step, by kind of reaction.
+typedef struct multiset_reaction {
+    term_t *term;
+    uint64_t reduce;
+    uint64_t fission;
+    uint64_t fusion;
+} multiset_reaction_t;
+
+static size_t home(multiset_t *ms, term_t *term) {
+    return term->hash & (ms->index_capacity - 1);
+}
+
+// Returns the position in the index of the given term, or of the empty
+// position where it would go if it isn't there.
+static size_t find(multiset_t *ms, term_t *term) {
+    size_t i = home(ms, term);
+    while (ms->index[i] != 0 && ms->slots[ms->index[i] - 1].term != term) {
+        i = (i + 1) & (ms->index_capacity - 1);
+    }
+    return i;
+}
+
+// Removes the entry at the given position of the index, shifting later
+// entries of the same run back so that lookups never hit a gap.
+static void unindex(multiset_t *ms, size_t i) {
+    size_t mask = ms->index_capacity - 1;
+    ms->index[i] = 0;
+    for (size_t j = (i + 1) & mask; ms->index[j] != 0; j = (j + 1) & mask) {
+        size_t h = home(ms, ms->slots[ms->index[j] - 1].term);
+        // The entry at j can move to i unless its home is cyclically in
+        // (i, j], in which case moving it would put it before its home:
+        int stays = i <= j ? (i < h && h <= j) : (i < h || h <= j);
+        if (!stays) {
+            ms->index[i] = ms->index[j];
+            ms->index[j] = 0;
+            i = j;
+        }
+    }
+}
+
+// Returns a slot drawn at random with probability proportional to its count.
+static size_t sample(multiset_t *ms) {
+    return find_fenwick(&ms->weights, below_rng(&ms->rng, ms->size));
+}
+
+// Doubles the number of slots, rebuilding the weights and the index.
+static void grow(multiset_t *ms) {
+    size_t capacity = 2 * ms->capacity;
+    ms->slots = realloc(ms->slots, capacity * sizeof(multiset_entry_t));
+    ms->free_slots = realloc(ms->free_slots, capacity * sizeof(size_t));
+    free_fenwick(&ms->weights);
+    init_fenwick(&ms->weights, capacity);
+    free(ms->index);
+    ms->index = calloc(2 * capacity, sizeof(size_t));
+    assert(ms->slots != NULL && ms->free_slots != NULL && ms->index != NULL);
+    for (size_t i = ms->capacity; i < capacity; i++) {
+        ms->slots[i].term = NULL;
+        ms->slots[i].count = 0;
+    }
+    ms->capacity = capacity;
+    ms->index_capacity = 2 * capacity;
+    for (size_t i = 0; i < ms->used; i++) {
+        if (ms->slots[i].term != NULL) {
+            add_fenwick(&ms->weights, i, ms->slots[i].count);
+            ms->index[find(ms, ms->slots[i].term)] = i + 1;
+        }
+    }
+}
+
+// Adds count copies of the given term, taking ownership of the reference,
+// without updating the tally of combinators.
+static void insert(multiset_t *ms, term_t *term, uint64_t count) {
+    size_t i = find(ms, term);
+    size_t slot;
+    if (ms->index[i] != 0) {
+        slot = ms->index[i] - 1;
+        ms->slots[slot].count += count;
+        free_term(term);
+    } else {
+        if (ms->free_count > 0) {
+            slot = ms->free_slots[--ms->free_count];
+        } else {
+            if (ms->used == ms->capacity) {
+                grow(ms);
+                i = find(ms, term);
+            }
+            slot = ms->used++;
+        }
+        ms->slots[slot].term = term;
+        ms->slots[slot].count = count;
+        ms->index[i] = slot + 1;
+        ms->distinct++;
+    }
+    add_fenwick(&ms->weights, slot, count);
+    ms->size += count;
+}
+
+// Takes count copies out of the given slot, without updating the tally of
+// combinators, freeing the slot once it's empty.
+static void take(multiset_t *ms, size_t slot, uint64_t count) {
+    multiset_entry_t *entry = &ms->slots[slot];
+    assert(entry->count >= count);
+    entry->count -= count;
+    add_fenwick(&ms->weights, slot, -count);
+    ms->size -= count;
+    if (entry->count == 0) {
+        unindex(ms, find(ms, entry->term));
+        free_term(entry->term);
+        entry->term = NULL;
+        ms->free_slots[ms->free_count++] = slot;
+        ms->distinct--;
+    }
+}
+
+multiset_t *new_multiset(uint64_t terms, const char *alphabet, uint64_t seed) {
+    assert(alphabet != NULL && alphabet[0] != '\0');
+    assert(strlen(alphabet) <= COMBINATORS);
+
+    multiset_t *ms = malloc(sizeof(multiset_t));
+    assert(ms != NULL);
+    ms->params = default_soup_params();
+    strcpy(ms->alphabet, alphabet);
+    ms->capacity = INITIAL_SLOTS;
+    ms->slots = calloc(ms->capacity, sizeof(multiset_entry_t));
+    init_fenwick(&ms->weights, ms->capacity);
+    ms->free_slots = malloc(ms->capacity * sizeof(size_t));
+    ms->index_capacity = 2 * ms->capacity;
+    ms->index = calloc(ms->index_capacity, sizeof(size_t));
+    assert(ms->slots != NULL && ms->free_slots != NULL && ms->index != NULL);
+    ms->used = 0;
+    ms->free_count = 0;
+    ms->distinct = 0;
+    ms->size = 0;
+    memset(ms->counts, 0, sizeof(ms->counts));
+    ms->reactions_capacity = INITIAL_SLOTS;
+    ms->reactions = malloc(ms->reactions_capacity *
+                           sizeof(multiset_reaction_t));
+    ms->pending_capacity = INITIAL_SLOTS;
+    ms->pending = malloc(ms->pending_capacity * sizeof(multiset_entry_t));
+    assert(ms->reactions != NULL && ms->pending != NULL);
+    ms->pending_size = 0;
+    seed_rng(&ms->rng, seed);
+    ms->steps = 0;
+    ms->exhausted = 0;
+
+    // Splitting the atoms between the combinators one at a time draws them
+    // from the multinomial distribution:
+    size_t n = strlen(alphabet);
+    uint64_t left = terms;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t k = i + 1 < n ? binomial_rng(&ms->rng, left, 1.0 / (n - i))
+                               : left;
+        term_t *atom = new_leaf(alphabet[i]);
+        multiset_add(ms, atom, k);
+        free_term(atom);
+        left -= k;
+    }
+    return ms;
+}
+
+void free_multiset(multiset_t *ms) {
+    if (ms == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < ms->used; i++) {
+        free_term(ms->slots[i].term);
+    }
+    free(ms->slots);
+    free_fenwick(&ms->weights);
+    free(ms->free_slots);
+    free(ms->index);
+    free(ms->reactions);
+    free(ms->pending);
+    free(ms);
+}
+
+void multiset_add(multiset_t *ms, term_t *term, uint64_t count) {
+    assert(ms != NULL && term != NULL);
+    if (count == 0) {
+        return;
+    }
+    for (int c = 0; c < COMBINATORS; c++) {
+        ms->counts[c] += count * term->counts[c];
+    }
+    insert(ms, copy_term(term), count);
+}
+
+// Adds count copies of a reaction's output to the step's pending outputs,
+// taking ownership of the reference, and their combinators to deltas.
+static void emit(multiset_t *ms, term_t *term, uint64_t count,
+                 int64_t *deltas) {
+    if (ms->pending_size == ms->pending_capacity) {
+        ms->pending_capacity *= 2;
+        ms->pending = realloc(ms->pending,
+                              ms->pending_capacity * sizeof(multiset_entry_t));
+        assert(ms->pending != NULL);
+    }
+    ms->pending[ms->pending_size].term = term;
+    ms->pending[ms->pending_size].count = count;
+    ms->pending_size++;
+    for (int c = 0; c < COMBINATORS; c++) {
+        deltas[c] += count * term->counts[c];
+    }
+}
+
+// Runs the reactions of the given copies of a term, which have already been
+// taken out of the soup.
+static void react(multiset_t *ms, multiset_reaction_t *r, int64_t *deltas) {
+    soup_params_t *p = &ms->params;
+    term_t *term = r->term;
+    uint64_t fission = r->fission;
+    if (r->reduce > 0) {
+        // Every copy reduces to the same thing, so only one of them needs to
+        // be reduced:
+        budget_t budget = p->budget;
+        term_t *reduced = NULL;
+        if (reduce_term_within(term, &budget, &reduced) == REDUCE_DONE) {
+            emit(ms, reduced, r->reduce, deltas);
+        } else {
+            ms->exhausted += r->reduce;
+            if (p->on_exhausted == BUDGET_FISSION) {
+                fission += r->reduce;
+            } else if (p->on_exhausted == BUDGET_KEEP) {
+                emit(ms, copy_term(term), r->reduce, deltas);
+            }
+        }
+    }
+
+    if (fission > 0) {
+        // Terms with fewer than two arguments can't be split:
+        if (term->is_leaf || term->left->is_leaf) {
+            emit(ms, copy_term(term), fission, deltas);
+        } else {
+            for (uint64_t i = 0; i < fission; i++) {
+                term_t *right = NULL;
+                emit(ms, fission_term(term, &ms->rng, p->p_break, &right), 1,
+                     deltas);
+                if (right != NULL) {
+                    emit(ms, right, 1, deltas);
+                }
+            }
+        }
+    }
+
+    for (uint64_t i = 0; i < r->fusion; i++) {
+        if (ms->size == 0) {
+            emit(ms, copy_term(term), 1, deltas);
+            continue;
+        }
+        size_t slot = sample(ms);
+        term_t *other = copy_term(ms->slots[slot].term);
+        take(ms, slot, 1);
+        for (int c = 0; c < COMBINATORS; c++) {
+            deltas[c] -= other->counts[c];
+        }
+        emit(ms, fuse_terms(other, term), 1, deltas);
+        free_term(other);
+    }
+}
+
+// Simulates a single step of the soup.
+static void step(multiset_t *ms) {
+    // Decide how many copies of each term react, and how, and take them out
+    // of the soup, so that fusing copies only draw partners from the rest.
+    // The kind of each reacting copy is decided as in soup_step, with fusion
+    // taking whatever is left over:
+    soup_params_t *p = &ms->params;
+    double p_fission = p->p_reduce < 1.0 ? p->p_fission / (1.0 - p->p_reduce)
+                                         : 0.0;
+    int64_t deltas[COMBINATORS] = { 0 };
+    size_t n = 0;
+    for (size_t i = 0; i < ms->used; i++) {
+        multiset_entry_t *entry = &ms->slots[i];
+        if (entry->term == NULL) {
+            continue;
+        }
+        uint64_t k = binomial_rng(&ms->rng, entry->count, p->p_action);
+        if (k == 0) {
+            continue;
+        }
+        if (n == ms->reactions_capacity) {
+            ms->reactions_capacity *= 2;
+            ms->reactions = realloc(ms->reactions, ms->reactions_capacity *
+                                    sizeof(multiset_reaction_t));
+            assert(ms->reactions != NULL);
+        }
+        multiset_reaction_t *r = &ms->reactions[n++];
+        r->term = copy_term(entry->term);
+        r->reduce = binomial_rng(&ms->rng, k, p->p_reduce);
+        r->fission = binomial_rng(&ms->rng, k - r->reduce, p_fission);
+        r->fusion = k - r->reduce - r->fission;
+        for (int c = 0; c < COMBINATORS; c++) {
+            deltas[c] -= k * r->term->counts[c];
+        }
+        take(ms, i, k);
+    }
+
+    // Outputs are held back until every reaction has run, so that they can't
+    // be drawn as partners in the same step:
+    ms->pending_size = 0;
+    for (size_t i = 0; i < n; i++) {
+        react(ms, &ms->reactions[i], deltas);
+        free_term(ms->reactions[i].term);
+    }
+    for (size_t i = 0; i < ms->pending_size; i++) {
+        insert(ms, ms->pending[i].term, ms->pending[i].count);
+    }
+
+    // Top the deficit back up with atoms, as soup_step does:
+    for (int i = 0; i < COMBINATORS; i++) {
+        ms->counts[i] += deltas[i];
+    }
+    for (const char *c = ms->alphabet; *c != '\0'; c++) {
+        int i = combinator_index(*c);
+        if (deltas[i] < 0) {
+            insert(ms, new_leaf(*c), -deltas[i]);
+            ms->counts[i] += -deltas[i];
+        }
+    }
+    ms->steps++;
+}
+
+void multiset_step(multiset_t *ms, int n_steps) {
+    assert(ms != NULL);
+    // A single step can run millions of reactions, so its scratch memory is
+    // released after each one rather than at the end:
+    for (int i = 0; i < n_steps; i++) {
+        begin_generation();
+        step(ms);
+        end_generation();
+    }
+}
+
+// Adds the number of each combinator in the given term to counts by walking
+// the whole tree, returning 0 if any node's cached counts are wrong.
+static int count_term(term_t *term, uint64_t *counts) {
+    if (term->is_leaf) {
+        int c = combinator_index(term->c);
+        if (c >= 0) {
+            counts[c]++;
+        }
+        return c < 0 || term->counts[c] == 1;
+    }
+
+    uint64_t sub[COMBINATORS] = { 0 };
+    int ok = count_term(term->left, sub) && count_term(term->right, sub);
+    for (int c = 0; c < COMBINATORS; c++) {
+        ok = ok && sub[c] == term->counts[c];
+        counts[c] += sub[c];
+    }
+    return ok;
+}
+
+int multiset_check(multiset_t *ms) {
+    assert(ms != NULL);
+    uint64_t counts[COMBINATORS] = { 0 };
+    uint64_t size = 0;
+    size_t distinct = 0;
+    int ok = 1;
+    for (size_t i = 0; i < ms->used; i++) {
+        multiset_entry_t *entry = &ms->slots[i];
+        if (entry->term == NULL) {
+            continue;
+        }
+        uint64_t sub[COMBINATORS] = { 0 };
+        ok = count_term(entry->term, sub) && ok;
+        for (int c = 0; c < COMBINATORS; c++) {
+            counts[c] += entry->count * sub[c];
+        }
+        ok = ok && entry->count > 0;
+        ok = ok && ms->index[find(ms, entry->term)] == i + 1;
+        size += entry->count;
+        distinct++;
+
+        // The weight of a single slot is the difference of two prefix sums:
+        uint64_t weight = prefix_fenwick(&ms->weights, i + 1) -
+            prefix_fenwick(&ms->weights, i);
+        ok = ok && weight == entry->count;
+    }
+    ok = ok && size == ms->size && size == ms->weights.total;
+    ok = ok && distinct == ms->distinct;
+    return ok && memcmp(counts, ms->counts, sizeof(counts)) == 0;
+}
+
+void multiset_entries(multiset_t *ms, term_t **terms, uint64_t *counts) {
+    assert(ms != NULL);
+    size_t n = 0;
+    for (size_t i = 0; i < ms->used; i++) {
+        if (ms->slots[i].term != NULL) {
+            terms[n] = copy_term(ms->slots[i].term);
+            counts[n] = ms->slots[i].count;
+            n++;
+        }
+    }
+}
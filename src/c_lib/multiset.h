@@ -0,0 +1,77 @@
+#pragma once
+#include "comb.h"
+#include "fenwick.h"
+#include "rng.h"
+#include "soup.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* An alternative representation of the soup as a multiset, mapping each
+ * distinct term to the number of copies of it in the soup. Most of a soup
+ * that is made of atoms consists of a handful of distinct small terms, so
+ * this takes memory proportional to the number of distinct terms rather than
+ * to the size of the soup, and a step takes time proportional to the number
+ * of reactions rather than of terms.
+ *
+ * A step follows the same rules as soup_step, with the same parameters, but
+ * draws how many copies of each term react, and how, from the binomial
+ * distribution instead of deciding each copy separately. All copies of a
+ * term that are reduced share a single reduction. Fusing copies draw their
+ * partners by weight from the copies that aren't reacting themselves. This
+ * means the two representations evolve the same way in distribution, apart
+ * from the order in which reactions claim their partners, but not step for
+ * step from the same seed.
+ */
+
+typedef struct multiset_entry {
+		term_t *term; // NULL if the slot is free
+		uint64_t count;
+} multiset_entry_t;
+
+typedef struct multiset {
+		soup_params_t params;
+		char alphabet[COMBINATORS + 1]; // combinators the soup is made of
+		multiset_entry_t *slots; // the distinct terms, each one owned by it
+		fenwick_t weights; // the slots' counts
+		size_t capacity; // number of slots, always a power of two
+		size_t used; // slots in use or freed, which come before unused ones
+		size_t *free_slots; // freed slots, to be reused first
+		size_t free_count;
+		size_t *index; // hash table from term to slot + 1, or 0 if empty
+		size_t index_capacity; // always a power of two, twice the capacity
+		size_t distinct; // number of distinct terms
+		uint64_t size; // total number of terms, counting copies
+		uint64_t counts[COMBINATORS]; // number of each combinator in the soup
+		struct multiset_reaction *reactions; // working memory for a step
+		size_t reactions_capacity;
+		multiset_entry_t *pending; // working memory for a step's outputs
+		size_t pending_size;
+		size_t pending_capacity;
+		rng_t rng;
+		uint64_t steps; // number of steps simulated so far
+		uint64_t exhausted; // number of reductions that ran out of budget
+} multiset_t;
+
+// Creates a soup of the given number of atoms, drawn uniformly at random from
+// the given alphabet of combinators, with the same default parameters as
+// new_soup. The caller is responsible for freeing the returned soup with
+// free_multiset.
+multiset_t *new_multiset(uint64_t terms, const char *alphabet, uint64_t seed);
+void free_multiset(multiset_t *ms);
+
+// Adds count copies of the given term to the soup, without taking ownership
+// of the reference.
+void multiset_add(multiset_t *ms, term_t *term, uint64_t count);
+
+// Simulates the given number of steps of the soup.
+void multiset_step(multiset_t *ms, int n_steps);
+
+// Recounts every combinator in the soup by walking each distinct term, and
+// returns 1 if the tally, the total size and the weights all agree with it,
+// or 0 otherwise. This is slow, and only meant for debugging.
+int multiset_check(multiset_t *ms);
+
+// Writes a new reference to each of the soup's ms->distinct terms to terms,
+// and how many copies of it there are to counts. The caller is responsible
+// for freeing the terms.
+void multiset_entries(multiset_t *ms, term_t **terms, uint64_t *counts);
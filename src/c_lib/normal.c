@@ -0,0 +1,253 @@
+#include "normal.h"
+#include "pool.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of terms the chain of reductions starts with room for, if the
+// cutoff is larger.
+#define CHAIN_CAPACITY 64
+
+normal_cache_t *new_normal_cache(size_t capacity) {
+    assert(capacity > 0);
+    normal_cache_t *cache = malloc(sizeof(normal_cache_t));
+    assert(cache != NULL);
+    cache->entries = malloc(capacity * sizeof(normal_entry_t));
+    cache->buckets = malloc(capacity * sizeof(int));
+    assert(cache->entries != NULL && cache->buckets != NULL);
+    cache->capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        cache->entries[i].term = NULL;
+        cache->entries[i].normal = NULL;
+        cache->buckets[i] = -1;
+    }
+    cache->size = 0;
+    cache->hand = 0;
+    cache->hits = 0;
+    cache->chain_hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    return cache;
+}
+
+void clear_normal_cache(normal_cache_t *cache) {
+    assert(cache != NULL);
+    for (size_t i = 0; i < cache->capacity; i++) {
+        free_term(cache->entries[i].term);
+        free_term(cache->entries[i].normal);
+        cache->entries[i].term = NULL;
+        cache->entries[i].normal = NULL;
+        cache->buckets[i] = -1;
+    }
+    cache->size = 0;
+}
+
+void free_normal_cache(normal_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    clear_normal_cache(cache);
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
+
+static size_t bucket(normal_cache_t *cache, term_t *term) {
+    return term->hash % cache->capacity;
+}
+
+// Returns the entry for the given term, or NULL if there isn't one.
+static normal_entry_t *lookup(normal_cache_t *cache, term_t *term) {
+    for (int i = cache->buckets[bucket(cache, term)]; i >= 0;
+         i = cache->entries[i].next) {
+        normal_entry_t *entry = &cache->entries[i];
+        if (entry->term == term) {
+            entry->referenced = 1;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Returns an unused entry, evicting one if the cache is full.
+static normal_entry_t *claim(normal_cache_t *cache) {
+    for (;;) {
+        normal_entry_t *entry = &cache->entries[cache->hand];
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        if (entry->term == NULL) {
+            cache->size++;
+            return entry;
+        }
+        if (entry->referenced) {
+            entry->referenced = 0;
+            continue;
+        }
+
+        // Unlink the entry from its bucket:
+        int index = entry - cache->entries;
+        int *link = &cache->buckets[bucket(cache, entry->term)];
+        while (*link != index) {
+            link = &cache->entries[*link].next;
+        }
+        *link = entry->next;
+        free_term(entry->term);
+        free_term(entry->normal);
+        cache->evictions++;
+        return entry;
+    }
+}
+
+// Records what is known about the given term, replacing any existing entry
+// if this is more informative. Takes ownership of the reference to normal.
+static void record(normal_cache_t *cache, term_t *term, term_t *normal,
+                   int steps) {
+    normal_entry_t *entry = lookup(cache, term);
+    if (entry != NULL) {
+        if (entry->normal == NULL && (normal != NULL || steps > entry->steps)) {
+            entry->normal = normal;
+            entry->steps = steps;
+        } else {
+            free_term(normal);
+        }
+        return;
+    }
+
+    entry = claim(cache);
+    size_t b = bucket(cache, term);
+    entry->term = copy_term(term);
+    entry->normal = normal;
+    entry->steps = steps;
+    entry->referenced = 0;
+    entry->next = cache->buckets[b];
+    cache->buckets[b] = entry - cache->entries;
+}
+
+// Returns the answer to a query recorded in the given entry as a new
+// reference, or NULL if the normal form isn't reached within the cutoff.
+// Sets *known if the entry settles the query either way.
+static term_t *answer(normal_entry_t *entry, int cutoff, int *known) {
+    if (entry->normal != NULL) {
+        *known = 1;
+        return entry->steps < cutoff ? copy_term(entry->normal) : NULL;
+    }
+    *known = entry->steps >= cutoff;
+    return NULL;
+}
+
+int beta_normal(normal_cache_t *cache, term_t *term, budget_t *budget,
+                term_t **out) {
+    assert(cache != NULL);
+    assert(term != NULL);
+    assert(budget != NULL && out != NULL);
+
+    // The number of reductions the query may take, as a cutoff:
+    long remaining = budget->max_steps ? budget->max_steps - budget->steps
+                                       : INT_MAX;
+    int cutoff = remaining < 0 ? 0 : remaining < INT_MAX ? remaining : INT_MAX;
+    long start = budget->steps;
+
+    int known = 0;
+    normal_entry_t *entry = lookup(cache, term);
+    if (entry != NULL) {
+        *out = answer(entry, cutoff, &known);
+        if (known) {
+            cache->hits++;
+            budget->steps = start + (*out ? entry->steps + 1 : cutoff);
+            return *out ? REDUCE_DONE : REDUCE_OUT_OF_STEPS;
+        }
+    }
+
+    // Walk the chain of reductions, keeping a reference to every term on it
+    // so that they can all be recorded afterwards. chain[i] is the term after
+    // i reductions. The chain only has room for as many terms as it may need
+    // when the cutoff is small, and grows otherwise:
+    scratch_mark_t mark = scratch_mark();
+    int capacity = cutoff < CHAIN_CAPACITY ? cutoff + 1 : CHAIN_CAPACITY;
+    term_t **chain = scratch_alloc(capacity * sizeof(term_t *));
+    budget->bytes += capacity * sizeof(term_t *);
+    chain[0] = copy_term(term);
+    int length = 1;
+    term_t *normal = NULL;
+    int steps = cutoff; // reductions from chain[0] to normal, or a bound
+    int hit = 0;
+    int result = REDUCE_DONE;
+    for (int i = 0; i < cutoff; i++) {
+        if (i > 0 && (entry = lookup(cache, chain[i])) != NULL) {
+            // The rest of the chain may already be known, so just offset it:
+            if (entry->normal != NULL) {
+                normal = copy_term(entry->normal);
+                steps = i + entry->steps;
+                hit = 1;
+                break;
+            } else if (entry->steps >= cutoff - i) {
+                // Terms that never normalise are INT_MAX steps from it, which
+                // mustn't overflow:
+                steps = entry->steps < INT_MAX - i ? i + entry->steps : INT_MAX;
+                hit = 1;
+                break;
+            }
+        }
+        term_t *reduced = NULL;
+        result = reduce_term_within(chain[i], budget, &reduced);
+        if (result != REDUCE_DONE) {
+            // Each term is at least as far from normalising as the chain
+            // got past it before the budget ran out:
+            steps = i;
+            break;
+        }
+        if (reduced == chain[i]) {
+            // A term that reduces to itself without being in normal form,
+            // like WWW, never reaches one:
+            free_term(reduced);
+            if (chain[i]->normal) {
+                normal = copy_term(chain[i]);
+                steps = i;
+            } else {
+                steps = INT_MAX;
+            }
+            break;
+        }
+        if (length == capacity) {
+            term_t **grown = scratch_alloc(2 * capacity * sizeof(term_t *));
+            memcpy(grown, chain, capacity * sizeof(term_t *));
+            budget->bytes += 2 * capacity * sizeof(term_t *);
+            chain = grown;
+            capacity *= 2;
+        }
+        chain[length++] = reduced;
+    }
+    if (hit) {
+        cache->chain_hits++;
+    } else {
+        cache->misses++;
+    }
+
+    // Fill in an entry for every term along the chain. If the normal form is
+    // known, each term's distance to it is exact, and otherwise each term is
+    // at least as far from normalising as the chain was long past it:
+    for (int i = 0; i < length; i++) {
+        if (normal != NULL || steps > i) {
+            record(cache, chain[i], normal ? copy_term(normal) : NULL,
+                   steps - i);
+        }
+        free_term(chain[i]);
+    }
+    scratch_release(mark);
+
+    // Charge the steps that reducing the term from scratch would have taken,
+    // so that the budget doesn't depend on what was cached, unless the query
+    // was cut short by some other limit:
+    if (result == REDUCE_DONE) {
+        budget->steps = start + (normal != NULL && steps < cutoff ? steps + 1
+                                                                  : cutoff);
+        if (normal == NULL || steps >= cutoff) {
+            free_term(normal);
+            normal = NULL;
+            result = REDUCE_OUT_OF_STEPS;
+        }
+    }
+    *out = normal;
+    return result;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "comb.h"
+#include <stddef.h>
+
+/* A bounded cache of beta normal forms. Most terms in a soup are unchanged
+ * from one step to the next, or are duplicates of each other, so checking
+ * whether each one normalises is mostly repeated work.
+ *
+ * Since terms are hash-consed, a term's pointer identifies its structure, and
+ * each entry holds a reference to its term so that the pointer can't be
+ * reused. An entry records either how many reductions the term takes to
+ * reach its normal form, and what that is, or a lower bound on how many it
+ * takes if it hasn't been seen to normalise. That bound is INT_MAX for a
+ * term that reduces to itself without being in normal form, like WWW, as it
+ * never will. Every term along a reduction chain gets an entry, not just the
+ * one that was asked about. Entries are evicted by the clock algorithm once
+ * the cache is full.
+ */
+
+typedef struct normal_entry {
+		term_t *term; // NULL if the entry is unused
+		term_t *normal; // normal form, or NULL if it wasn't reached
+		int steps; // reductions to the normal form, or a lower bound on them
+		int referenced; // clock bit, set whenever the entry is used
+		int next; // next entry in the same bucket, or -1
+} normal_entry_t;
+
+typedef struct normal_cache {
+		normal_entry_t *entries;
+		int *buckets; // first entry in each bucket, or -1
+		size_t capacity; // number of entries, and of buckets
+		size_t size; // number of entries in use
+		size_t hand; // position of the clock hand
+		size_t hits; // queries answered without reducing
+		size_t chain_hits; // queries cut short by an entry along the way
+		size_t misses; // queries that reduced all the way
+		size_t evictions;
+} normal_cache_t;
+
+// Creates a cache with room for the given number of entries. The caller is
+// responsible for freeing the returned cache with free_normal_cache.
+normal_cache_t *new_normal_cache(size_t capacity);
+void free_normal_cache(normal_cache_t *cache);
+
+// Drops every entry in the cache, and the references they hold.
+void clear_normal_cache(normal_cache_t *cache);
+
+// Finds the beta normal form of the given term, which is the same as reducing
+// the term until it is in normal form, one reduce_term_within at a time,
+// within the given budget. Queries answered from the cache are charged the steps
+// that reducing the term would have taken, so only nodes and bytes depend on
+// what is cached. Returns one of the REDUCE_ results, and sets *out to a new
+// reference to the normal form if it is REDUCE_DONE, or to NULL otherwise.
+// The caller is responsible for freeing the returned term.
+int beta_normal(normal_cache_t *cache, term_t *term, budget_t *budget,
+                term_t **out);
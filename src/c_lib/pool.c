@@ -0,0 +1,225 @@
+#include "pool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of nodes carved out of each slab. Slabs are never returned to the
+// system, so a soup that has reached its steady-state size stops allocating.
+#define SLAB_NODES 4096
+
+// Number of nodes moved between a thread's cache and the shared free list at
+// a time in threaded mode.
+#define CACHE_BATCH 256
+
+// Default size of a chunk in the scratch arena. Requests that don't fit are
+// given a chunk of their own.
+#define CHUNK_BYTES (64 * 1024)
+
+typedef struct slab {
+    struct slab *next;
+    term_t nodes[SLAB_NODES];
+} slab_t;
+
+typedef struct chunk {
+    struct chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} chunk_t;
+
+int threaded = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static slab_t *slabs = NULL; // every slab ever allocated
+static term_t *free_nodes = NULL; // free list, threaded through node->left
+static size_t free_count = 0; // number of nodes on the free list
+
+// Nodes cached by the calling thread in threaded mode:
+static _Thread_local term_t *cached_nodes = NULL;
+static _Thread_local int cached_count = 0;
+
+static _Thread_local chunk_t *chunks = NULL; // scratch in use, newest first
+static _Thread_local chunk_t *spare_chunks = NULL; // released for reuse
+static _Thread_local int generation_depth = 0;
+static _Thread_local scratch_mark_t generation_start;
+
+static term_stats_t stats;
+
+// Allocates a fresh slab and threads all of its nodes onto the free list.
+// Must be called with the pool lock held in threaded mode.
+static void grow_pool(void) {
+    slab_t *slab = malloc(sizeof(slab_t));
+    assert(slab != NULL);
+    slab->next = slabs;
+    slabs = slab;
+    for (int i = SLAB_NODES - 1; i >= 0; i--) {
+        slab->nodes[i].left = free_nodes;
+        free_nodes = &slab->nodes[i];
+    }
+    free_count += SLAB_NODES;
+    stats.nodes_reserved += SLAB_NODES;
+    stats.bytes_reserved += sizeof(slab_t);
+    __atomic_fetch_add(&stats.system_allocs, 1, __ATOMIC_RELAXED);
+}
+
+// Moves a batch of nodes from the shared free list to the thread's cache.
+static void refill_cache(void) {
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < CACHE_BATCH; i++) {
+        if (free_nodes == NULL) {
+            grow_pool();
+        }
+        term_t *node = free_nodes;
+        free_nodes = node->left;
+        node->left = cached_nodes;
+        cached_nodes = node;
+    }
+    free_count -= CACHE_BATCH;
+    cached_count += CACHE_BATCH;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Moves up to n nodes from the thread's cache to the shared free list.
+static void spill_cache(int n) {
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < n && cached_nodes != NULL; i++) {
+        term_t *node = cached_nodes;
+        cached_nodes = node->left;
+        node->left = free_nodes;
+        free_nodes = node;
+        cached_count--;
+        free_count++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+term_t *alloc_node(void) {
+    if (threaded) {
+        if (cached_nodes == NULL) {
+            refill_cache();
+        }
+        term_t *node = cached_nodes;
+        cached_nodes = node->left;
+        cached_count--;
+        return node;
+    }
+
+    if (free_nodes == NULL) {
+        grow_pool();
+    }
+    term_t *node = free_nodes;
+    free_nodes = node->left;
+    free_count--;
+    return node;
+}
+
+void release_node(term_t *node) {
+    assert(node != NULL);
+    if (threaded) {
+        node->left = cached_nodes;
+        cached_nodes = node;
+        if (++cached_count >= 2 * CACHE_BATCH) {
+            spill_cache(CACHE_BATCH);
+        }
+        return;
+    }
+
+    node->left = free_nodes;
+    free_nodes = node;
+    free_count++;
+}
+
+void flush_thread(void) {
+    if (cached_count > 0) {
+        spill_cache(cached_count);
+    }
+}
+
+// Pushes a chunk with room for at least size bytes onto the arena, reusing a
+// spare one if it's big enough.
+static void grow_scratch(size_t size) {
+    chunk_t *chunk = NULL;
+    if (spare_chunks != NULL && spare_chunks->size >= size) {
+        chunk = spare_chunks;
+        spare_chunks = chunk->next;
+    } else {
+        size_t bytes = size > CHUNK_BYTES ? size : CHUNK_BYTES;
+        chunk = malloc(sizeof(chunk_t) + bytes);
+        assert(chunk != NULL);
+        chunk->size = bytes;
+        __atomic_fetch_add(&stats.scratch_reserved, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats.system_allocs, 1, __ATOMIC_RELAXED);
+    }
+    chunk->used = 0;
+    chunk->next = chunks;
+    chunks = chunk;
+}
+
+void *scratch_alloc(size_t size) {
+    size = (size + 15) & ~(size_t) 15;
+    if (chunks == NULL || chunks->used + size > chunks->size) {
+        grow_scratch(size);
+    }
+    void *ptr = chunks->data + chunks->used;
+    chunks->used += size;
+    return ptr;
+}
+
+scratch_mark_t scratch_mark(void) {
+    scratch_mark_t mark = { chunks, chunks ? chunks->used : 0 };
+    return mark;
+}
+
+// Rolls the arena back unconditionally, moving emptied chunks to the spares.
+static void rollback(scratch_mark_t mark) {
+    while (chunks != NULL && chunks != mark.chunk) {
+        chunk_t *chunk = chunks;
+        chunks = chunk->next;
+        chunk->next = spare_chunks;
+        spare_chunks = chunk;
+    }
+    if (chunks != NULL) {
+        chunks->used = mark.used;
+    }
+}
+
+void scratch_release(scratch_mark_t mark) {
+    if (generation_depth == 0) {
+        rollback(mark);
+    }
+}
+
+void release_scratch(void) {
+    assert(generation_depth == 0);
+    scratch_mark_t empty = { NULL, 0 };
+    rollback(empty);
+    while (spare_chunks != NULL) {
+        chunk_t *chunk = spare_chunks;
+        spare_chunks = chunk->next;
+        __atomic_fetch_sub(&stats.scratch_reserved, chunk->size, __ATOMIC_RELAXED);
+        free(chunk);
+    }
+}
+
+void begin_generation(void) {
+    if (generation_depth++ == 0) {
+        generation_start = scratch_mark();
+    }
+}
+
+void end_generation(void) {
+    assert(generation_depth > 0);
+    if (--generation_depth == 0) {
+        rollback(generation_start);
+    }
+}
+
+void term_stats(term_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&pool_lock);
+    *out = stats;
+    out->nodes_alive = stats.nodes_reserved - free_count;
+    out->bytes_alive = out->nodes_alive * sizeof(term_t);
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "comb.h"
+#include <stddef.h>
+
+/* Internal memory management for the term library. This header is not part
+ * of the Python-facing API in comb.h.
+ *
+ * Term nodes all have the same size, so they are carved out of large slabs
+ * and recycled through a free list instead of going through malloc/free one
+ * node at a time. Short-lived working memory (spine stacks, substrings and
+ * the like) comes from a bump-allocated scratch arena, which is released
+ * either at the end of each top-level call, or all at once at the end of a
+ * generation (see begin_generation/end_generation in comb.h).
+ *
+ * The library can be switched into a threaded mode, in which it may be used
+ * from several threads at once. In that mode each thread allocates nodes
+ * from its own cache, which is refilled from and spilled back to the shared
+ * free list in batches, and shared state is protected by locks and atomics.
+ * The scratch arena is always per-thread.
+ */
+
+// Whether the library is in threaded mode. This only changes while a single
+// thread is using the library, so it is safe to read without synchronisation.
+extern int threaded;
+
+// Switches the library into and out of threaded mode. These must only be
+// called while no other threads are using the library, and every other thread
+// that used it must have called flush_thread in between.
+void begin_threaded(void);
+void end_threaded(void);
+
+// Returns the calling thread's cached nodes to the shared pool. Threads must
+// call this once they are done with the library in threaded mode.
+void flush_thread(void);
+
+// Frees the calling thread's scratch arena, for threads that are exiting.
+void release_scratch(void);
+
+// Returns an uninitialised node from the pool.
+term_t *alloc_node(void);
+
+// Returns the given node to the pool's free list.
+void release_node(term_t *node);
+
+// A position in the scratch arena that can be rolled back to.
+typedef struct scratch_mark {
+    void *chunk;
+    size_t used;
+} scratch_mark_t;
+
+// Allocates size bytes of scratch memory, aligned to 16 bytes. The memory
+// is valid until the scratch arena is rolled back past it.
+void *scratch_alloc(size_t size);
+
+// Returns the current position of the scratch arena.
+scratch_mark_t scratch_mark(void);
+
+// Rolls the scratch arena back to the given mark, invalidating everything
+// allocated since. This is a no-op while a generation is open, in which case
+// the memory is dropped in bulk by end_generation instead.
+void scratch_release(scratch_mark_t mark);
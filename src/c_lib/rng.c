@@ -0,0 +1,66 @@
+#include "rng.h"
+#include <assert.h>
+#include <math.h>
+
+void seed_rng(rng_t *rng, uint64_t seed) {
+    rng->state = seed;
+}
+
+uint64_t next_rng(rng_t *rng) {
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+double uniform_rng(rng_t *rng) {
+    // The top 53 bits fill a double's mantissa exactly:
+    return (next_rng(rng) >> 11) * 0x1.0p-53;
+}
+
+uint64_t below_rng(rng_t *rng, uint64_t n) {
+    assert(n > 0);
+    // Multiply-shift is unbiased enough for our purposes, and avoids a
+    // division:
+    return (uint64_t) (((unsigned __int128) next_rng(rng) * n) >> 64);
+}
+
+// Mean below which binomial_rng draws exactly.
+#define EXACT_MEAN 16.0
+
+uint64_t binomial_rng(rng_t *rng, uint64_t n, double p) {
+    if (n == 0 || p <= 0.0) {
+        return 0;
+    }
+    if (p >= 1.0) {
+        return n;
+    }
+    if (p > 0.5) {
+        return n - binomial_rng(rng, n, 1.0 - p);
+    }
+
+    double mean = n * p;
+    if (mean < EXACT_MEAN) {
+        // The gaps between successes are geometrically distributed, so this
+        // takes time proportional to the number of successes:
+        double log_q = log1p(-p);
+        uint64_t k = 0;
+        for (uint64_t i = 0;; k++) {
+            double gap = floor(log1p(-uniform_rng(rng)) / log_q) + 1.0;
+            if (gap > (double) (n - i)) {
+                return k;
+            }
+            i += (uint64_t) gap;
+        }
+    }
+
+    // With p at most a half, both the mean and n - mean are large enough here
+    // for the normal approximation, drawn by the Box-Muller transform:
+    double u = 1.0 - uniform_rng(rng);
+    double z = sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * uniform_rng(rng));
+    double x = floor(mean + sqrt(mean * (1.0 - p)) * z + 0.5);
+    if (x < 0.0) {
+        return 0;
+    }
+    return x > (double) n ? n : (uint64_t) x;
+}
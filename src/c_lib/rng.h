@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+
+/* A small, fast pseudo-random number generator (splitmix64), so that the
+ * native soup doesn't depend on the platform's rand(). Separately seeded
+ * generators produce independent streams.
+ */
+
+typedef struct rng {
+		uint64_t state;
+} rng_t;
+
+void seed_rng(rng_t *rng, uint64_t seed);
+uint64_t next_rng(rng_t *rng);
+
+// Returns a uniformly distributed double in [0, 1).
+double uniform_rng(rng_t *rng);
+
+// Returns a uniformly distributed integer in [0, n).
+uint64_t below_rng(rng_t *rng, uint64_t n);
+
+// Returns the number of successes in n independent trials that each succeed
+// with probability p. Small means are drawn exactly, by skipping over the
+// failures between successes, and large ones from the normal approximation,
+// so the cost doesn't grow with n.
+uint64_t binomial_rng(rng_t *rng, uint64_t n, double p);
@@ -0,0 +1,798 @@
+#include "soup.h"
+#include "checkpoint.h"
+#include "detector.h"
+#include "trace.h"
+#include "fenwick.h"
+#include "pool.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Number of reactions a worker claims from its range at a time.
+#define BATCH 16
+
+typedef struct worker {
+    pthread_mutex_t lock; // protects lo and hi, which thieves also move
+    size_t lo, hi; // range of reactions left to run
+    long deltas[COMBINATORS]; // change in each combinator from the reactions
+    uint64_t redexes[COMBINATORS]; // redexes contracted by the reactions
+    pthread_t thread;
+    struct workers *workers;
+    int id;
+} worker_t;
+
+struct workers {
+    pthread_mutex_t lock;
+    pthread_cond_t start; // signalled when a job is posted
+    pthread_cond_t done; // signalled when the last worker finishes a job
+    uint64_t job; // incremented for every job posted
+    int running; // number of workers still busy with the current job
+    int quit;
+    soup_t *soup;
+    uint64_t seed; // seed of the current step's random streams
+    int count;
+    worker_t worker[];
+};
+
+soup_params_t default_soup_params(void) {
+    return (soup_params_t) {
+        .p_action = 0.5,
+        .p_reduce = 0.7,
+        .p_fission = 0.15,
+        .p_fusion = 0.15,
+        .p_break = 0.3,
+        .budget = {
+            .max_nodes = 1 << 20,
+            .max_bytes = 64 << 20,
+        },
+        .on_exhausted = BUDGET_KEEP,
+    };
+}
+
+soup_t *new_soup(size_t terms, const char *alphabet, uint64_t seed) {
+    assert(alphabet != NULL && alphabet[0] != '\0');
+    assert(strlen(alphabet) <= COMBINATORS);
+
+    soup_t *soup = malloc(sizeof(soup_t));
+    assert(soup != NULL);
+    soup->params = default_soup_params();
+    strcpy(soup->alphabet, alphabet);
+    soup->capacity = terms > 16 ? terms : 16;
+    soup->terms = malloc(soup->capacity * sizeof(term_t *));
+    soup->next_capacity = soup->capacity;
+    soup->next = malloc(soup->next_capacity * sizeof(term_t *));
+    assert(soup->terms != NULL && soup->next != NULL);
+    soup->reactions_capacity = 16;
+    soup->reactions = malloc(soup->reactions_capacity * sizeof(reaction_t));
+    assert(soup->reactions != NULL);
+    seed_rng(&soup->rng, seed);
+    soup->steps = 0;
+    soup->time = 0.0;
+    soup->events = 0;
+    soup->exhausted = 0;
+    memset(&soup->stats, 0, sizeof(soup->stats));
+    soup->threads = 1;
+    soup->workers = NULL;
+    soup->checkpoint = NULL;
+    soup->trace = NULL;
+    soup->detector = NULL;
+    soup->debug = 0;
+    memset(soup->counts, 0, sizeof(soup->counts));
+
+    size_t n = strlen(alphabet);
+    for (soup->size = 0; soup->size < terms; soup->size++) {
+        char c = alphabet[below_rng(&soup->rng, n)];
+        soup->terms[soup->size] = new_leaf(c);
+        soup->counts[combinator_index(c)]++;
+    }
+    return soup;
+}
+
+static void stop_workers(soup_t *soup);
+
+void free_soup(soup_t *soup) {
+    if (soup == NULL) {
+        return;
+    }
+    soup_checkpoint_wait(soup);
+    soup_trace_stop(soup);
+    soup_detect_stop(soup);
+    stop_workers(soup);
+    for (size_t i = 0; i < soup->size; i++) {
+        free_term(soup->terms[i]);
+    }
+    free(soup->terms);
+    free(soup->next);
+    free(soup->reactions);
+    free(soup);
+}
+
+term_t *soup_term(soup_t *soup, size_t i) {
+    assert(i < soup->size);
+    return copy_term(soup->terms[i]);
+}
+
+void soup_terms(soup_t *soup, term_t **out) {
+    assert(soup != NULL);
+    for (size_t i = 0; i < soup->size; i++) {
+        out[i] = copy_term(soup->terms[i]);
+    }
+}
+
+// Appends a term to the given array, growing it as necessary.
+static void push_term(term_t ***terms, size_t *size, size_t *capacity,
+                      term_t *term) {
+    if (*size == *capacity) {
+        *capacity *= 2;
+        *terms = realloc(*terms, *capacity * sizeof(term_t *));
+        assert(*terms != NULL);
+    }
+    (*terms)[(*size)++] = term;
+}
+
+static void push_next(soup_t *soup, size_t *size, term_t *term) {
+    push_term(&soup->next, size, &soup->next_capacity, term);
+}
+
+// Adds the number of each combinator in the given term to counts by walking
+// the whole tree, returning 0 if any node's cached counts are wrong.
+static int count_term(term_t *term, size_t *counts) {
+    if (term->is_leaf) {
+        int c = combinator_index(term->c);
+        if (c >= 0) {
+            counts[c]++;
+        }
+        return c < 0 || term->counts[c] == 1;
+    }
+
+    size_t sub[COMBINATORS] = { 0 };
+    int ok = count_term(term->left, sub) && count_term(term->right, sub);
+    for (int c = 0; c < COMBINATORS; c++) {
+        ok = ok && sub[c] == term->counts[c];
+        counts[c] += sub[c];
+    }
+    return ok;
+}
+
+int soup_check(soup_t *soup) {
+    assert(soup != NULL);
+    size_t counts[COMBINATORS] = { 0 };
+    int ok = 1;
+    for (size_t i = 0; i < soup->size; i++) {
+        ok = count_term(soup->terms[i], counts) && ok;
+    }
+    return ok && memcmp(counts, soup->counts, sizeof(counts)) == 0;
+}
+
+// Returns the number of arguments on the given term's spine.
+static int spine_length(term_t *term) {
+    int n = 0;
+    for (; !term->is_leaf; term = term->left) {
+        n++;
+    }
+    return n;
+}
+
+// Writes the n arguments of the given term's spine to args, in order.
+static void spine_args(term_t *term, int n, term_t **args) {
+    for (int i = n - 1; i >= 0; i--, term = term->left) {
+        args[i] = term->right;
+    }
+}
+
+term_t *fission_term(term_t *term, rng_t *rng, double p_break,
+                     term_t **right) {
+    assert(term != NULL && right != NULL);
+    *right = NULL;
+    if (!term->splits) {
+        return copy_term(term);
+    }
+    int n = spine_length(term);
+
+    scratch_mark_t mark = scratch_mark();
+    term_t **args = scratch_alloc(n * sizeof(term_t *));
+    spine_args(term, n, args);
+    int split = -1;
+    for (int i = 0; i < n - 1; i++) {
+        if (args[i]->is_leaf && uniform_rng(rng) < p_break) {
+            split = i;
+            break;
+        }
+    }
+    if (split < 0) {
+        scratch_release(mark);
+        return copy_term(term);
+    }
+
+    // The left half is a node on the spine, and the right half rebuilds the
+    // spine above the split on top of the atom:
+    term_t *left = term;
+    for (int i = split; i < n; i++) {
+        left = left->left;
+    }
+    *right = copy_term(args[split]);
+    for (int i = split + 1; i < n; i++) {
+        *right = new_node(*right, copy_term(args[i]));
+    }
+    scratch_release(mark);
+    return copy_term(left);
+}
+
+term_t *fuse_terms(term_t *left, term_t *right) {
+    assert(left != NULL && right != NULL);
+    int n = spine_length(right);
+    scratch_mark_t mark = scratch_mark();
+    term_t **args = scratch_alloc((n + 1) * sizeof(term_t *));
+    spine_args(right, n, args);
+
+    term_t *head = right;
+    for (int i = 0; i < n; i++) {
+        head = head->left;
+    }
+    term_t *fused = new_node(copy_term(left), copy_term(head));
+    for (int i = 0; i < n; i++) {
+        fused = new_node(fused, copy_term(args[i]));
+    }
+    scratch_release(mark);
+    return fused;
+}
+
+// Runs the ith reaction of the current step, adding the change in the number
+// of each combinator to deltas, and the redexes contracted to redexes.
+static void react(soup_t *soup, uint64_t seed, size_t i, long *deltas,
+                  uint64_t *redexes) {
+    reaction_t *r = &soup->reactions[i];
+    for (int j = 0; j < 2 && r->inputs[j] != NULL; j++) {
+        for (int c = 0; c < COMBINATORS; c++) {
+            deltas[c] -= r->inputs[j]->counts[c];
+        }
+    }
+
+    r->outputs[0] = NULL;
+    r->outputs[1] = NULL;
+    r->result = REDUCE_DONE;
+    int kind = r->kind;
+    if (kind == REACTION_REDUCTION) {
+        // A reduction that runs out of budget leaves no output, and then
+        // falls back on the soup's policy:
+        budget_t budget = soup->params.budget;
+        r->result = reduce_term_within(r->inputs[0], &budget, &r->outputs[0]);
+        for (int c = 0; c < COMBINATORS; c++) {
+            redexes[c] += budget.redexes[c];
+        }
+        if (r->result != REDUCE_DONE &&
+            soup->params.on_exhausted == BUDGET_FISSION) {
+            kind = REACTION_FISSION;
+        } else {
+            if (r->result != REDUCE_DONE &&
+                soup->params.on_exhausted == BUDGET_KEEP) {
+                r->outputs[0] = copy_term(r->inputs[0]);
+            }
+            free_term(r->inputs[0]);
+        }
+    }
+    if (kind == REACTION_FISSION) {
+        rng_t rng;
+        seed_rng(&rng, seed ^ (i * 0xD1B54A32D192ED03ull));
+        r->outputs[0] = fission_term(r->inputs[0], &rng, soup->params.p_break,
+                                     &r->outputs[1]);
+        free_term(r->inputs[0]);
+    } else if (kind == REACTION_FUSION) {
+        r->outputs[0] = fuse_terms(r->inputs[0], r->inputs[1]);
+        free_term(r->inputs[0]);
+        free_term(r->inputs[1]);
+    }
+
+    for (int j = 0; j < 2 && r->outputs[j] != NULL; j++) {
+        for (int c = 0; c < COMBINATORS; c++) {
+            deltas[c] += r->outputs[j]->counts[c];
+        }
+    }
+}
+
+// Claims the next batch of reactions from the given worker's own range, or
+// failing that steals the upper half of another worker's range. Returns 0
+// once there is no work left anywhere.
+static int claim(struct workers *workers, int id, size_t *lo, size_t *hi) {
+    worker_t *self = &workers->worker[id];
+    pthread_mutex_lock(&self->lock);
+    if (self->lo < self->hi) {
+        *lo = self->lo;
+        *hi = self->hi - self->lo > BATCH ? self->lo + BATCH : self->hi;
+        self->lo = *hi;
+        pthread_mutex_unlock(&self->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    for (int k = 1; k < workers->count; k++) {
+        worker_t *victim = &workers->worker[(id + k) % workers->count];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->hi - victim->lo;
+        if (left == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t mid = victim->lo + left / 2;
+        size_t end = victim->hi;
+        victim->hi = mid;
+        pthread_mutex_unlock(&victim->lock);
+
+        // Only we ever refill our own range, so it's still empty:
+        pthread_mutex_lock(&self->lock);
+        self->lo = mid;
+        self->hi = end;
+        pthread_mutex_unlock(&self->lock);
+        return claim(workers, id, lo, hi);
+    }
+    return 0;
+}
+
+// Runs reactions of the current job until there are none left.
+static void work(struct workers *workers, int id) {
+    size_t lo, hi;
+    while (claim(workers, id, &lo, &hi)) {
+        for (size_t i = lo; i < hi; i++) {
+            react(workers->soup, workers->seed, i, workers->worker[id].deltas,
+                  workers->worker[id].redexes);
+        }
+    }
+}
+
+static void *run_worker(void *arg) {
+    worker_t *self = arg;
+    struct workers *workers = self->workers;
+    uint64_t job = 0;
+    pthread_mutex_lock(&workers->lock);
+    for (;;) {
+        while (workers->job == job && !workers->quit) {
+            pthread_cond_wait(&workers->start, &workers->lock);
+        }
+        if (workers->quit) {
+            break;
+        }
+        job = workers->job;
+        pthread_mutex_unlock(&workers->lock);
+
+        work(workers, self->id);
+        flush_thread();
+
+        pthread_mutex_lock(&workers->lock);
+        if (--workers->running == 0) {
+            pthread_cond_signal(&workers->done);
+        }
+    }
+    pthread_mutex_unlock(&workers->lock);
+    release_scratch();
+    return NULL;
+}
+
+// Starts a pool of the given number of workers, including the calling thread
+// as worker 0.
+static void start_workers(soup_t *soup, int count) {
+    struct workers *workers = malloc(sizeof(struct workers) +
+                                     count * sizeof(worker_t));
+    assert(workers != NULL);
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->start, NULL);
+    pthread_cond_init(&workers->done, NULL);
+    workers->job = 0;
+    workers->running = 0;
+    workers->quit = 0;
+    workers->soup = soup;
+    workers->count = count;
+    for (int i = 0; i < count; i++) {
+        worker_t *worker = &workers->worker[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->lo = worker->hi = 0;
+        worker->workers = workers;
+        worker->id = i;
+        if (i > 0) {
+            int err = pthread_create(&worker->thread, NULL, run_worker, worker);
+            assert(err == 0);
+            (void) err;
+        }
+    }
+    soup->workers = workers;
+}
+
+static void stop_workers(soup_t *soup) {
+    struct workers *workers = soup->workers;
+    if (workers == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&workers->lock);
+    workers->quit = 1;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+    for (int i = 0; i < workers->count; i++) {
+        worker_t *worker = &workers->worker[i];
+        if (i > 0) {
+            pthread_join(worker->thread, NULL);
+        }
+        pthread_mutex_destroy(&worker->lock);
+    }
+    pthread_mutex_destroy(&workers->lock);
+    pthread_cond_destroy(&workers->start);
+    pthread_cond_destroy(&workers->done);
+    free(workers);
+    soup->workers = NULL;
+}
+
+void soup_threads(soup_t *soup, int threads) {
+    assert(soup != NULL);
+    soup->threads = threads > 1 ? threads : 1;
+}
+
+// Runs the given number of reactions of the current step, on the thread pool
+// if there is one and there's enough work to be worth it. Returns the change
+// in each combinator in deltas, and adds the redexes contracted to the soup's
+// stats.
+static void run_reactions(soup_t *soup, size_t n, uint64_t seed,
+                          long *deltas) {
+    memset(deltas, 0, COMBINATORS * sizeof(long));
+    if (soup->threads == 1 || n < 2 * BATCH) {
+        for (size_t i = 0; i < n; i++) {
+            react(soup, seed, i, deltas, soup->stats.redexes);
+        }
+        return;
+    }
+
+    if (soup->workers != NULL && soup->workers->count != soup->threads) {
+        stop_workers(soup);
+    }
+    if (soup->workers == NULL) {
+        start_workers(soup, soup->threads);
+    }
+    struct workers *workers = soup->workers;
+    for (int i = 0; i < workers->count; i++) {
+        worker_t *worker = &workers->worker[i];
+        worker->lo = n * i / workers->count;
+        worker->hi = n * (i + 1) / workers->count;
+        memset(worker->deltas, 0, sizeof(worker->deltas));
+        memset(worker->redexes, 0, sizeof(worker->redexes));
+    }
+
+    begin_threaded();
+    pthread_mutex_lock(&workers->lock);
+    workers->seed = seed;
+    workers->running = workers->count - 1;
+    workers->job++;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    work(workers, 0);
+
+    pthread_mutex_lock(&workers->lock);
+    while (workers->running > 0) {
+        pthread_cond_wait(&workers->done, &workers->lock);
+    }
+    pthread_mutex_unlock(&workers->lock);
+    end_threaded();
+
+    for (int i = 0; i < workers->count; i++) {
+        for (int c = 0; c < COMBINATORS; c++) {
+            deltas[c] += workers->worker[i].deltas[c];
+            soup->stats.redexes[c] += workers->worker[i].redexes[c];
+        }
+    }
+}
+
+// Schedules a reaction for the current step, growing the array as necessary.
+static void push_reaction(soup_t *soup, size_t *n, int kind, term_t *first,
+                          term_t *second) {
+    if (*n == soup->reactions_capacity) {
+        soup->reactions_capacity *= 2;
+        soup->reactions = realloc(soup->reactions,
+                                  soup->reactions_capacity * sizeof(reaction_t));
+        assert(soup->reactions != NULL);
+    }
+    reaction_t *r = &soup->reactions[(*n)++];
+    r->kind = kind;
+    r->inputs[0] = first;
+    r->inputs[1] = second;
+    r->hashes[0] = first->hash;
+    r->hashes[1] = second != NULL ? second->hash : 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Simulates a single step of the soup.
+static void step(soup_t *soup) {
+    double start = now();
+
+    // Shuffle the soup, so that terms are reacted and fused in random order:
+    for (size_t i = soup->size; i > 1; i--) {
+        size_t j = below_rng(&soup->rng, i);
+        term_t *tmp = soup->terms[i - 1];
+        soup->terms[i - 1] = soup->terms[j];
+        soup->terms[j] = tmp;
+    }
+
+    // Decide which terms react and how. Terms that don't react go straight
+    // into the next generation:
+    soup_params_t *p = &soup->params;
+    size_t size = 0;
+    size_t n = 0;
+    while (soup->size > 0) {
+        term_t *term = soup->terms[--soup->size];
+        if (uniform_rng(&soup->rng) >= p->p_action) {
+            push_next(soup, &size, term);
+            continue;
+        }
+
+        double action = uniform_rng(&soup->rng);
+        if (action < p->p_reduce) {
+            push_reaction(soup, &n, REACTION_REDUCTION, term, NULL);
+        } else if (action < p->p_reduce + p->p_fission) {
+            push_reaction(soup, &n, REACTION_FISSION, term, NULL);
+        } else if (soup->size == 0) {
+            push_next(soup, &size, term);
+        } else {
+            term_t *other = soup->terms[--soup->size];
+            push_reaction(soup, &n, REACTION_FUSION, other, term);
+        }
+    }
+
+    double shuffled = now();
+    long deltas[COMBINATORS];
+    run_reactions(soup, n, next_rng(&soup->rng), deltas);
+    double reacted = now();
+    for (size_t i = 0; i < n; i++) {
+        reaction_t *r = &soup->reactions[i];
+        soup->exhausted += r->result != REDUCE_DONE;
+        soup->stats.reactions[r->kind]++;
+        if (r->kind == REACTION_REDUCTION) {
+            soup->stats.results[r->result]++;
+        }
+        for (int j = 0; j < 2 && soup->reactions[i].outputs[j] != NULL; j++) {
+            push_next(soup, &size, soup->reactions[i].outputs[j]);
+        }
+    }
+
+    // The next generation becomes the soup, and the old soup's storage is
+    // kept around for the generation after that:
+    term_t **terms = soup->terms;
+    size_t capacity = soup->capacity;
+    soup->terms = soup->next;
+    soup->capacity = soup->next_capacity;
+    soup->size = size;
+    soup->next = terms;
+    soup->next_capacity = capacity;
+
+    // Insert any deficit back into the soup as atomic terms. There may
+    // occasionally be a surplus from S terms, which we leave alone. Only the
+    // reactions can have changed the counts:
+    uint64_t topped_up[COMBINATORS] = { 0 };
+    for (int i = 0; i < COMBINATORS; i++) {
+        soup->counts[i] += deltas[i];
+    }
+    for (const char *c = soup->alphabet; *c != '\0'; c++) {
+        int i = combinator_index(*c);
+        for (long k = deltas[i]; k < 0; k++) {
+            push_term(&soup->terms, &soup->size, &soup->capacity, new_leaf(*c));
+            soup->counts[i]++;
+            topped_up[i]++;
+        }
+        soup->stats.topped_up[i] += topped_up[i];
+    }
+    soup->steps++;
+    trace_step(soup, n, topped_up);
+    detect_step(soup, n, topped_up);
+    soup->stats.seconds[PHASE_SHUFFLE] += shuffled - start;
+    soup->stats.seconds[PHASE_REACT] += reacted - shuffled;
+    soup->stats.seconds[PHASE_CONSERVE] += now() - reacted;
+    assert(!soup->debug || soup_check(soup));
+}
+
+void soup_step(soup_t *soup, int n_steps) {
+    assert(soup != NULL);
+    begin_generation();
+    for (int i = 0; i < n_steps; i++) {
+        step(soup);
+    }
+    end_generation();
+}
+
+// Which terms of the soup can react in each way, by position in the soup, as
+// weights of 0 or 1. Fusion is left out, as every term can fuse.
+typedef struct schedule {
+    fenwick_t reducible;
+    fenwick_t splittable;
+} schedule_t;
+
+static int reducible(term_t *term) {
+    return !term->normal;
+}
+
+static int splittable(term_t *term) {
+    return term->splits;
+}
+
+// Sets the weights of every term in the soup, making room for the given
+// number of terms.
+static void schedule_terms(soup_t *soup, schedule_t *s, size_t capacity) {
+    init_fenwick(&s->reducible, capacity);
+    init_fenwick(&s->splittable, capacity);
+    for (size_t i = 0; i < soup->size; i++) {
+        add_fenwick(&s->reducible, i, reducible(soup->terms[i]));
+        add_fenwick(&s->splittable, i, splittable(soup->terms[i]));
+    }
+}
+
+// Adds the weights of a term at the given position of the soup, or takes
+// them away if sign is -1.
+static void schedule_term(schedule_t *s, size_t i, term_t *term, int sign) {
+    add_fenwick(&s->reducible, i, (uint64_t) (sign * reducible(term)));
+    add_fenwick(&s->splittable, i, (uint64_t) (sign * splittable(term)));
+}
+
+// Replaces the term at the given position, taking ownership of the new one.
+static void replace_term(soup_t *soup, schedule_t *s, size_t i,
+                         term_t *term) {
+    schedule_term(s, i, soup->terms[i], -1);
+    schedule_term(s, i, term, 1);
+    free_term(soup->terms[i]);
+    soup->terms[i] = term;
+}
+
+// Adds a term to the end of the soup, taking ownership of it.
+static void append_term(soup_t *soup, schedule_t *s, term_t *term) {
+    if (soup->size == s->reducible.capacity) {
+        free_fenwick(&s->reducible);
+        free_fenwick(&s->splittable);
+        schedule_terms(soup, s, 2 * soup->size);
+    }
+    push_term(&soup->terms, &soup->size, &soup->capacity, term);
+    schedule_term(s, soup->size - 1, term, 1);
+}
+
+// Removes the term at the given position, moving the last term into its
+// place, and returns it.
+static term_t *remove_term(soup_t *soup, schedule_t *s, size_t i) {
+    term_t *term = soup->terms[i];
+    size_t last = soup->size - 1;
+    schedule_term(s, i, term, -1);
+    if (i != last) {
+        schedule_term(s, last, soup->terms[last], -1);
+        schedule_term(s, i, soup->terms[last], 1);
+        soup->terms[i] = soup->terms[last];
+    }
+    soup->size--;
+    return term;
+}
+
+// Splits the term at the given position, if fission_term does.
+static void split_term(soup_t *soup, schedule_t *s, size_t i) {
+    term_t *right = NULL;
+    term_t *left = fission_term(soup->terms[i], &soup->rng,
+                                soup->params.p_break, &right);
+    if (right == NULL) {
+        free_term(left);
+        return;
+    }
+    replace_term(soup, s, i, left);
+    append_term(soup, s, right);
+}
+
+// Reduces the term at the given position, falling back on the soup's policy
+// if it runs out of budget, and adds the change in each combinator to deltas.
+static void reduce_at(soup_t *soup, schedule_t *s, size_t i, long *deltas) {
+    term_t *term = soup->terms[i];
+    budget_t budget = soup->params.budget;
+    term_t *reduced = NULL;
+    int result = reduce_term_within(term, &budget, &reduced);
+    soup->stats.results[result]++;
+    for (int c = 0; c < COMBINATORS; c++) {
+        soup->stats.redexes[c] += budget.redexes[c];
+    }
+    if (result == REDUCE_DONE) {
+        for (int c = 0; c < COMBINATORS; c++) {
+            deltas[c] += (long) reduced->counts[c] - (long) term->counts[c];
+        }
+        replace_term(soup, s, i, reduced);
+        return;
+    }
+
+    soup->exhausted++;
+    if (soup->params.on_exhausted == BUDGET_FISSION) {
+        split_term(soup, s, i);
+    } else if (soup->params.on_exhausted == BUDGET_REMOVE) {
+        for (int c = 0; c < COMBINATORS; c++) {
+            deltas[c] -= term->counts[c];
+        }
+        free_term(remove_term(soup, s, i));
+    }
+}
+
+uint64_t soup_run(soup_t *soup, double duration, uint64_t max_events) {
+    assert(soup != NULL && duration >= 0.0);
+    soup_params_t *p = &soup->params;
+    double start = now();
+    double end = soup->time + duration;
+    schedule_t s;
+    schedule_terms(soup, &s, soup->capacity);
+
+    uint64_t n = 0;
+    while (max_events == 0 || n < max_events) {
+        // The time to the next reaction is exponentially distributed, with
+        // the total rate of every possible reaction:
+        double reduce = p->p_action * p->p_reduce * s.reducible.total;
+        double fission = p->p_action * p->p_fission * s.splittable.total;
+        double fusion = soup->size < 2 ? 0.0
+                                       : p->p_action * p->p_fusion * soup->size;
+        double total = reduce + fission + fusion;
+        if (total <= 0.0) {
+            soup->time = end;
+            break;
+        }
+        double dt = -log(1.0 - uniform_rng(&soup->rng)) / total;
+        if (soup->time + dt > end) {
+            soup->time = end;
+            break;
+        }
+        soup->time += dt;
+
+        // Only reductions can change the number of each combinator:
+        long deltas[COMBINATORS] = { 0 };
+        double u = uniform_rng(&soup->rng) * total;
+        if (u < reduce) {
+            uint64_t r = below_rng(&soup->rng, s.reducible.total);
+            reduce_at(soup, &s, find_fenwick(&s.reducible, r), deltas);
+            soup->stats.reactions[REACTION_REDUCTION]++;
+        } else if (u < reduce + fission) {
+            uint64_t r = below_rng(&soup->rng, s.splittable.total);
+            split_term(soup, &s, find_fenwick(&s.splittable, r));
+            soup->stats.reactions[REACTION_FISSION]++;
+        } else {
+            soup->stats.reactions[REACTION_FUSION]++;
+            // Fuse a random term with a random partner, which is removed:
+            size_t i = below_rng(&soup->rng, soup->size);
+            size_t j = below_rng(&soup->rng, soup->size - 1);
+            j += j >= i;
+            replace_term(soup, &s, i, fuse_terms(soup->terms[j],
+                                                 soup->terms[i]));
+            free_term(remove_term(soup, &s, j));
+        }
+
+        for (int i = 0; i < COMBINATORS; i++) {
+            soup->counts[i] += deltas[i];
+        }
+        for (const char *c = soup->alphabet; *c != '\0'; c++) {
+            int i = combinator_index(*c);
+            for (long k = deltas[i]; k < 0; k++) {
+                append_term(soup, &s, new_leaf(*c));
+                soup->counts[i]++;
+                soup->stats.topped_up[i]++;
+            }
+        }
+        n++;
+    }
+
+    free_fenwick(&s.reducible);
+    free_fenwick(&s.splittable);
+    soup->events += n;
+    if (n > 0) {
+        trace_restart(soup);
+        detect_restart(soup);
+    }
+    soup->stats.seconds[PHASE_REACT] += now() - start;
+    assert(!soup->debug || soup_check(soup));
+    return n;
+}
+
+void soup_histogram(soup_t *soup, uint64_t *histogram) {
+    assert(soup != NULL && histogram != NULL);
+    memset(histogram, 0, SIZE_BUCKETS * sizeof(uint64_t));
+    for (size_t i = 0; i < soup->size; i++) {
+        int bucket = 63 - __builtin_clzll(soup->terms[i]->size);
+        histogram[bucket < SIZE_BUCKETS ? bucket : SIZE_BUCKETS - 1]++;
+    }
+}
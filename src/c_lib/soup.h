@@ -0,0 +1,183 @@
+#pragma once
+#include "comb.h"
+#include "rng.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* A native implementation of the soup simulation in src/soup.py. A soup is a
+ * collection of terms, and in each step a random subset of them are reacted,
+ * by one of:
+ *   1) Reduction: the term is reduced by a step, as by reduce_term_within.
+ *   2) Fission: the term is split into two at a random point of its spine.
+ *   3) Fusion: another term is taken from the soup and fused with this one.
+ * Afterwards, any combinators that were lost from the soup by reactions are
+ * topped back up as atoms, so that the number of each combinator never drops.
+ * The soup keeps a running tally of each combinator, which reactions update
+ * by the difference between their inputs' and outputs' cached counts.
+ *
+ * Each step first decides serially which terms react and how, and then runs
+ * the reactions, optionally on a pool of threads that steal work from each
+ * other. Every reaction draws from its own random stream, so the outcome of
+ * a step depends only on the seed and not on the number of threads.
+ *
+ * Alternatively, the soup can be run in continuous time by soup_run, as a
+ * Markov chain in which each term reacts at a rate given by the same
+ * parameters, with one unit of time corresponding to a step. Reactions that
+ * the shape each node caches shows can't change anything, like reducing a
+ * term in normal form, are left out altogether, and the next reaction is
+ * drawn directly, so the cost of each one doesn't depend on the size of the
+ * soup. That is only a syntactic test, so a term like WWW, which reduces to
+ * itself without ever being in normal form, is still reduced.
+ */
+
+// What to do with a term whose reduction runs out of budget: keep the term as
+// it was, split it by fission instead, or remove it from the soup, in which
+// case its combinators are topped back up as atoms.
+#define BUDGET_KEEP 0
+#define BUDGET_FISSION 1
+#define BUDGET_REMOVE 2
+
+// Tunable parameters of the simulation. These default to the same values as
+// the constants in src/soup.py. Every reduction gets a fresh copy of the
+// budget, so the counters in it are always left at zero.
+typedef struct soup_params {
+		double p_action; // probability of applying an action to a term
+		double p_reduce; // probability of the action being a reduction
+		double p_fission; // probability of the action being a fission
+		double p_fusion; // probability of the action being a fusion
+		double p_break; // probability of breaking at any given fission point
+		budget_t budget; // budget of each reduction
+		int on_exhausted; // one of the BUDGET_ policies
+} soup_params_t;
+
+// Kinds of reaction:
+#define REACTION_FISSION 0
+#define REACTION_FUSION 1
+#define REACTION_REDUCTION 2
+#define REACTIONS 3
+
+// Phases of a step, which are timed separately: shuffling the soup and
+// deciding which terms react, running the reactions, and collecting their
+// outputs and topping up lost combinators. soup_run counts as reacting.
+#define PHASE_SHUFFLE 0
+#define PHASE_REACT 1
+#define PHASE_CONSERVE 2
+#define PHASES 3
+
+// Running totals of what the soup has done, for telemetry. These are cheap
+// enough to always be kept, as they are tallied per reaction, or timed per
+// phase of a whole step, so a caller can sample them as often as it likes and
+// take the difference between samples.
+typedef struct soup_stats {
+		uint64_t reactions[REACTIONS]; // reactions run of each kind
+		uint64_t results[4]; // reductions with each REDUCE_ result
+		uint64_t redexes[COMBINATORS]; // redexes contracted of each combinator
+		uint64_t topped_up[COMBINATORS]; // atoms added back of each combinator
+		double seconds[PHASES]; // wall time spent in each phase
+} soup_stats_t;
+
+// Number of buckets in a histogram of term sizes, where bucket i counts the
+// terms with at least 2^i and fewer than 2^(i+1) leaves, apart from the last,
+// which counts every larger term too.
+#define SIZE_BUCKETS 24
+
+// A reaction scheduled for the current step, consuming its inputs and
+// producing up to two outputs.
+typedef struct reaction {
+		int kind;
+		int result; // REDUCE_ result of a reduction
+		term_t *inputs[2];
+		term_t *outputs[2];
+		uint64_t hashes[2]; // of the inputs, which reacting frees
+} reaction_t;
+
+typedef struct soup {
+		soup_params_t params;
+		char alphabet[COMBINATORS + 1]; // combinators the soup is made of
+		term_t **terms; // the terms in the soup, each one owned by it
+		size_t size;
+		size_t capacity;
+		term_t **next; // working memory for building the next generation
+		size_t next_capacity;
+		size_t counts[COMBINATORS]; // number of each combinator in the soup
+		reaction_t *reactions; // working memory for the current step's reactions
+		size_t reactions_capacity;
+		rng_t rng;
+		uint64_t steps; // number of steps simulated so far
+		double time; // time simulated by soup_run so far
+		uint64_t events; // number of reactions run by soup_run so far
+		uint64_t exhausted; // number of reductions that ran out of budget
+		soup_stats_t stats;
+		int threads; // number of threads to run reactions on
+		struct workers *workers; // thread pool, started on first use
+		struct checkpoint *checkpoint; // being written in the background, if any
+		struct trace *trace; // recording every step, if any
+		struct detector *detector; // watching for replicators, if any
+		int debug; // if set, every step asserts that soup_check passes
+} soup_t;
+
+// Returns the default parameters of the simulation.
+soup_params_t default_soup_params(void);
+
+// Creates a soup of the given number of atoms, drawn uniformly at random from
+// the given alphabet of combinators. The caller is responsible for freeing
+// the returned soup with free_soup.
+soup_t *new_soup(size_t terms, const char *alphabet, uint64_t seed);
+void free_soup(soup_t *soup);
+
+// Simulates the given number of steps of the soup.
+void soup_step(soup_t *soup, int n_steps);
+
+// Simulates the soup in continuous time for the given duration, or until it
+// has run max_events reactions, if that isn't 0. In each unit of time, each
+// term is reduced at a rate of p_action * p_reduce if it isn't in normal form,
+// split at a rate of p_action * p_fission if it has an atom on its spine that
+// fission_term can split it before, and fused with a random partner at a rate
+// of p_action * p_fusion. A fission that breaks at none of those atoms leaves
+// the term as it was, as it does in soup_step, but still counts as a reaction.
+// Reducing a term like WWW, which reduces to itself, is likewise a reaction.
+// Any combinators lost by a reduction are topped back up as atoms right away.
+// Returns the number of reactions run. This always runs on the calling
+// thread, and takes time linear in the size of the soup to set up.
+uint64_t soup_run(soup_t *soup, double duration, uint64_t max_events);
+
+// Writes a histogram of the sizes of the terms in the soup to the given array
+// of SIZE_BUCKETS counts. This takes time linear in the number of terms, as
+// each one caches its size.
+void soup_histogram(soup_t *soup, uint64_t *histogram);
+
+// Sets the number of threads that reactions are run on, including the calling
+// thread. The default is 1, which runs everything on the calling thread.
+void soup_threads(soup_t *soup, int threads);
+
+// Splits the given term in two at a random point of its spine, returning a
+// new reference to the left half, and setting *right to a new reference to
+// the right half, or to NULL if the term wasn't split. A term h a1 ... an can
+// be split before any ai that is an atom, apart from an, giving h a1 ... ai-1
+// and ai ... an. Each such point is broken with probability p_break, from
+// left to right, until one is. This is the same as splitting the term's
+// string at an atom outside of any brackets, but works on the tree directly,
+// in time proportional to the length of the spine. The caller is responsible
+// for freeing the returned terms.
+term_t *fission_term(term_t *term, rng_t *rng, double p_break,
+                     term_t **right);
+
+// Fuses two terms into one whose string is the concatenation of theirs, so
+// that fusing h a1 ... an with g b1 ... bm gives h a1 ... an g b1 ... bm. This
+// works on the tree directly, in time proportional to the length of the
+// second term's spine. The caller is responsible for freeing the returned
+// term.
+term_t *fuse_terms(term_t *left, term_t *right);
+
+// Recounts every combinator in the soup by walking each term, and returns 1
+// if the soup's tally and every term's cached counts agree with it, or 0
+// otherwise. This is slow, and only meant for debugging.
+int soup_check(soup_t *soup);
+
+// Returns a new reference to the ith term of the soup. The caller is
+// responsible for freeing the returned term.
+term_t *soup_term(soup_t *soup, size_t i);
+
+// Writes a new reference to every term of the soup to out, which must have
+// room for soup->size terms. The caller is responsible for freeing them.
+void soup_terms(soup_t *soup, term_t **out);
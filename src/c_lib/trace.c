@@ -0,0 +1,571 @@
+#include "trace.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define MAGIC "COMBTRAC"
+#define CHUNK_MAGIC "CHNK"
+#define HEADER_SIZE 16
+#define APP '@'
+// The most chunks that may be waiting to be written before the soup has to
+// wait for the writer to catch up:
+#define MAX_PENDING 4
+
+// A growable array of bytes.
+typedef struct buffer {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+} buffer_t;
+
+static void put_bytes(buffer_t *buffer, const void *data, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    if (buffer->len + n > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->len + n) {
+            capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, capacity);
+        assert(buffer->data != NULL);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->len, data, n);
+    buffer->len += n;
+}
+
+static void put_u8(buffer_t *buffer, uint8_t value) {
+    put_bytes(buffer, &value, 1);
+}
+
+static void put_u32(buffer_t *buffer, uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = value >> (8 * i);
+    }
+    put_bytes(buffer, bytes, sizeof(bytes));
+}
+
+static void put_u64(buffer_t *buffer, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = value >> (8 * i);
+    }
+    put_bytes(buffer, bytes, sizeof(bytes));
+}
+
+static void put_varint(buffer_t *buffer, uint64_t value) {
+    uint8_t bytes[10];
+    int n = 0;
+    for (; value >= 0x80; value >>= 7) {
+        bytes[n++] = value | 0x80;
+    }
+    bytes[n++] = value;
+    put_bytes(buffer, bytes, n);
+}
+
+// Writes a signed number as a varint, zigzag-encoded so that small changes
+// either way stay small.
+static void put_change(buffer_t *buffer, int64_t value) {
+    put_varint(buffer, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+// An open-addressed hash table from the structural hash of a term to a count,
+// and possibly a reference to the term. Entries are never removed, but may
+// have a count of 0.
+typedef struct entry {
+    uint64_t hash;
+    int64_t count;
+    term_t *term;
+    int used;
+} entry_t;
+
+typedef struct table {
+    entry_t *entries;
+    size_t size; // always a power of two, at least twice the entries used
+    size_t used;
+} table_t;
+
+static void init_table(table_t *table, size_t size) {
+    table->entries = calloc(size, sizeof(entry_t));
+    assert(table->entries != NULL);
+    table->size = size;
+    table->used = 0;
+}
+
+static void clear_table(table_t *table) {
+    memset(table->entries, 0, table->size * sizeof(entry_t));
+    table->used = 0;
+}
+
+static entry_t *find_entry(table_t *table, uint64_t hash) {
+    size_t mask = table->size - 1;
+    size_t b = hash & mask;
+    while (table->entries[b].used && table->entries[b].hash != hash) {
+        b = (b + 1) & mask;
+    }
+    return &table->entries[b];
+}
+
+static int has_entry(table_t *table, uint64_t hash) {
+    return find_entry(table, hash)->used;
+}
+
+// Returns the entry for the given hash, adding it with a count of 0 if there
+// isn't one yet.
+static entry_t *get_entry(table_t *table, uint64_t hash) {
+    if (2 * (table->used + 1) > table->size) {
+        table_t grown;
+        init_table(&grown, 2 * table->size);
+        for (size_t i = 0; i < table->size; i++) {
+            if (table->entries[i].used) {
+                *find_entry(&grown, table->entries[i].hash) = table->entries[i];
+            }
+        }
+        grown.used = table->used;
+        free(table->entries);
+        *table = grown;
+    }
+    entry_t *entry = find_entry(table, hash);
+    if (!entry->used) {
+        entry->used = 1;
+        entry->hash = hash;
+        table->used++;
+    }
+    return entry;
+}
+
+// Releases the references held by the table's entries, and empties it.
+static void release_table(table_t *table) {
+    for (size_t i = 0; i < table->size; i++) {
+        free_term(table->entries[i].term);
+    }
+    clear_table(table);
+}
+
+// A chunk that is ready to be compressed and written.
+typedef struct sealed {
+    struct sealed *next;
+    buffer_t contents;
+    uint64_t first_step;
+    uint32_t steps;
+} sealed_t;
+
+struct trace {
+    int fd;
+    int steps_per_chunk;
+    table_t population; // copies of each term in the soup, with a reference
+    table_t changes; // change in copies of each term in the current step
+    table_t emitted; // nodes already written to the current chunk
+    buffer_t chunk; // contents of the current chunk so far
+    uint64_t first_step; // step of the current chunk's keyframe
+    uint32_t steps; // steps recorded in the current chunk so far
+    buffer_t nodes; // nodes new to the chunk in the current step
+    uint64_t new_nodes;
+    buffer_t counts; // changes in copies, or the copies in a keyframe
+    uint64_t new_counts;
+    term_t **stack; // nodes waiting for their children to be emitted
+    size_t stack_capacity;
+
+    // Sealed chunks are queued for the writer thread, which owns them:
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // signalled when a chunk is queued or the trace stops
+    pthread_cond_t room; // signalled when a chunk has been written
+    sealed_t *head;
+    sealed_t *tail;
+    int pending; // chunks queued or being written
+    int stopping;
+    int error; // errno of the first write that failed, or 0
+};
+
+// Writes the given term's nodes that haven't been written to the current chunk
+// yet, children first.
+static void emit_term(struct trace *trace, term_t *term) {
+    if (has_entry(&trace->emitted, term->hash)) {
+        return;
+    }
+    size_t depth = 0;
+    trace->stack[depth++] = term;
+    while (depth > 0) {
+        term_t *node = trace->stack[depth - 1];
+        if (has_entry(&trace->emitted, node->hash)) {
+            depth--;
+            continue;
+        }
+        if (trace->stack_capacity < depth + 2) {
+            trace->stack_capacity *= 2;
+            trace->stack = realloc(trace->stack,
+                                   trace->stack_capacity * sizeof(term_t *));
+            assert(trace->stack != NULL);
+        }
+        int ready = 1;
+        if (!node->is_leaf && !has_entry(&trace->emitted, node->right->hash)) {
+            trace->stack[depth++] = node->right;
+            ready = 0;
+        }
+        if (!node->is_leaf && !has_entry(&trace->emitted, node->left->hash)) {
+            trace->stack[depth++] = node->left;
+            ready = 0;
+        }
+        if (!ready) {
+            continue;
+        }
+        get_entry(&trace->emitted, node->hash);
+        put_u64(&trace->nodes, node->hash);
+        if (node->is_leaf) {
+            put_u8(&trace->nodes, node->c);
+        } else {
+            put_u8(&trace->nodes, APP);
+            put_u64(&trace->nodes, node->left->hash);
+            put_u64(&trace->nodes, node->right->hash);
+        }
+        trace->new_nodes++;
+        depth--;
+    }
+}
+
+// Appends the nodes and counts gathered so far to the current chunk, each
+// preceded by how many there are.
+static void flush_sections(struct trace *trace) {
+    put_varint(&trace->chunk, trace->new_nodes);
+    put_bytes(&trace->chunk, trace->nodes.data, trace->nodes.len);
+    put_varint(&trace->chunk, trace->new_counts);
+    put_bytes(&trace->chunk, trace->counts.data, trace->counts.len);
+    trace->nodes.len = trace->counts.len = 0;
+    trace->new_nodes = trace->new_counts = 0;
+}
+
+// Starts a new chunk at the soup's current step, with a keyframe of the whole
+// population. Terms that have died out are dropped from the population.
+static void start_chunk(struct trace *trace, soup_t *soup) {
+    trace->first_step = soup->steps;
+    trace->steps = 0;
+    clear_table(&trace->emitted);
+
+    table_t population;
+    init_table(&population, 64);
+    for (size_t i = 0; i < trace->population.size; i++) {
+        entry_t *entry = &trace->population.entries[i];
+        if (entry->used && entry->count > 0) {
+            *get_entry(&population, entry->hash) = *entry;
+            emit_term(trace, entry->term);
+            put_u64(&trace->counts, entry->hash);
+            put_varint(&trace->counts, entry->count);
+            trace->new_counts++;
+        }
+    }
+    free(trace->population.entries);
+    trace->population = population;
+    flush_sections(trace);
+}
+
+// Queues the current chunk for the writer, waiting for it if too many chunks
+// are already queued, and leaves the current chunk empty.
+static void seal_chunk(struct trace *trace) {
+    sealed_t *sealed = malloc(sizeof(sealed_t));
+    assert(sealed != NULL);
+    sealed->next = NULL;
+    sealed->contents = trace->chunk;
+    sealed->first_step = trace->first_step;
+    sealed->steps = trace->steps;
+    memset(&trace->chunk, 0, sizeof(trace->chunk));
+
+    pthread_mutex_lock(&trace->lock);
+    while (trace->pending >= MAX_PENDING) {
+        pthread_cond_wait(&trace->room, &trace->lock);
+    }
+    if (trace->tail != NULL) {
+        trace->tail->next = sealed;
+    } else {
+        trace->head = sealed;
+    }
+    trace->tail = sealed;
+    trace->pending++;
+    pthread_cond_signal(&trace->wake);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+// Recounts the population from the soup's terms.
+static void count_population(struct trace *trace, soup_t *soup) {
+    release_table(&trace->population);
+    for (size_t i = 0; i < soup->size; i++) {
+        entry_t *entry = get_entry(&trace->population, soup->terms[i]->hash);
+        if (entry->count++ == 0) {
+            entry->term = copy_term(soup->terms[i]);
+        }
+    }
+}
+
+// Writes all the given bytes to the file. Returns 0, or an errno on failure.
+static int write_all(int fd, const void *data, size_t bytes) {
+    for (size_t done = 0; done < bytes;) {
+        ssize_t n = write(fd, (const char *) data + done, bytes - done);
+        if (n >= 0) {
+            done += n;
+        } else if (errno != EINTR) {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+// Compresses the chunk and appends it to the file. Returns 0, or an errno on
+// failure.
+static int write_chunk(int fd, sealed_t *chunk) {
+    uLongf bytes = compressBound(chunk->contents.len);
+    Bytef *data = malloc(bytes);
+    if (data == NULL || compress2(data, &bytes, chunk->contents.data,
+                                  chunk->contents.len, Z_BEST_SPEED) != Z_OK) {
+        // Compression can only fail for lack of memory:
+        free(data);
+        return ENOMEM;
+    }
+    buffer_t header = { 0 };
+    put_bytes(&header, CHUNK_MAGIC, 4);
+    put_u32(&header, chunk->steps);
+    put_u64(&header, chunk->first_step);
+    put_u64(&header, chunk->contents.len);
+    put_u64(&header, bytes);
+    put_u32(&header, crc32(0, data, bytes));
+    put_u32(&header, 0);
+    int error = write_all(fd, header.data, header.len);
+    if (error == 0) {
+        error = write_all(fd, data, bytes);
+    }
+    free(header.data);
+    free(data);
+    return error;
+}
+
+static void *write_chunks(void *arg) {
+    struct trace *trace = arg;
+    pthread_mutex_lock(&trace->lock);
+    while (1) {
+        while (trace->head == NULL && !trace->stopping) {
+            pthread_cond_wait(&trace->wake, &trace->lock);
+        }
+        sealed_t *chunk = trace->head;
+        if (chunk == NULL) {
+            break;
+        }
+        trace->head = chunk->next;
+        if (trace->head == NULL) {
+            trace->tail = NULL;
+        }
+
+        // Once a write has failed, the rest of the file is unusable, so later
+        // chunks are dropped:
+        int failed = trace->error != 0;
+        pthread_mutex_unlock(&trace->lock);
+        int error = failed ? 0 : write_chunk(trace->fd, chunk);
+        free(chunk->contents.data);
+        free(chunk);
+        pthread_mutex_lock(&trace->lock);
+        if (error != 0) {
+            trace->error = error;
+        }
+        trace->pending--;
+        pthread_cond_signal(&trace->room);
+    }
+    pthread_mutex_unlock(&trace->lock);
+    return NULL;
+}
+
+int soup_trace(soup_t *soup, const char *path, int steps_per_chunk) {
+    assert(soup != NULL && steps_per_chunk > 0);
+    int ok = soup_trace_stop(soup);
+    int error = ok ? 0 : errno;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    buffer_t header = { 0 };
+    put_bytes(&header, MAGIC, 8);
+    put_u32(&header, TRACE_VERSION);
+    put_u32(&header, HEADER_SIZE);
+    int failed = write_all(fd, header.data, header.len);
+    free(header.data);
+    if (failed != 0) {
+        close(fd);
+        errno = failed;
+        return 0;
+    }
+
+    struct trace *trace = calloc(1, sizeof(struct trace));
+    assert(trace != NULL);
+    trace->fd = fd;
+    trace->steps_per_chunk = steps_per_chunk;
+    init_table(&trace->population, 64);
+    init_table(&trace->changes, 64);
+    init_table(&trace->emitted, 64);
+    trace->stack_capacity = 64;
+    trace->stack = malloc(trace->stack_capacity * sizeof(term_t *));
+    assert(trace->stack != NULL);
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->wake, NULL);
+    pthread_cond_init(&trace->room, NULL);
+    failed = pthread_create(&trace->thread, NULL, write_chunks, trace);
+    if (failed != 0) {
+        pthread_mutex_destroy(&trace->lock);
+        pthread_cond_destroy(&trace->wake);
+        pthread_cond_destroy(&trace->room);
+        free(trace->population.entries);
+        free(trace->changes.entries);
+        free(trace->emitted.entries);
+        free(trace->stack);
+        free(trace);
+        close(fd);
+        errno = failed;
+        return 0;
+    }
+    soup->trace = trace;
+    count_population(trace, soup);
+    start_chunk(trace, soup);
+    if (!ok) {
+        errno = error;
+    }
+    return ok;
+}
+
+int soup_trace_stop(soup_t *soup) {
+    struct trace *trace = soup->trace;
+    if (trace == NULL) {
+        return 1;
+    }
+    seal_chunk(trace);
+    pthread_mutex_lock(&trace->lock);
+    trace->stopping = 1;
+    pthread_cond_signal(&trace->wake);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->thread, NULL);
+    soup->trace = NULL;
+
+    int error = trace->error;
+    if (close(trace->fd) != 0 && error == 0) {
+        error = errno;
+    }
+    release_table(&trace->population);
+    free(trace->population.entries);
+    free(trace->changes.entries);
+    free(trace->emitted.entries);
+    free(trace->nodes.data);
+    free(trace->counts.data);
+    free(trace->stack);
+    pthread_mutex_destroy(&trace->lock);
+    pthread_cond_destroy(&trace->wake);
+    pthread_cond_destroy(&trace->room);
+    free(trace);
+    if (error != 0) {
+        errno = error;
+        return 0;
+    }
+    return 1;
+}
+
+// Adds a change in the copies of a term to the current step. The term is
+// only needed if the change is positive, as the term may have been freed
+// otherwise.
+static void add_change(struct trace *trace, uint64_t hash, int64_t change,
+                       term_t *term) {
+    entry_t *entry = get_entry(&trace->changes, hash);
+    entry->count += change;
+    if (change > 0) {
+        entry->term = term;
+    }
+}
+
+void trace_step(soup_t *soup, size_t reactions, const uint64_t *topped_up) {
+    struct trace *trace = soup->trace;
+    if (trace == NULL) {
+        return;
+    }
+
+    // Net out the change in copies of each term over the step. The inputs of
+    // the reactions have been freed by now, but their hashes were kept:
+    clear_table(&trace->changes);
+    for (size_t i = 0; i < reactions; i++) {
+        reaction_t *r = &soup->reactions[i];
+        for (int j = 0; j < 2 && r->inputs[j] != NULL; j++) {
+            add_change(trace, r->hashes[j], -1, NULL);
+        }
+        for (int j = 0; j < 2 && r->outputs[j] != NULL; j++) {
+            add_change(trace, r->outputs[j]->hash, 1, r->outputs[j]);
+        }
+    }
+    for (const char *c = soup->alphabet; *c != '\0'; c++) {
+        uint64_t k = topped_up[combinator_index(*c)];
+        if (k > 0) {
+            // Leaves are never freed, so this one outlives the reference:
+            term_t *leaf = new_leaf(*c);
+            add_change(trace, leaf->hash, k, leaf);
+            free_term(leaf);
+        }
+    }
+
+    // Apply the changes to the population, writing out the nodes of any term
+    // that has come back from having no copies, if they aren't in the chunk:
+    for (size_t i = 0; i < trace->changes.size; i++) {
+        entry_t *change = &trace->changes.entries[i];
+        if (!change->used || change->count == 0) {
+            continue;
+        }
+        entry_t *entry = get_entry(&trace->population, change->hash);
+        if (entry->count == 0) {
+            assert(change->count > 0);
+            entry->term = copy_term(change->term);
+            emit_term(trace, change->term);
+        }
+        entry->count += change->count;
+        assert(entry->count >= 0);
+        if (entry->count == 0) {
+            free_term(entry->term);
+            entry->term = NULL;
+        }
+        put_u64(&trace->counts, change->hash);
+        put_change(&trace->counts, change->count);
+        trace->new_counts++;
+    }
+    flush_sections(trace);
+
+    put_varint(&trace->chunk, reactions);
+    for (size_t i = 0; i < reactions; i++) {
+        reaction_t *r = &soup->reactions[i];
+        int inputs = r->inputs[1] != NULL ? 2 : 1;
+        int outputs = 0;
+        while (outputs < 2 && r->outputs[outputs] != NULL) {
+            outputs++;
+        }
+        put_u8(&trace->chunk, r->kind);
+        put_u8(&trace->chunk, r->result);
+        put_u8(&trace->chunk, inputs);
+        for (int j = 0; j < inputs; j++) {
+            put_u64(&trace->chunk, r->hashes[j]);
+        }
+        put_u8(&trace->chunk, outputs);
+        for (int j = 0; j < outputs; j++) {
+            put_u64(&trace->chunk, r->outputs[j]->hash);
+        }
+    }
+
+    if (++trace->steps == (uint32_t) trace->steps_per_chunk) {
+        seal_chunk(trace);
+        start_chunk(trace, soup);
+    }
+}
+
+void trace_restart(soup_t *soup) {
+    struct trace *trace = soup->trace;
+    if (trace == NULL) {
+        return;
+    }
+    seal_chunk(trace);
+    count_population(trace, soup);
+    start_chunk(trace, soup);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "soup.h"
+
+/* A population trace of a soup, recording what changed in every step to a
+ * compressed, append-only file, so that a run can be analysed afterwards
+ * without having to print anything while it runs.
+ *
+ * The trace tracks how many copies of each distinct term the soup holds, by
+ * structural hash, and updates the count from each step's reactions and top-
+ * ups, so recording a step takes time proportional to its reactions rather
+ * than to the size of the soup. Each step's record holds the nodes of any
+ * terms that are new to the chunk, the change in the number of copies of
+ * every term whose count changed, and every reaction, as its kind, result,
+ * and the hashes of its inputs and outputs.
+ *
+ * Records are grouped into chunks of a fixed number of steps, each of which
+ * starts with a keyframe of the whole population, and holds every node its
+ * records refer to, so that a reader can seek to any step by decoding a single
+ * chunk. Terms are written as nodes rather than strings, as terms in a soup
+ * share so many subterms that their strings can be enormous: each node is a
+ * hash, and either a combinator or '@' and the hashes of its children, which
+ * come before it. Chunks are compressed with zlib and written by a background
+ * thread, so the simulation only waits for it if it falls several chunks
+ * behind.
+ *
+ * The file starts with the magic "COMBTRAC" and a 32-bit version and header
+ * size. Each chunk then has a 40-byte header: the magic "CHNK", the number of
+ * steps recorded in it, the step of its keyframe, the sizes of its contents
+ * before and after compression, and the CRC-32 of the compressed contents.
+ * Integers in headers are little-endian and fixed-size, and those in chunks
+ * are LEB128 varints, apart from hashes, which are 8 bytes little-endian, and
+ * changes in counts, which are zigzag-encoded varints. src/trace.py reads it.
+ *
+ * soup_run doesn't record its reactions one by one. Instead, the trace starts
+ * a new chunk when it returns, from the soup as it stands, so the population
+ * at a step of the trace is that after the step and any soup_run after it.
+ */
+
+#define TRACE_VERSION 1
+
+// Starts tracing the soup to the given file, replacing it, with the given
+// number of steps in each chunk. Any trace the soup already has is stopped
+// first. Returns 1 on success, or 0 with errno set on failure, or if
+// stopping the previous trace failed, in which case this one is still
+// started if it can be.
+int soup_trace(soup_t *soup, const char *path, int steps_per_chunk);
+
+// Stops tracing the soup, if it is being traced, writing out the last chunk
+// and waiting for the file to be written. Returns 1 on success, or 0 with
+// errno set if any part of the trace couldn't be written. free_soup also
+// stops the trace.
+int soup_trace_stop(soup_t *soup);
+
+// These are called by the soup itself: trace_step after each step, with the
+// number of its reactions and the atoms of each combinator topped up, and
+// trace_restart whenever the soup has changed in some other way.
+void trace_step(soup_t *soup, size_t reactions, const uint64_t *topped_up);
+void trace_restart(soup_t *soup);
@@ -0,0 +1,154 @@
+#include "brackets.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+static void masks_scalar(const char *p, uint64_t *opens, uint64_t *closes) {
+  uint64_t o = 0, c = 0;
+  for (int k = 0; k < 64; k++) {
+    o |= (uint64_t) (p[k] == '(') << k;
+    c |= (uint64_t) (p[k] == ')') << k;
+  }
+  *opens = o;
+  *closes = c;
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2")))
+static void masks_sse2(const char *p, uint64_t *opens, uint64_t *closes) {
+  const __m128i open = _mm_set1_epi8('('), close = _mm_set1_epi8(')');
+  uint64_t o = 0, c = 0;
+  for (int k = 0; k < 64; k += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (p + k));
+    o |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, open)) << k;
+    c |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, close)) << k;
+  }
+  *opens = o;
+  *closes = c;
+}
+
+__attribute__((target("avx2")))
+static void masks_avx2(const char *p, uint64_t *opens, uint64_t *closes) {
+  const __m256i open = _mm256_set1_epi8('('), close = _mm256_set1_epi8(')');
+  uint64_t o = 0, c = 0;
+  for (int k = 0; k < 64; k += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (p + k));
+    o |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, open)) << k;
+    c |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, close)) << k;
+  }
+  *opens = o;
+  *closes = c;
+}
+#endif
+
+typedef void (*masks_t)(const char *p, uint64_t *opens, uint64_t *closes);
+
+static masks_t masks = NULL;
+
+// Picks the widest implementation the CPU supports, the first time it's
+// needed. Racing threads would all pick the same one, so there's no harm.
+static masks_t pick_masks(void) {
+  if (masks == NULL) {
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    masks = __builtin_cpu_supports("avx2") ? masks_avx2 :
+      __builtin_cpu_supports("sse2") ? masks_sse2 : masks_scalar;
+#else
+    masks = masks_scalar;
+#endif
+  }
+  return masks;
+}
+
+int use_bracket_masks(const char *name) {
+  if (strcmp(name, "scalar") == 0) {
+    masks = masks_scalar;
+    return 1;
+  }
+#ifdef HAVE_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    masks = masks_sse2;
+    return 1;
+  }
+  if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    masks = masks_avx2;
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+void bracket_masks(const char *p, uint64_t *opens, uint64_t *closes) {
+  pick_masks()(p, opens, closes);
+}
+
+// Finds the brackets in the 64 characters of the term from the given offset,
+// copying the end of the term into a padded block so as not to read past it.
+static void block_masks(masks_t masks, const char *term, int len, int base,
+    uint64_t *opens, uint64_t *closes) {
+  if (len - base >= 64) {
+    masks(term + base, opens, closes);
+  } else {
+    char block[64] = { 0 };
+    memcpy(block, term + base, len - base);
+    masks(block, opens, closes);
+  }
+}
+
+int has_brackets(const char *term, int len) {
+  masks_t masks = pick_masks();
+  for (int base = 0; base < len; base += 64) {
+    uint64_t o, c;
+    block_masks(masks, term, len, base, &o, &c);
+    if ((o | c) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int match_brackets(const char *term, int len, int *match, int *closes,
+    int *opens) {
+  masks_t masks = pick_masks();
+  int depth = 0, n = 0;
+  for (int base = 0; base < len; base += 64) {
+    uint64_t o, c;
+    block_masks(masks, term, len, base, &o, &c);
+
+    // The depth only changes at brackets, so only they need visiting, and a
+    // block that closes more brackets than it and the blocks before it open
+    // can't belong to a balanced term:
+    if ((o | c) == 0) {
+      continue;
+    }
+    if (__builtin_popcountll(c) > depth + __builtin_popcountll(o)) {
+      return -1;
+    }
+    for (uint64_t bits = o | c; bits != 0; bits &= bits - 1) {
+      int k = __builtin_ctzll(bits);
+      int i = base + k;
+      if ((o >> k) & 1) {
+        // An opening bracket with too few characters left after it to close
+        // it and those already open can't belong to a balanced term. This
+        // also keeps depth within opens, as depth <= i at every bracket:
+        if (depth + 1 > len - i - 1) {
+          return -1;
+        }
+        opens[depth++] = i;
+      } else {
+        if (depth == 0) {
+          return -1;
+        }
+        int open = opens[--depth];
+        match[open] = i;
+        match[i] = open;
+        closes[n++] = i;
+      }
+    }
+  }
+  return depth == 0 ? n : -1;
+}
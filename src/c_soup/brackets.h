@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+// Finding the redexes of a term means matching up its brackets, which is
+// where most of the time goes on long terms. Rather than look at the term a
+// character at a time, this finds the brackets in it 64 characters at a time
+// with vector compares, using AVX2 or SSE2 where the CPU has them (decided
+// once, at runtime) and plain C otherwise, and then only visits the brackets.
+// A term's brackets are almost always far fewer than its characters.
+
+// Writes masks of the opening and closing brackets among the 64 characters at
+// the given pointer to opens and closes, with bit k standing for p[k]. All 64
+// characters must be readable.
+void bracket_masks(const char *p, uint64_t *opens, uint64_t *closes);
+
+// Makes the rest of this file use the named implementation, one of "avx2",
+// "sse2" or "scalar", rather than the widest the CPU has, so that each can be
+// tested. Returns false, leaving the choice as it was, if the CPU lacks it.
+int use_bracket_masks(const char *name);
+
+// Returns true if the first len characters of the term contain a bracket.
+int has_brackets(const char *term, int len);
+
+// Matches up the brackets in the first len characters of the term. For every
+// bracket at offset i, match[i] is set to the offset of its partner, and the
+// offsets of the closing brackets are written to closes in order, so that
+// each group closes after every group nested inside it. Returns the number of
+// closing brackets, or -1 if the brackets are unbalanced, which is detected
+// before more than len / 2 brackets are open at once. The match array must
+// hold len ints, and closes and opens (which is working memory for the
+// brackets still open) must each hold len / 2 + 1.
+int match_brackets(const char *term, int len, int *match, int *closes,
+  int *opens);
@@ -0,0 +1,177 @@
+#include "brackets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks every implementation of bracket_masks, and match_brackets on top of
+// each, against a plain character-by-character scan of random terms, both
+// balanced and not. Buffers are allocated at exactly the sizes brackets.h
+// asks for, so that building with -fsanitize=address catches any access past
+// them.
+
+#define TERMS 200000
+#define MAX_LEN 8192
+
+// Terms that have got past match_brackets before, or nearly could have:
+static const char *fixed[] = {
+  "S((((((((((", "(", ")", "((", "))", ")(", "()", "S(", "(S", "S)", "())",
+  "(()", "S(K(I)", "S(K)I)", "((((((((((((((((((((((((((((((((S",
+  "S(((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((",
+};
+
+static unsigned long long x = 88172645463325252ull;
+
+static unsigned rnd(void) {
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return (unsigned) x;
+}
+
+// Appends a random balanced term, keeping n within MAX_LEN - 1.
+static void gen(char *buf, int *n, int depth) {
+  int items = rnd() % (depth == 0 ? 40 : 6);
+  for (int i = 0; i < items && *n < MAX_LEN / 2; i++) {
+    if (depth < 8 && rnd() % 3 == 0) {
+      buf[(*n)++] = '(';
+      gen(buf, n, depth + 1);
+      buf[(*n)++] = ')';
+    } else {
+      buf[(*n)++] = "SKIBCW"[rnd() % 6];
+    }
+  }
+}
+
+// Makes the term unbalanced half of the time, mostly by leaving brackets
+// unclosed, including runs of them longer than the rest of the term.
+static void unbalance(char *buf, int *n) {
+  switch (rnd() % 8) {
+    case 0: {
+      int k = 1 + rnd() % 200;
+      *n = 0;
+      buf[(*n)++] = 'S';
+      while (k--) {
+        buf[(*n)++] = '(';
+      }
+      break;
+    }
+    case 1: {
+      int k = 1 + rnd() % 100;
+      while (k--) {
+        buf[(*n)++] = '(';
+      }
+      break;
+    }
+    case 2:
+    case 3: {
+      int at = rnd() % (*n + 1);
+      memmove(buf + at + 1, buf + at, *n - at);
+      buf[at] = rnd() % 2 ? '(' : ')';
+      (*n)++;
+      break;
+    }
+  }
+}
+
+// The reference: returns the number of closing brackets, or -1.
+static int scan(const char *term, int len, int *match, int *closes) {
+  int *stack = malloc((len + 1) * sizeof(int));
+  int depth = 0, n = 0;
+  for (int i = 0; i < len; i++) {
+    if (term[i] == '(') {
+      stack[depth++] = i;
+    } else if (term[i] == ')') {
+      if (depth == 0) {
+        free(stack);
+        return -1;
+      }
+      int open = stack[--depth];
+      match[open] = i;
+      match[i] = open;
+      closes[n++] = i;
+    }
+  }
+  free(stack);
+  return depth == 0 ? n : -1;
+}
+
+// Returns the number of ways the implementation gets the term wrong.
+static int check(const char *str, int len) {
+  char *term = malloc(len > 0 ? len : 1);
+  memcpy(term, str, len);
+  int *match = malloc((len > 0 ? len : 1) * sizeof(int));
+  int *closes = malloc((len / 2 + 1) * sizeof(int));
+  int *opens = malloc((len / 2 + 1) * sizeof(int));
+  int *want_match = malloc((len > 0 ? len : 1) * sizeof(int));
+  int *want_closes = malloc((len + 1) * sizeof(int));
+
+  int errors = 0;
+  int want = scan(term, len, want_match, want_closes);
+  int got = match_brackets(term, len, match, closes, opens);
+  if (got != want) {
+    errors++;
+  } else if (got > 0) {
+    errors += memcmp(closes, want_closes, got * sizeof(int)) != 0;
+    for (int i = 0; i < len; i++) {
+      if ((term[i] == '(' || term[i] == ')') && match[i] != want_match[i]) {
+        errors++;
+        break;
+      }
+    }
+  }
+  int brackets = memchr(term, '(', len) != NULL || memchr(term, ')', len) != NULL;
+  errors += has_brackets(term, len) != brackets;
+
+  free(term);
+  free(match);
+  free(closes);
+  free(opens);
+  free(want_match);
+  free(want_closes);
+  return errors;
+}
+
+// Checks the masks of a block of random bytes, biased towards brackets.
+static int check_masks(void) {
+  char p[64];
+  uint64_t want_opens = 0, want_closes = 0;
+  for (int k = 0; k < 64; k++) {
+    unsigned r = rnd();
+    p[k] = r % 4 == 0 ? '(' : r % 4 == 1 ? ')' : (char) (r >> 8);
+    want_opens |= (uint64_t) (p[k] == '(') << k;
+    want_closes |= (uint64_t) (p[k] == ')') << k;
+  }
+  uint64_t opens, closes;
+  bracket_masks(p, &opens, &closes);
+  return opens != want_opens || closes != want_closes;
+}
+
+int main(void) {
+  const char *impls[] = { "scalar", "sse2", "avx2" };
+  char *buf = malloc(MAX_LEN);
+  int failed = 0;
+  for (int m = 0; m < 3; m++) {
+    if (!use_bracket_masks(impls[m])) {
+      printf("%s: not supported by this CPU, skipped\n", impls[m]);
+      continue;
+    }
+    x = 88172645463325252ull;
+    int errors = 0;
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+      errors += check(fixed[i], strlen(fixed[i]));
+    }
+    for (int t = 0; t < TERMS; t++) {
+      int n = 0;
+      gen(buf, &n, 0);
+      if (t % 2) {
+        unbalance(buf, &n);
+      }
+      errors += check(buf, n);
+      errors += check_masks();
+    }
+    printf("%s: %d terms, %d errors\n", impls[m], TERMS, errors);
+    failed |= errors > 0;
+  }
+  free(buf);
+  return failed;
+}
@@ -12,19 +12,29 @@ int main(int argc, char **argv) {
     term_t t = term_t_new(argv[1]);
     normalise(t, s);
     printf("%s\n", t);
-    t = reduce(t, s);
+    budget_t budget = { .max_steps = 10000, .max_symbols = 1 << 20 };
+    reduce_result_t result;
+    t = reduce(t, s, &budget, &result);
     printf("-> %s\n", t);
+    if (result != REDUCE_DONE) {
+      printf("(stopped after %d steps, at %d symbols: out of %s)\n",
+        budget.steps, budget.symbols,
+        result == REDUCE_OUT_OF_STEPS ? "steps" :
+        result == REDUCE_OUT_OF_SYMBOLS ? "symbols" : "bytes");
+    }
     term_t_free(t);
   }
 
-  // Time how many calls to apply can be made in 1 second:
+  // Time how many calls to apply can be made in 1 second. Each apply keeps
+  // the redexes up to date, so the term is only scanned for them once:
   {
     int count = 0;
     clock_t start = clock();
     for (int i = 0; i < 1000000; i++) {
       term_t t = term_t_new(argv[1]);
       normalise(t, s);
-      while (redexes(t, s)) {
+      redexes(t, s);
+      while (s->redexes->size > 0) {
         t = apply(t, subterms_t_top(s->redexes), s);
         count++;
       }
@@ -37,6 +47,42 @@ int main(int argc, char **argv) {
     printf("Applied %d redexes in %f seconds (%f redexes per second)\n", count, time, rate);
   }
 
+  // Time the same on a large term, made by applying a variable to 1000 copies
+  // of the given term, so that the cost of each apply on long terms shows:
+  {
+    int copies = 1000;
+    int len = strlen(argv[1]);
+    char *big = malloc(copies * (len + 2) + 2);
+    big[0] = 'a';
+    for (int i = 0; i < copies; i++) {
+      char *copy = big + 1 + i * (len + 2);
+      copy[0] = '(';
+      memcpy(copy + 1, argv[1], len);
+      copy[len + 1] = ')';
+    }
+    big[copies * (len + 2) + 1] = '\0';
+
+    int count = 0;
+    clock_t start = clock();
+    for (int i = 0; i < 10; i++) {
+      term_t t = term_t_new(big);
+      normalise(t, s);
+      redexes(t, s);
+      while (s->redexes->size > 0) {
+        t = apply(t, subterms_t_top(s->redexes), s);
+        count++;
+      }
+      term_t_free(t);
+    }
+
+    clock_t end = clock();
+    double time = (double)(end - start) / CLOCKS_PER_SEC;
+    double rate = count / time;
+    printf("Applied %d redexes to a term of %d symbols in %f seconds (%f redexes per second)\n",
+      count, (int) strlen(big), time, rate);
+    free(big);
+  }
+
   state_t_free(s);
   return 0;
 }
@@ -1,136 +1,390 @@
 #include "soup.h"
+#include "brackets.h"
 #include <stdlib.h>
 
+// Brackets that normalise has found to be redundant are overwritten with this
+// marker, and then squeezed out in a second pass.
+#define DROPPED '\x01'
+
+// Records another item of the given group, where open and close are the
+// offsets of the item's brackets, or -1 if it's an atom.
+static void add_item(group_t *g, int open, int close) {
+  if (g->count == 0) {
+    g->first_open = open;
+    g->first_close = close;
+  }
+  g->count++;
+}
+
 // Normalises the given term by removing all unnecessary parentheses. Note that
 // two terms can have different normal forms, and yet still behave in exactly
 // the same way: S(KI)Ix = KIx(Ix) = I(Ix) = Ix, for instance. This operates
-// in-place.
+// in-place, in time linear in the length of the term.
 void normalise(term_t term, state_t *s) {
   state_t_reset(s);
-  if (term == NULL || term[0] == '\0') {
+  if (term == NULL || !has_brackets(term, strlen(term))) {
     return;
   }
 
+  // A group's brackets are redundant if it has a single item, in which case
+  // it's equivalent to that item, or if it's the first item of a group with
+  // more than one, by left-associativity. So the fate of a group's first item
+  // is decided when the group closes. The top-level of the term acts as a
+  // group without brackets of its own.
+  groups_t_push(s->groups);
+  *groups_t_top(s->groups) = (group_t) { -1, 0, -1, -1 };
+  int i = 0;
+  for (; term[i] != '\0'; i++) {
+    if (term[i] == '(') {
+      groups_t_push(s->groups);
+      *groups_t_top(s->groups) = (group_t) { i, 0, -1, -1 };
+    } else if (term[i] == ')') {
+      group_t *g = groups_t_pop(s->groups);
+      int open = g->open, close = i;
+      if (g->count <= 1) {
+        term[open] = term[close] = DROPPED;
+        open = g->first_open;
+        close = g->first_close;
+      } else if (g->first_open >= 0) {
+        term[g->first_open] = term[g->first_close] = DROPPED;
+      }
+      if (g->count > 0) {
+        add_item(groups_t_top(s->groups), open, close);
+      }
+    } else {
+      add_item(groups_t_top(s->groups), -1, -1);
+    }
+  }
+  group_t *top = groups_t_top(s->groups);
+  if (top->first_open >= 0) {
+    term[top->first_open] = term[top->first_close] = DROPPED;
+  }
+
+  int j = 0;
+  for (int k = 0; k < i; k++) {
+    if (term[k] != DROPPED) {
+      term[j++] = term[k];
+    }
+  }
+  term[j] = '\0';
+}
+
+// Scans term[from, to), which must be a sequence of whole items, adding every
+// redex nested inside the items to out, in the order their groups close. The
+// offsets of the items themselves are left in the bottom frame of s->stack,
+// which is returned.
+static indices_t *scan(term_t term, int from, int to, state_t *s,
+    subterms_t *out) {
+  subterms_t_reset(s->stack);
   subterms_t_push(s->stack);
-  indices_t_push(subterms_t_top(s->stack));
-  *indices_t_top(subterms_t_top(s->stack)) = -1;
-  for (int i = 0; term[i] != '\0'; i++) {
+  for (int i = from; i < to; i++) {
+    // An opening bracket starts an item of the enclosing group, and a
+    // closing one ends the group it closes:
+    indices_t_push(subterms_t_top(s->stack));
+    *indices_t_top(subterms_t_top(s->stack)) = i;
     if (term[i] == '(') {
       subterms_t_push(s->stack);
-      indices_t_push(subterms_t_top(s->stack));
-      *indices_t_top(subterms_t_top(s->stack)) = i;
-    } else if (term[i] == ')' || term[i] == '\0') {
-      indices_t_push(subterms_t_top(s->stack));
-      *indices_t_top(subterms_t_top(s->stack)) = i;
+    } else if (term[i] == ')') {
       indices_t *pop = subterms_t_pop(s->stack);
-      if (pop->data[1] - pop->data[0] <= 2 ||
-          pop->data[0] == subterms_t_top(s->stack)->data[0] + 1) {
-        char *start = &term[pop->data[0]];
-        char *end = term + pop->data[1];
-        memcpy(end, end+1, strlen(end+1)+1);
-        memcpy(start, start+1, strlen(start+1)+1);
-        i -= 2;
+      if (subterm_is_redex(term, pop)) {
+        subterms_t_push(out);
+        indices_t_copy(pop, subterms_t_top(out));
       }
     }
-  };
+  }
+  return subterms_t_top(s->stack);
+}
+
+// Returns the offset just past the item starting at the given offset, which
+// is a single character unless it's a bracketed group.
+static int next_item(term_t term, int i, const int *match) {
+  return term[i] == '(' ? match[i] + 1 : i + 1;
+}
+
+// Adds the group of items in term[from, to) to s->redexes if it's a redex,
+// which only takes looking at as many items as the combinator's arity.
+static void add_group(term_t term, int from, int to, state_t *s) {
+  const rule_t *rule = from < to ? find_rule(term[from]) : NULL;
+  if (rule == NULL) {
+    return;
+  }
+  int items = 0;
+  for (int i = from; i < to && items <= rule->arity; items++) {
+    i = next_item(term, i, s->match);
+  }
+  if (items <= rule->arity) {
+    return;
+  }
+  subterms_t_push(s->redexes);
+  indices_t *redex = subterms_t_top(s->redexes);
+  for (int i = from; i < to; i = next_item(term, i, s->match)) {
+    indices_t_push(redex);
+    *indices_t_top(redex) = i;
+  }
+  indices_t_push(redex);
+  *indices_t_top(redex) = to;
 }
 
 // Writes all of the redexes in the given term to s->redexes, and returns
-// true if any redexes were found.
+// true if any redexes were found. The brackets are matched up first, so
+// that each group can be checked by skipping over its items, rather than
+// scanning every character of it. A term with unbalanced brackets has none.
 bool redexes(term_t term, state_t *s) {
-  state_t_reset(s);  
+  state_t_reset(s);
   if (term == NULL || term[0] == '\0') {
     return false;
   }
 
-  int i = -1;
-  subterms_t_push(s->stack);
-  do { // hack so we explicitly handle the '\0' char
-    i++;
-    if (term[i] == '(') {
-      indices_t_push(subterms_t_top(s->stack));
-      *indices_t_top(subterms_t_top(s->stack)) = i;
-      subterms_t_push(s->stack);
-    } else if (term[i] == ')' || term[i] == '\0') {
-      indices_t_push(subterms_t_top(s->stack));
-      *indices_t_top(subterms_t_top(s->stack)) = i;
-      indices_t *pop = subterms_t_pop(s->stack);
-      if (subterm_is_redex(term, pop)) {
-        subterms_t_push(s->redexes);
-        indices_t_copy(pop, subterms_t_top(s->redexes));
-      }
+  int len = strlen(term);
+  if (len > s->brackets_capacity) {
+    s->brackets_capacity = len;
+    s->match = realloc(s->match, len * sizeof(int));
+    s->closes = realloc(s->closes, (len / 2 + 1) * sizeof(int));
+    s->opens = realloc(s->opens, (len / 2 + 1) * sizeof(int));
+  }
+  int n = match_brackets(term, len, s->match, s->closes, s->opens);
+  if (n < 0) {
+    return false;
+  }
+
+  // Groups are listed in the order they close, and the top-level of the
+  // term acts as a group that closes at the '\0':
+  for (int i = 0; i < n; i++) {
+    add_group(term, s->match[s->closes[i]] + 1, s->closes[i], s);
+  }
+  add_group(term, 0, len, s);
+  return s->redexes->size > 0;
+}
+
+// Appends the given bytes to the end of the output buffer, which currently
+// holds len bytes, growing it as necessary.
+static void emit(state_t *s, int *len, const char *src, int n) {
+  if (*len + n + 1 > s->capacity) {
+    while (*len + n + 1 > s->capacity) {
+      s->capacity *= 2;
+    }
+    s->buffer = realloc(s->buffer, s->capacity);
+  }
+  memcpy(s->buffer + *len, src, n);
+  *len += n;
+}
+
+// Appends the given argument of a redex to the output buffer. Arguments in
+// head position never need their brackets, by left-associativity.
+static void emit_arg(state_t *s, int *len, term_t term, indices_t *indices,
+                     int arg, bool head) {
+  int start = indices->data[arg + 1];
+  int end = indices->data[arg + 2];
+  if (head && term[start] == '(') {
+    start++;
+    end--;
+  }
+  emit(s, len, term + start, end - start);
+}
+
+// Returns the length of the given argument of a redex, as it would be written
+// in the output of the redex.
+static int arg_length(term_t term, indices_t *indices, int arg, bool head) {
+  int start = indices->data[arg + 1];
+  int end = indices->data[arg + 2];
+  if (head && term[start] == '(') {
+    return end - start - 2;
+  }
+  return end - start;
+}
+
+// Returns whether the redex is a whole bracketed group that reduces to a
+// single atom, in which case its brackets are dropped along with it.
+static bool collapses(term_t term, indices_t *indices, const rule_t *rule) {
+  int start = indices->data[0];
+  int end = indices->data[rule->arity + 1];
+  return rule->output[1] == '\0' &&
+    arg_length(term, indices, rule->output[0] - '0', true) == 1 &&
+    start > 0 && term[start - 1] == '(' && term[end] == ')';
+}
+
+// Returns the change in the length of the term caused by applying the given
+// redex, which is negative if the redex shrinks the term.
+int growth(term_t term, indices_t *indices) {
+  const rule_t *rule = find_rule(term[indices->data[0]]);
+  int before = indices->data[rule->arity + 1] - indices->data[0];
+  int after = 0;
+  bool head = true;
+  for (const char *c = rule->output; *c != '\0'; c++) {
+    if (*c == '(' || *c == ')') {
+      after++;
+      head = *c == '(';
     } else {
-      indices_t_push(subterms_t_top(s->stack));
-      *indices_t_top(subterms_t_top(s->stack)) = i;
+      after += arg_length(term, indices, *c - '0', head);
+      head = false;
     }
-  } while (term[i] != '\0');
+  }
+  if (collapses(term, indices, rule)) {
+    after -= 2;
+  }
+  return after - before;
+}
 
-  return s->redexes->size > 0;
+// Moves the given redex to the end of the spare index, leaving an empty one in
+// its place, which is cheaper than copying it.
+static void keep_redex(indices_t *redex, state_t *s) {
+  subterms_t_push(s->spare);
+  indices_t tmp = *subterms_t_top(s->spare);
+  *subterms_t_top(s->spare) = *redex;
+  *redex = tmp;
+}
+
+// Returns the offset that the group of the given redex closes at.
+static int closes(indices_t *redex) {
+  return redex->data[redex->size - 1];
+}
+
+// Updates s->redexes after the given redex was applied, rewriting the old
+// term's [start, end) as the new term's [start, end + growth). The redexes
+// are kept in the order their groups close, so those that close before the
+// rewritten part are untouched, and those that close after it are shifted,
+// apart from the group the redex was in, whose items have changed. Any that
+// close inside it are replaced by those found by rescanning it.
+static void update_redexes(term_t term, indices_t *applied, int start,
+    int end, int growth, state_t *s) {
+  subterms_t *old = s->redexes;
+  subterms_t_reset(s->spare);
+  int i = 0;
+  for (; i < old->size && closes(&old->data[i]) < start; i++) {
+    keep_redex(&old->data[i], s);
+  }
+  while (i < old->size && closes(&old->data[i]) < end) {
+    i++; // rewritten, so found again by the scan below
+  }
+  indices_t *items = scan(term, start, end + growth, s, s->spare);
+  for (; i < old->size; i++) {
+    indices_t *redex = &old->data[i];
+    if (redex == applied) {
+      // The group keeps the items after the redex's arguments, and gains
+      // those of its output, which start where the redex did:
+      int rest = applied->size - 1;
+      while (rest > 0 && applied->data[rest - 1] >= end) {
+        rest--;
+      }
+      subterms_t_push(s->spare);
+      indices_t *group = subterms_t_top(s->spare);
+      indices_t_copy(items, group);
+      for (int j = rest; j < applied->size; j++) {
+        indices_t_push(group);
+        *indices_t_top(group) = applied->data[j] + growth;
+      }
+      if (!subterm_is_redex(term, group)) {
+        s->spare->size--;
+      }
+      continue;
+    }
+    int first = 0;
+    while (first < redex->size && redex->data[first] < end) {
+      first++;
+    }
+    for (int j = first; j < redex->size; j++) {
+      redex->data[j] += growth;
+    }
+    keep_redex(redex, s);
+  }
+
+  s->redexes = s->spare;
+  s->spare = old;
 }
 
-// Applies the given redex to the term in-place.
+// Applies the given redex to the term, writing the result into the state's
+// buffer by following the combinator's output template. The result is
+// returned, and the old term becomes the new buffer, so the caller must not
+// use it afterwards.
 term_t apply(term_t term, indices_t *indices, state_t *s) {
-  char *subterm = term + indices->data[0];
-  if (subterm[0] == 'I') {
-    // Ix = x
-    char *x = term + indices->data[1];
-    memcpy(subterm, x, strlen(x) + 1);
-  } else if (subterm[0] == 'K') {
-    // Kxy = x
-    char *x = term + indices->data[1];
-    char *y = term + indices->data[2];
-    char *rest = term + indices->data[3];
-    memcpy(y, rest, strlen(rest) + 1);
-    memcpy(subterm, x, strlen(x) + 1);
-  } else if (subterm[0] == 'S') {
-    // Sxyz = xz(yz)
-    int x_len = indices->data[2] - indices->data[1];
-    int y_len = indices->data[3] - indices->data[2];
-    int z_len = indices->data[4] - indices->data[3];
-    int rest_len = strlen(term + indices->data[4]);
-    int term_len = strlen(term);
-    term = realloc(term, sizeof(char) * (strlen(term) + z_len + 3));
-    subterm = term + indices->data[0];
-    char *x = term + indices->data[1];
-    char *y = term + indices->data[2];
-    char *z = term + indices->data[3];
-    char *rest = term + indices->data[4];
-    *(term + term_len + z_len + 2) = '\0';
-    memmove(rest + z_len + 2, rest, rest_len);
-    *(x + x_len + y_len + 2*z_len + 1) = ')';
-    memmove(x + x_len + y_len + z_len + 1, z, z_len);
-    memmove(x + x_len + z_len + 1, y, y_len);
-    *(x + x_len + z_len) = '(';
-    memmove(x + x_len, x + x_len + y_len + z_len + 1, z_len);
-    memmove(subterm, x, strlen(x) + 1);
-  }
-
-  normalise(term, s);
-  return term;
+  const rule_t *rule = find_rule(term[indices->data[0]]);
+  int start = indices->data[0];
+  int end = indices->data[rule->arity + 1];
+  if (collapses(term, indices, rule)) {
+    start--;
+    end++;
+  }
+
+  int len = 0;
+  emit(s, &len, term, start);
+  bool head = true;
+  for (const char *c = rule->output; *c != '\0'; c++) {
+    if (*c == '(' || *c == ')') {
+      emit(s, &len, c, 1);
+      head = *c == '(';
+    } else {
+      emit_arg(s, &len, term, indices, *c - '0', head);
+      head = false;
+    }
+  }
+  int rest = strlen(term + end);
+  emit(s, &len, term + end, rest);
+  s->buffer[len] = '\0';
+
+  // Swap the halves of the double buffer. The old term was allocated with
+  // at least enough room for itself, so that's its capacity from now on:
+  term_t result = s->buffer;
+  s->capacity = end + rest + 1;
+  s->buffer = term;
+  update_redexes(result, indices, start, end, len - (end + rest), s);
+  return result;
 }
 
-// Reduces the given term to its normal form, and returns the result. Note that
-// if the given term has no normal form, this will loop forever. We use the
-// heuristic that redexes which reduce the size of the term (i.e. K, I) are
-// applied first.
-term_t reduce(term_t term, state_t *s) {
-  while (redexes(term, s)) {
-    // Find the first K, I redex and apply it:
-    bool found = false;
-    for (int i = 0; i < s->redexes->size; i++) {
-      indices_t *indices = &s->redexes->data[i];
-      if (term[indices->data[0]] == 'K' ||
-          term[indices->data[0]] == 'I') {
-        term = apply(term, indices, s);
-        found = true;
-        break;
+// Returns why applying a redex that grows the given term by the given amount
+// would go over budget, or REDUCE_DONE if it wouldn't. The term is kept in a
+// double buffer, so it takes up twice its length in memory.
+static reduce_result_t over_budget(budget_t *budget, int len, int growth) {
+  if (budget->max_steps && budget->steps >= budget->max_steps) {
+    return REDUCE_OUT_OF_STEPS;
+  }
+  if (budget->max_symbols && len + growth > budget->max_symbols) {
+    return REDUCE_OUT_OF_SYMBOLS;
+  }
+  if (budget->max_bytes && 2 * (size_t) (len + growth + 1) > budget->max_bytes) {
+    return REDUCE_OUT_OF_BYTES;
+  }
+  return REDUCE_DONE;
+}
+
+// Reduces the given term to its normal form, and returns the result. We use
+// the heuristic that the redex which shrinks the term the most (e.g. K, I) is
+// applied first, and the one that grows it the least otherwise. Each redex is
+// checked against the budget before it's applied, so a term that runs out is
+// left whole, as it was after the last redex that fit. The term is only
+// scanned for redexes once, as apply keeps them up to date.
+term_t reduce(term_t term, state_t *s, budget_t *budget,
+    reduce_result_t *result) {
+  budget_t unlimited = { 0 };
+  if (budget == NULL) {
+    budget = &unlimited;
+  }
+  reduce_result_t stop = REDUCE_DONE;
+  int len = strlen(term);
+  redexes(term, s);
+  while (s->redexes->size > 0) {
+    indices_t *best = &s->redexes->data[0];
+    int best_growth = growth(term, best);
+    for (int i = 1; i < s->redexes->size; i++) {
+      int g = growth(term, &s->redexes->data[i]);
+      if (g < best_growth) {
+        best = &s->redexes->data[i];
+        best_growth = g;
       }
     }
-    // Or just apply the first one if they're all S redexes:
-    // TODO: might make sense to look for the smallest S redex
-    if (!found) {
-      term = apply(term, &s->redexes->data[0], s);
+    stop = over_budget(budget, len, best_growth);
+    if (stop != REDUCE_DONE) {
+      break;
     }
+    term = apply(term, best, s);
+    len += best_growth;
+    budget->steps++;
+    if (len > budget->symbols) {
+      budget->symbols = len;
+      budget->bytes = 2 * (size_t) (len + 1);
+    }
+  }
+  if (result != NULL) {
+    *result = stop;
   }
   return term;
 }
@@ -102,44 +102,159 @@ inline static int subterm_length(term_t term, indices_t *indices, int index) {
   int end = index == indices->size - 1 ? strlen(term) : indices->data[index + 1];
   return end - start;
 }
+
+// Each combinator is described by the number of arguments it takes, and a
+// template for the result of applying it, in which digits stand for its
+// arguments and brackets are copied as they are:
+//   Sxyz -> xz(yz)
+//   Kxy  -> x
+//   Ix   -> x
+//   Bxyz -> x(yz)
+//   Cxyz -> xzy
+//   Wxy  -> xyy
+// Adding a combinator only needs another entry here.
+typedef struct {
+  char combinator;
+  int arity;
+  const char *output;
+} rule_t;
+inline static const rule_t *find_rule(char c) {
+  static const rule_t rules[] = {
+    { 'S', 3, "02(12)" },
+    { 'K', 2, "0" },
+    { 'I', 1, "0" },
+    { 'B', 3, "0(12)" },
+    { 'C', 3, "021" },
+    { 'W', 2, "011" },
+  };
+  for (int i = 0; i < (int) (sizeof(rules) / sizeof(rules[0])); i++) {
+    if (rules[i].combinator == c) {
+      return &rules[i];
+    }
+  }
+  return NULL;
+}
 inline static bool subterm_is_redex(term_t term, indices_t *indices) {
-  return indices->size > 1 && subterm_length(term, indices, 0) == 1 && (
-    (term[indices->data[0]] == 'S' && indices->size >= 5) || 
-    (term[indices->data[0]] == 'K' && indices->size >= 4) ||
-    (term[indices->data[0]] == 'I' && indices->size >= 3)
-  );
+  if (indices->size <= 1 || subterm_length(term, indices, 0) != 1) {
+    return false;
+  }
+  const rule_t *rule = find_rule(term[indices->data[0]]);
+  return rule != NULL && indices->size >= rule->arity + 2;
 }
 
+// While normalising, we track each open bracketed group by the offset of its
+// opening bracket, the number of items in it so far, and the brackets of its
+// first item if that's a group too (or -1 if not), since whether the first
+// item needs brackets depends on how many items end up following it.
+typedef struct {
+  int open;
+  int count;
+  int first_open;
+  int first_close;
+} group_t;
+inline static void group_t_init(group_t *g) { g->count = 0; } // for STACK
+inline static void group_t_reset(group_t *g) { g->count = 0; } // for STACK
+inline static void group_t_free(group_t *g) {} // for STACK
+inline static void group_t_copy(group_t *src, group_t *dst) { *dst = *src; } // for STACK
+STACK(group_t, groups_t);
+
 // The following data structures act as cached working memory so we can avoid
-// allocations when we're messing with terms:
+// allocations when we're messing with terms. The buffer is the other half of
+// a double buffer for terms: apply writes its result into it and hands it
+// back, keeping the caller's old term as the next buffer. The redexes are an
+// index of the redexes in the current term, in the order their groups close,
+// which apply keeps up to date, and spare is the other half of a double
+// buffer for them. The brackets are the matching table and working memory
+// for match_brackets, big enough for terms of up to brackets_capacity.
 STACK(indices_t, subterms_t);
 typedef struct {
   subterms_t *stack;
   subterms_t *redexes;
+  subterms_t *spare;
+  groups_t *groups;
+  char *buffer;
+  int capacity;
+  int *match;
+  int *closes;
+  int *opens;
+  int brackets_capacity;
 } state_t;
 inline static void state_t_init(state_t *t) {
   t->stack = malloc(sizeof(subterms_t));
   t->redexes = malloc(sizeof(subterms_t));
+  t->spare = malloc(sizeof(subterms_t));
+  t->groups = malloc(sizeof(groups_t));
   subterms_t_init(t->stack);
   subterms_t_init(t->redexes);
+  subterms_t_init(t->spare);
+  groups_t_init(t->groups);
+  t->capacity = 256;
+  t->buffer = malloc(t->capacity);
+  t->match = t->closes = t->opens = NULL;
+  t->brackets_capacity = 0;
 }
 inline static void state_t_free(state_t *t) {
   subterms_t_free(t->stack);
   subterms_t_free(t->redexes);
+  subterms_t_free(t->spare);
+  groups_t_free(t->groups);
+  free(t->stack);
+  free(t->redexes);
+  free(t->spare);
+  free(t->groups);
+  free(t->buffer);
+  free(t->match);
+  free(t->closes);
+  free(t->opens);
 }
 inline static void state_t_reset(state_t *t) {
   subterms_t_reset(t->stack);
   subterms_t_reset(t->redexes);
+  groups_t_reset(t->groups);
 }
 
 // We need to be able to list all the redexes in a term.
-bool redexes(term_t term, state_t *s); // IMPLEMENT ME
+bool redexes(term_t term, state_t *s);
+
+// We need to be able to apply redexes to a term. The term must be normalised,
+// and so is the result. The redex must be one of s->redexes, which must list
+// the redexes of the term, as redexes() leaves it, and is updated to list the
+// redexes of the result. Only the rewritten part of the term is rescanned,
+// and the offsets of the redexes after it are shifted, so the redexes can be
+// followed through any number of applications without calling redexes again.
+term_t apply(term_t term, indices_t *indices, state_t *s);
+
+// We need to know how much applying a redex changes the length of a term.
+int growth(term_t term, indices_t *indices);
+
+// Reduction needn't terminate, and terms can grow without bound on the way,
+// so it can be given limits on the number of redexes it applies, and on the
+// most symbols and bytes the term may take up at once, where 0 means no
+// limit. The budget also records what the reduction used: the redexes it
+// applied, and the peak length and memory of the term.
+typedef struct {
+  int max_steps;
+  int max_symbols;
+  size_t max_bytes;
+  int steps;
+  int symbols;
+  size_t bytes;
+} budget_t;
 
-// We need to be able to apply redexes to a term.
-term_t apply(term_t term, indices_t *indices, state_t *s); // IMPLEMENT ME
+// A reduction either reaches a normal form, or stops at the first redex that
+// would take it over budget:
+typedef enum {
+  REDUCE_DONE,
+  REDUCE_OUT_OF_STEPS,
+  REDUCE_OUT_OF_SYMBOLS,
+  REDUCE_OUT_OF_BYTES,
+} reduce_result_t;
 
-// We need to be able to reduce a term to normal form.
-term_t reduce(term_t term, state_t *s); // IMPLEMENT ME
+// We need to be able to reduce a term to normal form, within a budget, which
+// may be NULL for no limits at all. The term is returned as far as it got,
+// and if result isn't NULL, it's set to why the reduction stopped.
+term_t reduce(term_t term, state_t *s, budget_t *budget,
+  reduce_result_t *result);
 
 // We need to be able to be able to put terms in a canonical form.
-void normalise(term_t term, state_t *s); // IMPLEMENT ME
+void normalise(term_t term, state_t *s);
@@ -1,19 +1,39 @@
 from pathlib import Path
 from cffi import FFI
-from typing import Optional, Tuple
-from copy import copy
+import os
+from typing import List, Mapping, NamedTuple, Optional, Tuple
 
 def _clibpath(filename):
     return Path(__file__).parent / "c_lib" / filename
 
-_COMB_H = _clibpath("comb.h")
-_COMB_C = _clibpath("comb.c")
-_COMB_BOOT = f"#include \"{_COMB_H}\""
+_COMB_HEADERS = [_clibpath(f) for f in [
+    "comb.h", "flat.h", "graph.h", "normal.h", "rng.h", "fenwick.h", "soup.h",
+    "checkpoint.h", "trace.h", "detector.h", "batch.h", "multiset.h"]]
+_COMB_SOURCES = [str(_clibpath(f)) for f in [
+    "batch.c", "checkpoint.c", "comb.c", "detector.c", "fenwick.c", "flat.c",
+    "graph.c", "multiset.c", "normal.c", "pool.c", "rng.c", "soup.c",
+    "trace.c"]]
+_COMB_BOOT = "\n".join(f"#include \"{h}\"" for h in _COMB_HEADERS)
+
+def _cdef(path):
+    """Returns the contents of the given header with preprocessor lines
+    stripped, as cffi can't parse them, apart from integer constants."""
+    def keep(line):
+        words = line.split()
+        if not line.lstrip().startswith("#"):
+            return True
+        return len(words) == 3 and words[0] == "#define" and words[2].isdigit()
+    with open(path) as f:
+        lines = f.read().splitlines()
+    return "\n".join(l for l in lines if keep(l))
 
 _ffibuilder = FFI()
-with open(_COMB_H) as f:
-    _ffibuilder.cdef(f.read())
-_ffibuilder.set_source("_comb", _COMB_BOOT, sources=[_COMB_C])
+for header in _COMB_HEADERS:
+    _ffibuilder.cdef(_cdef(header))
+_ffibuilder.set_source("_comb", _COMB_BOOT, sources=_COMB_SOURCES,
+                      libraries=["m", "z"],
+                      extra_compile_args=["-pthread"],
+                      extra_link_args=["-pthread"])
 _ffibuilder.compile()
 
 # Actual wrapper code is below. The goal in this module is to hide _all_ of
@@ -24,10 +44,28 @@ _ffibuilder.compile()
 # like strings, we just convert them to their Python counterparts and free the
 # memory immediately.
 import _comb.lib as _lib
+from _comb import ffi as _ffi
 
 # Useful constants:
 NULL = _ffibuilder.NULL
 
+# Results of a reduction with a budget: either it finished, or it stopped
+# because it would have gone over the limit on steps, nodes or bytes.
+DONE = _lib.REDUCE_DONE
+OUT_OF_STEPS = _lib.REDUCE_OUT_OF_STEPS
+OUT_OF_NODES = _lib.REDUCE_OUT_OF_NODES
+OUT_OF_BYTES = _lib.REDUCE_OUT_OF_BYTES
+
+def budget(max_steps: int = 0, max_nodes: int = 0,
+           max_bytes: int = 0) -> "budget_t *":
+    """Returns a new budget for the reduction functions, with the given
+    limits on steps, nodes allocated and bytes allocated, where 0 means no
+    limit. The budget's steps, nodes and bytes fields count what has been
+    used so far, across every call it is passed to."""
+    return _ffi.new("budget_t *", {"max_steps": max_steps,
+                                   "max_nodes": max_nodes,
+                                   "max_bytes": max_bytes})
+
 class Term:
     """Python wrapper of "term_t *" pointers that frees them with "free_term()"
     when they are garbage-collected."""
@@ -47,12 +85,20 @@ class Term:
         return py_str
 
     def __eq__(self, other):
+        # Terms are hash-consed, so structural equality is pointer equality:
         if not isinstance(other, Term):
             return False
-        return str(self) == str(other)
+        return self._term == other._term
 
     def __hash__(self):
-        return hash(str(self))
+        # Each node caches a structural hash, so this doesn't walk the term,
+        # and it is the same in every run:
+        return hash(self._term.hash)
+
+    def size(self) -> int:
+        """Returns the number of leaves in this term, which each node caches,
+        so this doesn't walk the term."""
+        return self._term.size
 
     def __bool__(self):
         return self._term != NULL
@@ -61,31 +107,37 @@ class Term:
         return self.__bool__()
 
     def __deepcopy__(self, memo):
-        return Term(lib.copy_term(self._term))
+        return Term(_lib.copy_term(self._term))
 
     def __copy__(self):
-        return Term(lib.copy_term(self._term))
-
-    def reduce(self) -> "Term":
-        """Returns the result of reducing this term, or None if it is already
-        in normal form."""
-        return reduce(self)
-
-    def beta_normal(self, cutoff=1000) -> Tuple["Term", bool]:
-        """Returns the beta normal form of this term, and whether or not the
-        cutoff number of reductions was reached. If the cutoff was reached, the
-        return value is None."""
-        term = self
-        for _ in range(cutoff):
-            reduced = term.reduce()
-            if reduced == term:
-                return term, True
-            term = reduced
-        return None, False
+        return Term(_lib.copy_term(self._term))
+
+    def reduce(self) -> Optional["Term"]:
+        """Returns the result of reducing this term, or None if the step is a
+        fixed point, which includes but isn't limited to normal forms, as WWW
+        reduces to itself. Reduction returns the same node when nothing
+        changes, so this is a pointer comparison."""
+        reduced = reduce(self)
+        return None if reduced == self else reduced
+
+    def beta_normal(self, cutoff=1000, max_nodes=0,
+                    max_bytes=0) -> Tuple["Term", bool]:
+        """Returns the beta normal form of this term, and whether or not it was
+        reached within the cutoff number of reductions and the limits on nodes
+        and bytes allocated, if any. If it wasn't, the return value is None.
+        Results are memoised in a shared cache, see normal_cache_stats()."""
+        normal = _ffi.new("term_t **")
+        result = _lib.beta_normal(_normal_cache, self._term,
+                                  budget(cutoff, max_nodes, max_bytes), normal)
+        if result != DONE:
+            return None, False
+        return Term(normal[0]), True
 
     def is_beta_normal(self) -> bool:
-        """Returns True if this term is in beta normal form."""
-        return self == self.reduce()
+        """Returns True if this term is in beta normal form, which each node
+        records when it is created. A term that isn't can still reduce to
+        itself, like WWW, and so never reach one."""
+        return bool(self._term.normal)
 
 def leaf(c: str) -> Term:
     """Creates a new leaf node with the given character.
@@ -108,7 +160,8 @@ def internal(left: Term, right: Term) -> Term:
         Returns:
             A Term representing the new node.
         """
-    return Term(_lib.new_node(copy(left)._term, copy(right)._term))
+    return Term(_lib.new_node(_lib.copy_term(left._term),
+                              _lib.copy_term(right._term)))
 
 def parse(str: str) -> Term:
     """Parses the given string into a term. The string must be a valid term,
@@ -140,3 +193,458 @@ def reduce(term: Term) -> Term:
             A Term representing the result of reducing the given term.
         """
     return Term(_lib.reduce_term(term._term))
+
+# Batch operations. Each of these crosses into C once for the whole list of
+# terms, rather than once per term, which matters when the per-term work is
+# small.
+def _term_array(terms: List[Term]) -> "term_t *[]":
+    return _ffi.new("term_t *[]", [term._term for term in terms])
+
+def _wrap_terms(c_terms: "term_t *[]") -> List[Optional[Term]]:
+    return [Term(t) if t != NULL else None for t in c_terms]
+
+def parse_all(strs: List[str]) -> List[Optional[Term]]:
+    """Parses each of the given strings into a term, as by parse(), except
+    that invalid terms are returned as None rather than raising an error."""
+    packed = "".join(s + "\0" for s in strs).encode("utf-8")
+    out = _ffi.new("term_t *[]", len(strs))
+    _lib.parse_terms(packed, len(strs), out)
+    return _wrap_terms(out)
+
+def print_all(terms: List[Term]) -> List[str]:
+    """Returns the string representation of each of the given terms."""
+    if not terms:
+        return []
+    length = _ffi.new("size_t *")
+    c_str = _lib.print_terms(_term_array(terms), len(terms), length)
+    packed = _ffi.unpack(c_str, length[0] - 1).decode("utf-8")
+    _lib.free(c_str)
+    return packed.split("\0")
+
+def reduce_all(terms: List[Term], max_steps: int = 1, max_nodes: int = 0,
+               max_bytes: int = 0) -> List[Term]:
+    """Reduces each of the given terms until it stops changing, or until its
+    budget of steps, nodes or bytes runs out, returning each term as far as it
+    got. With the default of one step, this is the same as calling reduce() on
+    each term."""
+    out = _ffi.new("term_t *[]", len(terms))
+    _lib.reduce_terms_n(_term_array(terms), len(terms),
+                        budget(max_steps, max_nodes, max_bytes), out, NULL,
+                        NULL)
+    return _wrap_terms(out)
+
+def beta_normal_all(terms: List[Term], cutoff: int = 1000, max_nodes: int = 0,
+                    max_bytes: int = 0) -> List[Optional[Term]]:
+    """Returns the beta normal form of each of the given terms, as by
+    Term.beta_normal(), or None for terms that don't reach it within their
+    budget."""
+    out = _ffi.new("term_t *[]", len(terms))
+    _lib.beta_normal_terms(_normal_cache, _term_array(terms), len(terms),
+                           budget(cutoff, max_nodes, max_bytes), out, NULL)
+    return _wrap_terms(out)
+
+def hash_all(terms: List[Term]) -> List[int]:
+    """Returns the 64-bit hash of each of the given terms, which hash() is
+    derived from, so that hash(term) == hash(hash_all([term])[0])."""
+    out = _ffi.new("uint64_t[]", len(terms))
+    _lib.hash_terms(_term_array(terms), len(terms), out)
+    return list(out)
+
+def stats() -> Mapping[str, int]:
+    """Returns memory accounting for the C term library, which is useful for
+    checking that allocation has reached a steady state.
+
+        Returns:
+            A dictionary with the number of nodes and bytes alive, the number
+            of nodes and bytes reserved by the pool, the bytes reserved by the
+            scratch arena, and the total number of system allocations made.
+        """
+    c_stats = _ffi.new("term_stats_t *")
+    _lib.term_stats(c_stats)
+    return {
+        "nodes_alive": c_stats.nodes_alive,
+        "bytes_alive": c_stats.bytes_alive,
+        "nodes_reserved": c_stats.nodes_reserved,
+        "bytes_reserved": c_stats.bytes_reserved,
+        "scratch_reserved": c_stats.scratch_reserved,
+        "system_allocs": c_stats.system_allocs,
+    }
+
+# Cache of beta normal forms shared by every Term. It holds references to the
+# terms in it, so they count towards stats()["nodes_alive"].
+NORMAL_CACHE_ENTRIES = 1 << 16
+_normal_cache = _ffi.gc(_lib.new_normal_cache(NORMAL_CACHE_ENTRIES),
+                        _lib.free_normal_cache)
+
+def normal_cache_stats() -> Mapping[str, float]:
+    """Returns statistics for the cache used by Term.beta_normal.
+
+        Returns:
+            A dictionary with the number of queries answered straight from the
+            cache (hits), cut short by an entry partway along the reduction
+            chain (chain_hits), or reduced all the way (misses), the overall
+            hit rate, the number of evictions, and the number of entries in
+            use out of the capacity.
+        """
+    queries = (_normal_cache.hits + _normal_cache.chain_hits
+               + _normal_cache.misses)
+    return {
+        "hits": _normal_cache.hits,
+        "chain_hits": _normal_cache.chain_hits,
+        "misses": _normal_cache.misses,
+        "hit_rate": _normal_cache.hits / queries if queries else 0.0,
+        "evictions": _normal_cache.evictions,
+        "size": _normal_cache.size,
+        "capacity": _normal_cache.capacity,
+    }
+
+def clear_normal_cache():
+    """Empties the cache used by Term.beta_normal, releasing every term it
+    holds."""
+    _lib.clear_normal_cache(_normal_cache)
+
+class generation:
+    """Context manager that keeps scratch memory used by the C term library
+    alive until the end of the block, and then drops it all at once."""
+    def __enter__(self):
+        _lib.begin_generation()
+        return self
+
+    def __exit__(self, *args):
+        _lib.end_generation()
+
+class Graph:
+    """Python wrapper of "graph_t *" pointers that frees them with
+    "free_graph()" when they are garbage-collected. A graph is a mutable copy
+    of a term that is reduced in place, one leftmost-outermost redex at a
+    time, with shared arguments only ever reduced once."""
+
+    # Results of evaluating a graph:
+    DONE = DONE
+    OUT_OF_STEPS = OUT_OF_STEPS
+    OUT_OF_NODES = OUT_OF_NODES
+    OUT_OF_BYTES = OUT_OF_BYTES
+
+    def __init__(self, term: Term):
+        self._graph = _lib.new_graph(term._term)
+
+    def __del__(self):
+        _lib.free_graph(self._graph)
+
+    def __str__(self):
+        return str(self.term())
+
+    @property
+    def steps(self) -> int:
+        """The number of reductions performed so far."""
+        return _lib.graph_steps(self._graph)
+
+    @property
+    def nodes(self) -> int:
+        """The number of nodes allocated so far."""
+        return _lib.graph_nodes(self._graph)
+
+    def term(self) -> Term:
+        """Reads the graph back into a term."""
+        return Term(_lib.graph_term(self._graph))
+
+    def step(self) -> bool:
+        """Reduces the leftmost-outermost redex, returning False if there
+        wasn't one because the graph is in normal form."""
+        return bool(_lib.graph_step(self._graph))
+
+    def whnf(self, max_steps: int = 0, max_nodes: int = 0,
+             max_bytes: int = 0) -> int:
+        """Reduces the graph to weak head normal form, unless the budget of
+        steps, nodes or bytes for this call runs out first. Returns one of
+        DONE, OUT_OF_STEPS, OUT_OF_NODES or OUT_OF_BYTES."""
+        return _lib.graph_whnf(self._graph,
+                               budget(max_steps, max_nodes, max_bytes))
+
+    def normalise(self, max_steps: int = 0, max_nodes: int = 0,
+                  max_bytes: int = 0) -> int:
+        """As whnf(), but reduces the graph to normal form."""
+        return _lib.graph_normalise(self._graph,
+                                    budget(max_steps, max_nodes, max_bytes))
+
+def graph_normal(term: Term, max_steps: int = 100000, max_nodes: int = 1000000,
+                 max_bytes: int = 0) -> Optional[Term]:
+    """Returns the normal form of the given term as found by graph reduction,
+    or None if it isn't reached within the budget of steps, nodes and bytes.
+    Steps are single leftmost-outermost reductions, unlike those of
+    reduce()."""
+    normal = _ffi.new("term_t **")
+    result = _lib.graph_normal_form(term._term,
+                                    budget(max_steps, max_nodes, max_bytes),
+                                    normal)
+    return Term(normal[0]) if result == DONE else None
+
+class Source(NamedTuple):
+    """Reactions of the same kind and inputs that produced copies of a
+    replicator. The inputs are their structural hashes, as given by
+    hash_all(), as they have usually been used up."""
+    kind: str # "fission", "fusion" or "reduction"
+    inputs: List[int]
+    copies: int
+
+class Replicator(NamedTuple):
+    """A term flagged as a replicator by SoupHandle.detect(), with its copies
+    and net copies gained over the detector's window, which may be estimates,
+    and the reactions that produced it, those that made the most first."""
+    term: Term
+    hash: int
+    first_step: int
+    copies: int
+    growth: int
+    sources: List[Source]
+
+class SoupHandle:
+    """Python wrapper of "soup_t *" pointers that frees them with "free_soup()"
+    when they are garbage-collected."""
+
+    # What to do with a term whose reduction runs out of budget, which is set
+    # with params.on_exhausted:
+    KEEP = _lib.BUDGET_KEEP
+    FISSION = _lib.BUDGET_FISSION
+    REMOVE = _lib.BUDGET_REMOVE
+
+    def __init__(self, terms: int, alphabet: str, seed: int, threads: int = 1,
+                 debug: bool = False):
+        self._soup = _lib.new_soup(terms, bytes(alphabet, "utf-8"), seed)
+        _lib.soup_threads(self._soup, threads)
+        self._soup.debug = debug
+
+    def __del__(self):
+        _lib.free_soup(self._soup)
+
+    @classmethod
+    def load(cls, path: str, threads: int = 1,
+             debug: bool = False) -> "SoupHandle":
+        """Loads a soup from a checkpoint written by save(), with the
+        parameters, random state and counters it had then. Raises OSError if
+        the file can't be read, or isn't a checkpoint that can be."""
+        soup = _lib.load_soup(os.fsencode(path))
+        if soup == NULL:
+            raise OSError(_ffi.errno, os.strerror(_ffi.errno), path)
+        handle = cls.__new__(cls)
+        handle._soup = soup
+        _lib.soup_threads(soup, threads)
+        soup.debug = debug
+        return handle
+
+    def save(self, path: str, background: bool = False):
+        """Writes a checkpoint of the soup to the given path, atomically, so
+        the path always holds a whole checkpoint. In the background, only
+        encoding the soup holds up the caller, and an error writing it is
+        raised by the next save() or wait_for_save(). Raises OSError if the
+        checkpoint, or the previous one in the background, failed."""
+        save = _lib.soup_checkpoint if background else _lib.save_soup
+        if not save(self._soup, os.fsencode(path)):
+            raise OSError(_ffi.errno, os.strerror(_ffi.errno), path)
+
+    def wait_for_save(self):
+        """Waits for the checkpoint being written in the background, if any.
+        Raises OSError if writing it failed."""
+        if not _lib.soup_checkpoint_wait(self._soup):
+            raise OSError(_ffi.errno, os.strerror(_ffi.errno))
+
+    def trace(self, path: str, steps_per_chunk: int = 64):
+        """Starts tracing the soup's population to the given file, which is
+        written in the background, replacing any trace already running. Raises
+        OSError if the file can't be opened, or the previous trace failed."""
+        if not _lib.soup_trace(self._soup, os.fsencode(path), steps_per_chunk):
+            raise OSError(_ffi.errno, os.strerror(_ffi.errno), path)
+
+    def stop_trace(self):
+        """Stops tracing the soup, if it is being traced, and waits for the
+        rest of the trace to be written. Raises OSError if writing any of it
+        failed."""
+        if not _lib.soup_trace_stop(self._soup):
+            raise OSError(_ffi.errno, os.strerror(_ffi.errno))
+
+    def detect(self, **params):
+        """Starts detecting replicators in the soup, forgetting any found so
+        far. Parameters not given keep their defaults, from
+        default_detector_params()."""
+        c_params = _lib.default_detector_params()
+        for name, value in params.items():
+            setattr(c_params, name, value)
+        _lib.soup_detect(self._soup, c_params)
+
+    def replicators(self, start: int = 0) -> List[Replicator]:
+        """Returns the replicators found so far, from the given index on, in
+        the order they were found."""
+        replicators = []
+        out = _ffi.new("replicator_t *")
+        for i in range(start, _lib.soup_replicators(self._soup)):
+            _lib.soup_replicator(self._soup, i, out)
+            sources = _ffi.new("source_t[]", max(out.sources, 1))
+            n = _lib.soup_replicator_sources(self._soup, i, sources,
+                                             out.sources)
+            term = Term(out.term)
+            replicators.append(Replicator(
+                term, hash_all([term])[0], out.first_step, out.copies,
+                out.growth,
+                [Source(["fission", "fusion", "reduction"][s.kind],
+                        [h for h in s.inputs if h != 0], s.copies)
+                 for s in sources[0:n]]))
+        return replicators
+
+    @property
+    def alphabet(self) -> str:
+        """The combinators the soup is made of."""
+        return _ffi.string(self._soup.alphabet).decode("utf-8")
+
+    @property
+    def params(self) -> "soup_params_t":
+        """The tunable parameters of the simulation, which can be assigned to
+        directly."""
+        return self._soup.params
+
+    @property
+    def steps(self) -> int:
+        """The number of steps simulated so far."""
+        return self._soup.steps
+
+    @property
+    def time(self) -> float:
+        """The time simulated by run() so far."""
+        return self._soup.time
+
+    @property
+    def events(self) -> int:
+        """The number of reactions run by run() so far."""
+        return self._soup.events
+
+    @property
+    def exhausted(self) -> int:
+        """The number of reductions so far that ran out of budget."""
+        return self._soup.exhausted
+
+    def __len__(self):
+        return self._soup.size
+
+    def step(self, n_steps: int = 1):
+        """Simulates the given number of steps of the soup. In debug mode the
+        combinator counts are checked against a full recount after each one,
+        as asserts are compiled out of the C library."""
+        if not self._soup.debug:
+            _lib.soup_step(self._soup, n_steps)
+            return
+        for _ in range(n_steps):
+            _lib.soup_step(self._soup, 1)
+            if not _lib.soup_check(self._soup):
+                raise AssertionError(
+                    f"combinator counts are wrong after step {self.steps}")
+
+    def run(self, duration: float, max_events: int = 0) -> int:
+        """Simulates the soup in continuous time for the given duration, or
+        until it has run max_events reactions if that isn't 0, and returns the
+        number of reactions run. In debug mode the combinator counts are
+        checked against a full recount afterwards."""
+        events = _lib.soup_run(self._soup, duration, max_events)
+        if self._soup.debug and not _lib.soup_check(self._soup):
+            raise AssertionError(
+                f"combinator counts are wrong at time {self.time}")
+        return events
+
+    def counts(self) -> Mapping[str, int]:
+        """Returns the number of each combinator in the soup."""
+        return {c: self._soup.counts[i] for i, c in enumerate("SKIBCW")}
+
+    def stats(self) -> Mapping[str, float]:
+        """Returns the soup's running totals of reactions of each kind,
+        reductions with each result, redexes contracted and atoms topped up of
+        each combinator, and seconds spent in each phase of a step."""
+        s = self._soup.stats
+        out = {}
+        for i, kind in enumerate(["fission", "fusion", "reduction"]):
+            out[f"reactions_{kind}"] = s.reactions[i]
+        for i, result in enumerate(["done", "out_of_steps", "out_of_nodes",
+                                    "out_of_bytes"]):
+            out[f"reductions_{result}"] = s.results[i]
+        for i, c in enumerate("SKIBCW"):
+            out[f"redexes_{c}"] = s.redexes[i]
+        for i, c in enumerate("SKIBCW"):
+            out[f"topped_up_{c}"] = s.topped_up[i]
+        for i, phase in enumerate(["shuffle", "react", "conserve"]):
+            out[f"seconds_{phase}"] = s.seconds[i]
+        return out
+
+    def histogram(self) -> List[int]:
+        """Returns the number of terms in the soup with 1, 2-3, 4-7 and so on
+        leaves, up to the last bucket, which counts every larger term too."""
+        out = _ffi.new("uint64_t[]", _lib.SIZE_BUCKETS)
+        _lib.soup_histogram(self._soup, out)
+        return list(out)
+
+    def terms(self) -> List[Term]:
+        """Returns the terms currently in the soup."""
+        out = _ffi.new("term_t *[]", len(self))
+        _lib.soup_terms(self._soup, out)
+        return [Term(t) for t in out]
+
+class MultisetHandle:
+    """Python wrapper of "multiset_t *" pointers that frees them with
+    "free_multiset()" when they are garbage-collected. This has the same
+    interface as SoupHandle, apart from threads, as a multiset soup always
+    runs on the calling thread."""
+    def __init__(self, terms: int, alphabet: str, seed: int,
+                 debug: bool = False):
+        self._ms = _lib.new_multiset(terms, bytes(alphabet, "utf-8"), seed)
+        self._debug = debug
+
+    def __del__(self):
+        _lib.free_multiset(self._ms)
+
+    @property
+    def params(self) -> "soup_params_t":
+        """The tunable parameters of the simulation, which can be assigned to
+        directly."""
+        return self._ms.params
+
+    @property
+    def steps(self) -> int:
+        """The number of steps simulated so far."""
+        return self._ms.steps
+
+    @property
+    def exhausted(self) -> int:
+        """The number of reductions so far that ran out of budget."""
+        return self._ms.exhausted
+
+    @property
+    def distinct(self) -> int:
+        """The number of distinct terms in the soup."""
+        return self._ms.distinct
+
+    def __len__(self):
+        return self._ms.size
+
+    def step(self, n_steps: int = 1):
+        """Simulates the given number of steps of the soup, checking it after
+        each one in debug mode, as SoupHandle.step() does."""
+        if not self._debug:
+            _lib.multiset_step(self._ms, n_steps)
+            return
+        for _ in range(n_steps):
+            _lib.multiset_step(self._ms, 1)
+            if not _lib.multiset_check(self._ms):
+                raise AssertionError(
+                    f"multiset is inconsistent after step {self.steps}")
+
+    def counts(self) -> Mapping[str, int]:
+        """Returns the number of each combinator in the soup."""
+        return {c: self._ms.counts[i] for i, c in enumerate("SKIBCW")}
+
+    def multiplicities(self) -> Mapping[Term, int]:
+        """Returns each distinct term in the soup, with its number of copies."""
+        terms = _ffi.new("term_t *[]", self.distinct)
+        counts = _ffi.new("uint64_t[]", self.distinct)
+        _lib.multiset_entries(self._ms, terms, counts)
+        return {Term(t): n for t, n in zip(terms, counts)}
+
+    def terms(self) -> List[Term]:
+        """Returns the terms currently in the soup, with a separate entry for
+        every copy, so this is only practical for small soups."""
+        return [t for t, n in self.multiplicities().items() for _ in range(n)]
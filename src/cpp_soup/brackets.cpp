@@ -0,0 +1,136 @@
+#include "brackets.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+static BracketMasks classifyScalar(const char *p) {
+	static const auto valid = [] {
+		array<bool, 256> table{};
+		for (unsigned char c : string_view("SKIBCW()")) {
+			table[c] = true;
+		}
+		return table;
+	}();
+	BracketMasks masks = {0, 0, 0};
+	for (int k = 0; k < 64; k++) {
+		unsigned char c = p[k];
+		masks.opens |= (uint64_t) (c == '(') << k;
+		masks.closes |= (uint64_t) (c == ')') << k;
+		masks.invalid |= (uint64_t) !valid[c] << k;
+	}
+	return masks;
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2")))
+static BracketMasks classifySSE2(const char *p) {
+	BracketMasks masks = {0, 0, 0};
+	for (int k = 0; k < 64; k += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + k));
+		__m128i open = _mm_cmpeq_epi8(v, _mm_set1_epi8('('));
+		__m128i close = _mm_cmpeq_epi8(v, _mm_set1_epi8(')'));
+		__m128i valid = _mm_or_si128(open, close);
+		for (char c : {'S', 'K', 'I', 'B', 'C', 'W'}) {
+			valid = _mm_or_si128(valid, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+		}
+		masks.opens |= (uint64_t) (uint16_t) _mm_movemask_epi8(open) << k;
+		masks.closes |= (uint64_t) (uint16_t) _mm_movemask_epi8(close) << k;
+		masks.invalid |= (uint64_t) (uint16_t) ~_mm_movemask_epi8(valid) << k;
+	}
+	return masks;
+}
+
+__attribute__((target("avx2")))
+static BracketMasks classifyAVX2(const char *p) {
+	BracketMasks masks = {0, 0, 0};
+	for (int k = 0; k < 64; k += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + k));
+		__m256i open = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('('));
+		__m256i close = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')'));
+		__m256i valid = _mm256_or_si256(open, close);
+		for (char c : {'S', 'K', 'I', 'B', 'C', 'W'}) {
+			valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+		}
+		masks.opens |= (uint64_t) (uint32_t) _mm256_movemask_epi8(open) << k;
+		masks.closes |= (uint64_t) (uint32_t) _mm256_movemask_epi8(close) << k;
+		masks.invalid |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8(valid) << k;
+	}
+	return masks;
+}
+#endif
+
+// Threads racing to initialise this would all pick the same function.
+static BracketMasks (*classify)(const char *) = [] {
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return classifyAVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return classifySSE2;
+	}
+#endif
+	return classifyScalar;
+}();
+
+bool useClassifier(string_view name) {
+	if (name == "scalar") {
+		classify = classifyScalar;
+		return true;
+	}
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (name == "sse2" && __builtin_cpu_supports("sse2")) {
+		classify = classifySSE2;
+		return true;
+	}
+	if (name == "avx2" && __builtin_cpu_supports("avx2")) {
+		classify = classifyAVX2;
+		return true;
+	}
+#endif
+	return false;
+}
+
+BracketMasks classifyBlock(string_view term, size_t base) {
+	// The end of the term is copied into a padded block, so as not to read
+	// past it, and the padding masked out:
+	size_t left = term.length() - base;
+	if (left >= 64) {
+		return classify(term.data() + base);
+	}
+	char block[64] = {0};
+	memcpy(block, term.data() + base, left);
+	BracketMasks masks = classify(block);
+	masks.invalid &= (uint64_t(1) << left) - 1;
+	return masks;
+}
+
+bool matchBrackets(string_view term, vector<int> &match, vector<int> &closes) {
+	static thread_local vector<int> opens;
+	opens.clear();
+	match.resize(term.length());
+	closes.clear();
+	for (size_t base = 0; base < term.length(); base += 64) {
+		BracketMasks masks = classifyBlock(term, base);
+		for (uint64_t bits = masks.opens | masks.closes; bits != 0; bits &= bits - 1) {
+			int k = __builtin_ctzll(bits);
+			int i = base + k;
+			if ((masks.opens >> k) & 1) {
+				opens.push_back(i);
+			} else if (opens.empty()) {
+				return false;
+			} else {
+				match[opens.back()] = i;
+				match[i] = opens.back();
+				opens.pop_back();
+				closes.push_back(i);
+			}
+		}
+	}
+	return opens.empty();
+}
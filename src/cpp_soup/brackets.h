@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// Validating a term and finding its redexes both come down to matching up its
+// brackets. Rather than look at a term a character at a time, we classify it
+// 64 characters at a time with vector compares, using AVX2 or SSE2 where the
+// CPU has them (picked once, at runtime) and plain C++ otherwise, and then
+// only visit the brackets, of which there are usually far fewer.
+
+// The characters of a block, as masks in which bit k stands for character k.
+struct BracketMasks {
+	uint64_t opens;
+	uint64_t closes;
+	uint64_t invalid; // neither brackets nor combinators
+};
+
+// Makes classifyBlock use the named implementation, one of "avx2", "sse2" or
+// "scalar", rather than the widest the CPU has, so that each can be tested.
+// Returns false, leaving the choice as it was, if the CPU lacks it.
+bool useClassifier(string_view name);
+
+// Classifies the 64 characters of the term from the given offset, as far as
+// the term goes. Characters past its end count as nothing at all.
+BracketMasks classifyBlock(string_view term, size_t base);
+
+// Matches up the brackets of the term, filling in match with the offset of
+// each bracket's partner, at the bracket's offset, and closes with the
+// offsets of the closing brackets in order, so that each group comes after
+// the groups nested inside it. Both vectors keep their storage. Returns false
+// if the brackets are unbalanced.
+bool matchBrackets(string_view term, vector<int> &match, vector<int> &closes);
@@ -0,0 +1,154 @@
+#include "brackets.h"
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+using namespace std;
+
+// Checks every implementation of classifyBlock, and matchBrackets on top of
+// each, against a plain character-by-character scan of random terms, both
+// balanced and not. Built with -fsanitize=address, this also catches any
+// read past the end of a term.
+
+static const int TERMS = 200000;
+static const size_t MAX_LENGTH = 4096;
+
+// Terms that have got past bracket matching before, or nearly could have:
+static const char *fixedTerms[] = {
+	"S((((((((((", "(", ")", "((", "))", ")(", "()", "S(", "(S", "S)", "())",
+	"(()", "S(K(I)", "S(K)I)", "((((((((((((((((((((((((((((((((S",
+	"S(((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((",
+};
+
+static uint64_t x = 88172645463325252ull;
+
+static unsigned rnd() {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return (unsigned) x;
+}
+
+// Appends a random balanced term.
+static void generate(string &term, int depth) {
+	int items = rnd() % (depth == 0 ? 40 : 6);
+	for (int i = 0; i < items && term.length() < MAX_LENGTH; i++) {
+		if (depth < 8 && rnd() % 3 == 0) {
+			term += '(';
+			generate(term, depth + 1);
+			term += ')';
+		} else {
+			term += "SKIBCW"[rnd() % 6];
+		}
+	}
+}
+
+// Makes the term unbalanced half of the time, mostly by leaving brackets
+// unclosed, including runs of them longer than the rest of the term.
+static void unbalance(string &term) {
+	switch (rnd() % 8) {
+	case 0:
+		term = "S" + string(1 + rnd() % 200, '(');
+		break;
+	case 1:
+		term += string(1 + rnd() % 100, '(');
+		break;
+	case 2:
+	case 3:
+		term.insert(term.begin() + rnd() % (term.length() + 1), rnd() % 2 ? '(' : ')');
+		break;
+	}
+}
+
+// The reference, which returns false if the brackets are unbalanced.
+static bool scan(string_view term, vector<int> &match, vector<int> &closes) {
+	vector<int> opens;
+	match.assign(term.length(), -1);
+	closes.clear();
+	for (size_t i = 0; i < term.length(); i++) {
+		if (term[i] == '(') {
+			opens.push_back(i);
+		} else if (term[i] == ')') {
+			if (opens.empty()) {
+				return false;
+			}
+			match[opens.back()] = i;
+			match[i] = opens.back();
+			opens.pop_back();
+			closes.push_back(i);
+		}
+	}
+	return opens.empty();
+}
+
+// Returns the number of ways the implementation gets the term wrong.
+static int check(const string &str) {
+	// A copy of exactly the term's length, so that reads past it are caught:
+	unique_ptr<char[]> copy(new char[str.length()]);
+	memcpy(copy.get(), str.data(), str.length());
+	string_view term(copy.get(), str.length());
+
+	vector<int> match, closes, wantMatch, wantCloses;
+	bool want = scan(term, wantMatch, wantCloses);
+	bool got = matchBrackets(term, match, closes);
+	if (got != want) {
+		return 1;
+	}
+	if (!got) {
+		return 0;
+	}
+	int errors = closes != wantCloses;
+	for (size_t i = 0; i < term.length(); i++) {
+		if (wantMatch[i] >= 0 && match[i] != wantMatch[i]) {
+			return errors + 1;
+		}
+	}
+	return errors;
+}
+
+// Checks the masks of a block of random bytes, biased towards brackets and
+// combinators, which may run past the end of a short term.
+static int checkMasks() {
+	static const string_view valid = "SKIBCW()";
+	string block(1 + rnd() % 64, '\0');
+	for (char &c : block) {
+		unsigned r = rnd();
+		c = r % 2 ? valid[(r >> 1) % valid.length()] : (char) (r >> 8);
+	}
+	BracketMasks want = {0, 0, 0};
+	for (size_t k = 0; k < block.length(); k++) {
+		want.opens |= (uint64_t) (block[k] == '(') << k;
+		want.closes |= (uint64_t) (block[k] == ')') << k;
+		want.invalid |= (uint64_t) (valid.find(block[k]) == string_view::npos) << k;
+	}
+	BracketMasks got = classifyBlock(block, 0);
+	return got.opens != want.opens || got.closes != want.closes ||
+		got.invalid != want.invalid;
+}
+
+int main() {
+	bool failed = false;
+	for (const char *name : {"scalar", "sse2", "avx2"}) {
+		if (!useClassifier(name)) {
+			cout << name << ": not supported by this CPU, skipped" << endl;
+			continue;
+		}
+		x = 88172645463325252ull;
+		int errors = 0;
+		for (const char *term : fixedTerms) {
+			errors += check(term);
+		}
+		for (int t = 0; t < TERMS; t++) {
+			string term;
+			generate(term, 0);
+			if (t % 2) {
+				unbalance(term);
+			}
+			errors += check(term);
+			errors += checkMasks();
+		}
+		cout << name << ": " << TERMS << " terms, " << errors << " errors" << endl;
+		failed |= errors > 0;
+	}
+	return failed;
+}
@@ -0,0 +1,66 @@
+#include "soup.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+int main(int argc, char **argv) {
+	Term term = argc > 1 ? argv[1] : "SII(KSI)(IK)";
+	if (!validateTerm(term)) {
+		cout << "Invalid term: " << term << endl;
+		return 1;
+	}
+	cout << "Valid term: " << term << endl;
+	vector<Redex> redexes;
+	listRedexes(term, redexes);
+	for (const Redex &redex : redexes) {
+		cout << "Redex at " << redex.index << endl;
+		cout << "  Inputs:" << endl;
+		for (int i = 0; i < redex.numInputs; i++) {
+			cout << "    " << redex.inputs[i] << endl;
+		}
+		cout << "  Outputs:" << endl;
+		for (int i = 0; i < redex.numOutputs; i++) {
+			cout << "    " << redex.outputs[i] << endl;
+		}
+	}
+
+	// Reduce the term to normal form by always applying the last redex,
+	// which is the same strategy as the benchmark in c_soup:
+	Term current = term, next;
+	while (listRedexes(current, redexes), !redexes.empty()) {
+		applyRedex(current, redexes.back(), next);
+		swap(current, next);
+	}
+	cout << "-> " << current << endl;
+
+	// Now time how long it takes to run listRedexes 1million times:
+	{
+		auto start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < 1000000; i++) {
+			listRedexes(term, redexes);
+		}
+		auto end = chrono::high_resolution_clock::now();
+		auto duration = chrono::duration_cast<chrono::microseconds>(end - start);
+		cout << "Time taken: " << duration.count() << " microseconds" << endl;
+	}
+
+	// ...and how many redexes can be listed and applied per second, reducing
+	// the term to normal form 1million times:
+	{
+		long count = 0;
+		auto start = chrono::high_resolution_clock::now();
+		for (int i = 0; i < 1000000; i++) {
+			current = term;
+			while (listRedexes(current, redexes), !redexes.empty()) {
+				applyRedex(current, redexes.back(), next);
+				swap(current, next);
+				count++;
+			}
+		}
+		auto end = chrono::high_resolution_clock::now();
+		double time = chrono::duration<double>(end - start).count();
+		cout << "Applied " << count << " redexes in " << time << " seconds ("
+			<< count / time << " redexes per second)" << endl;
+	}
+}
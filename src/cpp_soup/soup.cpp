@@ -1,168 +1,175 @@
 #include "soup.h"
-#include <iostream>
+#include "brackets.h"
 #include <vector>
-#include <stack>
-#include <set>
-#include <map>
-#include <queue>
 using namespace std;
 
-// The set of supported combinators.
-// https://en.wikipedia.org/wiki/Combinatory_logic
-const set<char> combinators = {'S', 'K', 'I', 'B', 'C', 'W'};
-
 // A term is valid if the only characters are combinators and parentheses,
-// and the parentheses are balanced and nested correctly.
+// and the parentheses are balanced and nested correctly. The supported
+// combinators (https://en.wikipedia.org/wiki/Combinatory_logic) are those
+// classifyBlock knows of. The depth only changes at brackets, so a block that
+// closes no more brackets than are open before it can't take it below zero,
+// and only needs its brackets counting.
 bool validateTerm(const Term &term) {
-		int balance = 0;
-		for (char c : term) {
-				if (c == '(') {
-						balance++;
-				} else if (c == ')') {
-						balance--;
-				} else if (combinators.find(c) == combinators.end()) {
+		int depth = 0;
+		for (size_t base = 0; base < term.length(); base += 64) {
+				BracketMasks masks = classifyBlock(term, base);
+				if (masks.invalid != 0) {
 						return false;
 				}
-				if (balance < 0) {
-						return false;
+				int opened = __builtin_popcountll(masks.opens);
+				int closed = __builtin_popcountll(masks.closes);
+				if (closed <= depth) {
+						depth += opened - closed;
+						continue;
+				}
+				for (uint64_t bits = masks.opens | masks.closes; bits != 0; bits &= bits - 1) {
+						depth += (masks.opens >> __builtin_ctzll(bits)) & 1 ? 1 : -1;
+						if (depth < 0) {
+								return false;
+						}
 				}
 		}
-		return balance == 0;
+		return depth == 0;
 }
 
-struct _ListRedexCtx {
-		int start;
-		vector<string> terms;
+// Combinators are defined by their reduction rules:
+//   Sxyz  -> xz(yz)
+//   Kxy   -> x
+//   Ix    -> x
+//   Bxyz  -> x(yz)
+//   Cxyz  -> xzy
+//   Wxy   -> xyy
+// ...which we describe by their arity and a template for their output, in
+// which digits stand for arguments. Reductions also exchange subterms with
+// the soup, which we describe by argument indices, with -1 standing for the
+// combinator itself.
+struct _Rule {
+	int arity;
+	const char *output;
+	int numInputs;
+	int inputs[1];
+	int numOutputs;
+	int outputs[2];
 };
 
-// Terms are left-associative (i.e. "abc" and "((ab)c)" are equivalent), so we
-// can find redexes by going left-to-right. A redex is a combinator followed
-// by a certain number of arguments, such as "Sxyz == (((Sx)y)z)". Note that
-// by left-associativity, something like aSbc is _not_ a redex, because of the
-// implicit parentheses: "aSbc" == "(aS)bc".
-vector<Redex> listRedexes(const Term &term) {
-	if (term.length() == 0) {
-		return vector<Redex>();
+static const _Rule *findRule(char c) {
+	static const _Rule S = {3, "02(12)", 1, {2}, 1, {-1}}; // consumes 'z', ejects 'S'
+	static const _Rule K = {2, "0", 0, {}, 2, {-1, 1}}; // ejects 'K' and 'y'
+	static const _Rule I = {1, "0", 0, {}, 1, {-1}}; // ejects 'I'
+	static const _Rule B = {3, "0(12)", 0, {}, 1, {-1}}; // ejects 'B'
+	static const _Rule C = {3, "021", 0, {}, 1, {-1}}; // ejects 'C'
+	static const _Rule W = {2, "011", 1, {1}, 1, {-1}}; // consumes 'y', ejects 'W'
+	switch (c) {
+		case 'S': return &S;
+		case 'K': return &K;
+		case 'I': return &I;
+		case 'B': return &B;
+		case 'C': return &C;
+		case 'W': return &W;
+		default: return nullptr;
+	}
+}
+
+// Terms are left-associative (i.e. "abc" and "((ab)c)" are equivalent), so a
+// redex is a combinator followed by a certain number of arguments, such as
+// "Sxyz == (((Sx)y)z)", at the start of a bracketed group or of the term.
+// Note that by left-associativity, something like aSbc is _not_ a redex,
+// because of the implicit parentheses: "aSbc" == "(aS)bc". With the brackets
+// matched up front, each group is checked by hopping from item to item, so
+// only the first few items of each are ever looked at.
+void listRedexes(const Term &term, vector<Redex> &redexes) {
+	redexes.clear();
+
+	// The tables are reused between calls, so listing doesn't allocate once
+	// they have grown to the longest term seen so far:
+	static thread_local vector<int> match, closes;
+	if (term.length() == 0 || !matchBrackets(term, match, closes)) {
+		return;
 	}
 
-	vector<Redex> redexes;
-	auto handleRedex = [&](const _ListRedexCtx &ctx) {
-		// There must be at least one term and the first must be a combinator:
-		if (ctx.terms.size() == 0) {
+	const char *base = term.data();
+	auto handleGroup = [&](int start, int end) {
+		// The first item must be a bare combinator, with at least as many
+		// arguments as its arity:
+		const _Rule *rule = start < end ? findRule(term[start]) : nullptr;
+		if (rule == nullptr) {
 			return;
 		}
-		if (ctx.terms[0].length() != 1) {
+		string_view items[4] = {string_view(base + start, 1)}; // without outer brackets
+		int i = start + 1, count = 1;
+		for (; i < end && count <= rule->arity; count++) {
+			if (term[i] == '(') {
+				items[count] = string_view(base + i + 1, match[i] - i - 1);
+				i = match[i] + 1;
+			} else {
+				items[count] = string_view(base + i, 1);
+				i++;
+			}
+		}
+		if (count <= rule->arity) {
 			return;
 		}
 
-		// Combinators are defined by their reduction rules:
-		//   Sxyz  -> xz(yz)
-		//   Kxy   -> x
-		//   Ix    -> x
-		//   Bxyz  -> x(yz)
-		//   Cxyz  -> xzy
-		//   Wxy   -> xyy
-		// ...thus the prospective redex is valid if the number of arguments
-		// is at least the combinator's arity.
-		vector<Term> inputs;
-		vector<Term> outputs;
-		if (ctx.terms[0] == "S") {
-			if (ctx.terms.size() < 4) {
-				return;
-			}
-			inputs.push_back(Term(ctx.terms[3])); // S consumes an additional 'z'
-			outputs.push_back(Term("S")); // S ejects 'S'
-		} else if (ctx.terms[0] == "K") {
-			if (ctx.terms.size() < 3) {
-				return;
-			}
-			outputs.push_back(Term("K")); // K ejects 'K' and an additional 'y'
-			outputs.push_back(Term(ctx.terms[2]));
-		} else if (ctx.terms[0] == "I") {
-			if (ctx.terms.size() < 2) {
-				return;
-			}
-			outputs.push_back(Term("I")); // I ejects 'I'
-		} else if (ctx.terms[0] == "B") {
-			if (ctx.terms.size() < 3) {
-				return;
-			}
-			outputs.push_back(Term("B")); // B ejects 'B'
-		} else if (ctx.terms[0] == "C") {
-			if (ctx.terms.size() < 3) {
-				return;
-			}
-			outputs.push_back(Term("C")); // C ejects 'C'
-		} else if (ctx.terms[0] == "W") {
-			if (ctx.terms.size() < 3) {
-				return;
-			}
-			inputs.push_back(Term(ctx.terms[2])); // W consumes an additional 'y'
-			outputs.push_back(Term("W")); // W ejects 'W'
-		} else {
-			return; // not a combinator, should never happen
+		Redex &redex = redexes.emplace_back();
+		redex.index = start;
+		redex.end = i;
+		redex.combinator = term[start];
+		for (int i = 0; i < rule->arity; i++) {
+			redex.args[i] = items[i + 1];
+		}
+		redex.numInputs = rule->numInputs;
+		for (int i = 0; i < rule->numInputs; i++) {
+			redex.inputs[i] = items[rule->inputs[i] + 1];
+		}
+		redex.numOutputs = rule->numOutputs;
+		for (int i = 0; i < rule->numOutputs; i++) {
+			redex.outputs[i] = items[rule->outputs[i] + 1];
 		}
-
-		// The redex is valid, so add it to the list:
-		Redex redex;
-		redex.index = ctx.start;
-		redex.inputs = inputs;
-		redex.outputs = outputs;
-		redexes.push_back(redex);
 	};
 
-	stack<_ListRedexCtx> stack;
-	stack.push({_ListRedexCtx{0, vector<string>()}});
-	for (int i = 0; i < term.length(); i++) {
-		char c = term[i];
-		if (c == '(') {
-			stack.push({_ListRedexCtx{i + 1, vector<string>()}});
-		} else if (c == ')') {
-			_ListRedexCtx ctx = stack.top();
-			stack.pop();
-			handleRedex(ctx);
-
-			string subterm = term.substr(ctx.start, i - ctx.start);
-			stack.top().terms.push_back(subterm);
-		} else {
-			stack.top().terms.push_back(string(1, c));
-		}
+	// Groups are visited innermost first, in the order they close, with the
+	// top-level of the term last:
+	for (int close : closes) {
+		handleGroup(match[close] + 1, close);
 	}
-
-	handleRedex(stack.top());
-	return redexes;
+	handleGroup(0, term.length());
 }
 
-Term applyRedex(const Term &term, const Redex &redex) {
-	return Term();
-}
+void applyRedex(const Term &term, const Redex &redex, Term &out) {
+	const _Rule *rule = findRule(redex.combinator);
+	out.clear();
 
-int main() {
-	Term term = "SII(KSI)(IK)";
-	if (!validateTerm(term)) {
-		cout << "Invalid term: " << term << endl;
-		return 1;
+	// If the redex is a whole bracketed group that reduces to an atom, then
+	// the brackets become redundant and are dropped along with it:
+	int start = redex.index;
+	int end = redex.end;
+	if (rule->output[1] == '\0' && redex.args[rule->output[0] - '0'].length() == 1 &&
+			start > 0 && term[start - 1] == '(' && end < (int) term.length() &&
+			term[end] == ')') {
+		start--;
+		end++;
 	}
-	cout << "Valid term: " << term << endl;
-	vector<Redex> redexes = listRedexes(term);
-	for (Redex redex : redexes) {
-		cout << "Redex at " << redex.index << endl;
-		cout << "  Inputs:" << endl;
-		for (Term input : redex.inputs) {
-			cout << "    " << input << endl;
-		}
-		cout << "  Outputs:" << endl;
-		for (Term output : redex.outputs) {
-			cout << "    " << output << endl;
+
+	out.append(term, 0, start);
+	bool head = true;
+	for (const char *c = rule->output; *c != '\0'; c++) {
+		if (*c == '(' || *c == ')') {
+			out.push_back(*c);
+			head = *c == '(';
+			continue;
 		}
-	}
 
-	// Now time how long it takes to run listRedexes 1million times:
-	auto start = chrono::high_resolution_clock::now();
-	for (int i = 0; i < 1000000; i++) {
-		listRedexes(term);
+		// Arguments in head position never need brackets by left-
+		// associativity, but any others that aren't atoms do:
+		string_view arg = redex.args[*c - '0'];
+		if (!head && arg.length() > 1) {
+			out.push_back('(');
+			out.append(arg);
+			out.push_back(')');
+		} else {
+			out.append(arg);
+		}
+		head = false;
 	}
-	auto end = chrono::high_resolution_clock::now();
-	auto duration = chrono::duration_cast<chrono::microseconds>(end - start);
-	cout << "Time taken: " << duration.count() << " microseconds" << endl;
+	out.append(term, end, string::npos);
 }
@@ -1,17 +1,32 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 using namespace std;
 
 typedef string Term;
 
+// A redex is described entirely by spans into the term it was found in, so
+// that listing redexes never copies any subterms. The spans are only valid
+// for as long as the term they point into is unchanged.
 struct Redex {
-	int index;
-	vector<Term> inputs;
-	vector<Term> outputs;
+	int index; // offset of the combinator
+	int end; // offset one past the last argument the combinator consumes
+	char combinator;
+	string_view args[3]; // the consumed arguments, without outer brackets
+	int numInputs;
+	string_view inputs[1]; // subterms the reduction consumes from the soup
+	int numOutputs;
+	string_view outputs[2]; // subterms the reduction ejects into the soup
 };
 
 bool validateTerm(const Term &term);
-vector<Redex> listRedexes(const Term &term);
-Term applyRedex(const Term &term, const Redex &redex);
+
+// Writes every redex in the term to redexes, innermost first, reusing the
+// vector's storage.
+void listRedexes(const Term &term, vector<Redex> &redexes);
+
+// Writes the result of reducing the given redex of the term into out, reusing
+// its storage. The output must not be the same string as the term.
+void applyRedex(const Term &term, const Redex &redex, Term &out);
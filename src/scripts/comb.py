@@ -1,4 +1,4 @@
-from src.cffi import parse, reduce
+from src.cffi import Graph, parse, reduce
 import argparse
 
 def main():
@@ -10,6 +10,9 @@ def main():
     reduce_parser.set_defaults(func=reduce_term)
     beta_parser = subparsers.add_parser("beta")
     beta_parser.add_argument("term")
+    beta_parser.add_argument("--engine", choices=["tree", "graph"],
+                             default="tree")
+    beta_parser.add_argument("--max-steps", type=int, default=None)
     beta_parser.set_defaults(func=beta_term)
     args = parser.parse_args()
     args.func(args)
@@ -23,6 +26,30 @@ def reduce_term(args):
 def beta_term(args):
     term = parse(args.term)
     print(term)
+    steps = 0
+    if args.engine == "graph":
+        # Each step is a single leftmost-outermost reduction:
+        graph = Graph(term)
+        printed = str(term)
+        while args.max_steps is None or steps < args.max_steps:
+            if not graph.step():
+                return
+            steps += 1
+            reduced = str(graph)
+            print(f"  -> {reduced}")
+            # Normal order is deterministic, so a term that reduces to itself
+            # does so forever:
+            if reduced == printed:
+                return
+            printed = reduced
+        return
     while not term.is_beta_normal():
-        term = reduce(term)
-        print(f"  -> {term}")
+        if args.max_steps is not None and steps >= args.max_steps:
+            return
+        reduced = reduce(term)
+        steps += 1
+        print(f"  -> {reduced}")
+        # A term like WWW reduces to itself, and so never normalises:
+        if reduced == term:
+            return
+        term = reduced
@@ -1,11 +1,59 @@
 from src.soup import Soup
+from src.telemetry import Telemetry
+from contextlib import nullcontext
+import argparse
 
 def main():
     """Runs the Soup simulation.
     """
-    soup = Soup(terms=10000, alphabet="BCKW")
-    for i in range(1000):
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--telemetry", default=None,
+                        help="file to write samples of the soup's statistics to")
+    parser.add_argument("--format", choices=Telemetry.FORMATS, default="jsonl")
+    parser.add_argument("--every", type=int, default=1,
+                        help="number of steps between samples")
+    parser.add_argument("--checkpoint", default=None,
+                        help="file to save the soup to in the background")
+    parser.add_argument("--checkpoint-every", type=int, default=100,
+                        help="number of steps between checkpoints")
+    parser.add_argument("--resume", default=None,
+                        help="checkpoint to resume the soup from")
+    parser.add_argument("--trace", default=None,
+                        help="file to trace the soup's population to, instead "
+                             "of printing its immortals")
+    parser.add_argument("--replicators", action="store_true",
+                        help="print terms whose copies grow fast, instead of "
+                             "its immortals")
+    args = parser.parse_args()
+
+    if args.resume is not None:
+        soup = Soup.load(args.resume)
+    else:
+        soup = Soup(terms=10000, alphabet="BCKW")
+    telemetry = None
+    if args.telemetry is not None:
+        telemetry = Telemetry(soup, open(args.telemetry, "w"), args.format,
+                              args.every)
+    if args.trace is not None:
+        soup.trace(args.trace)
+    if args.replicators:
+        soup.detect()
+    reported = 0
+    for i in range(soup.steps(), 1000):
         soup.step()
-        if i % 1 == 0:
+        if args.replicators:
+            for replicator in soup.replicators(reported):
+                print(f"STEP {i}: replicator {replicator.term} with "
+                      f"{replicator.copies} copies, up {replicator.growth}")
+                reported += 1
+        elif args.trace is None:
             print(f"STEP {i}.")
-            print(f"  immortals: {soup.immortals()}")
+            with telemetry.analysing() if telemetry else nullcontext():
+                immortals = soup.immortals()
+            print(f"  immortals: {immortals}")
+        if telemetry is not None:
+            telemetry.step(i)
+        if args.checkpoint is not None and (i + 1) % args.checkpoint_every == 0:
+            soup.save(args.checkpoint, background=True)
+    soup.wait_for_save()
+    soup.stop_trace()
@@ -0,0 +1,33 @@
+from src.trace import Trace
+import argparse
+
+def main():
+    """Reads a population trace written by the soup script's --trace.
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("trace", help="trace file to read")
+    parser.add_argument("--step", type=int, default=None,
+                        help="step to show the population at")
+    parser.add_argument("--top", type=int, default=10,
+                        help="number of the most abundant terms to show")
+    parser.add_argument("--reactions", action="store_true",
+                        help="also show the reactions in the step")
+    args = parser.parse_args()
+
+    with Trace(args.trace) as trace:
+        print(f"steps {trace.first_step} to {trace.last_step} "
+              f"in {trace.chunks} chunks")
+        if args.step is None:
+            return
+        population = trace.population(args.step)
+        print(f"STEP {args.step}: {sum(population.values())} terms, "
+              f"{len(population)} distinct")
+        ranked = sorted(population.items(), key=lambda item: -item[1])
+        for term, count in ranked[:args.top]:
+            print(f"  {count:8d}  {term}")
+        if args.reactions and args.step > trace.first_step:
+            for reaction in trace.reactions(args.step):
+                inputs = " + ".join(reaction.inputs)
+                outputs = " + ".join(reaction.outputs)
+                print(f"  {reaction.kind} ({reaction.result}): "
+                      f"{inputs} -> {outputs}")
@@ -1,5 +1,6 @@
-from .cffi import parse, reduce, Term
-from typing import List, Mapping
+from .cffi import (MultisetHandle, Replicator, SoupHandle, Term,
+                   beta_normal_all, graph_normal, print_all)
+from typing import Dict, List
 import random
 
 class Soup:
@@ -14,6 +15,11 @@ class Soup:
 
     The hope is that after some time, interesting behaviours such as self-
     replication will emerge automatically from this dynamics.
+
+    The simulation itself runs natively in src/c_lib/soup.c, and this class
+    is a thin wrapper around it. Soups made mostly of copies of a few terms,
+    such as large soups of atoms, can instead be stored as a multiset of
+    distinct terms and their counts, which runs in src/c_lib/multiset.c.
     """
 
     # Constants that can be tuned to find interesting behaviours:
@@ -22,116 +28,264 @@ class Soup:
     P_FISSION = 0.15 # Probability of the action being a fission.
     P_FUSION = 0.15 # Probability of the action being a fusion.
     P_BREAK = 0.3 # Probability of a term breaking at any given fission point.
+    MAX_NODES = 1 << 20 # Most nodes a single reduction may allocate.
+    MAX_BYTES = 64 << 20 # Most bytes a single reduction may allocate.
+    ON_EXHAUSTED = SoupHandle.KEEP # What to do if a reduction goes over either.
 
-    def __init__(self, terms: int, alphabet: str = "SKI"):
+    def __init__(self, terms: int, alphabet: str = "SKI", seed: int = None,
+                 threads: int = 1, debug: bool = False,
+                 multiset: bool = False):
         """Creates a new Soup with the given number and type of atomic terms,
         i.e. combinators.
 
         Args:
             terms: The number of atomic terms (i.e. combinators) to create.
             alphabet: The alphabet of atomic terms (i.e. combinators) to use.
+            seed: Seed for the soup's random number generator, which is
+              itself seeded randomly if not given.
+            threads: The number of threads to run reactions on. The
+              simulation is deterministic for a given seed regardless.
+            debug: Whether to check the soup's running combinator counts
+              against a full recount after every step, which is slow.
+            multiset: Whether to store the soup as a multiset of distinct
+              terms and their counts, which takes memory and time per step in
+              proportion to the distinct terms and the reactions rather than
+              to the number of terms. It evolves the same way in distribution,
+              but not step for step from the same seed, and always runs on
+              a single thread.
         """
+        if seed is None:
+            seed = random.getrandbits(64)
         self._terms = terms
         self._alphabet = alphabet
-        self._soup = [parse(random.choice(alphabet)) for _ in range(terms)]
+        if multiset:
+            self._soup = MultisetHandle(terms, alphabet, seed, debug)
+        else:
+            self._soup = SoupHandle(terms, alphabet, seed, threads, debug)
+        params = self._soup.params
+        params.p_action = self.P_ACTION
+        params.p_reduce = self.P_REDUCE
+        params.p_fission = self.P_FISSION
+        params.p_fusion = self.P_FUSION
+        params.p_break = self.P_BREAK
+        params.budget.max_nodes = self.MAX_NODES
+        params.budget.max_bytes = self.MAX_BYTES
+        params.on_exhausted = self.ON_EXHAUSTED
+
+    @classmethod
+    def load(cls, path: str, threads: int = 1, debug: bool = False) -> "Soup":
+        """Resumes a Soup from a checkpoint written by save(). The Soup
+        carries on exactly where it left off, with the parameters it was
+        saved with rather than the constants of this class.
+
+        Args:
+            path: The checkpoint to load.
+            threads: The number of threads to run reactions on.
+            debug: Whether to check the Soup's combinator counts after every
+              step, as in the constructor.
+        """
+        soup = cls.__new__(cls)
+        soup._soup = SoupHandle.load(path, threads, debug)
+        soup._terms = len(soup._soup)
+        soup._alphabet = soup._soup.alphabet
+        return soup
+
+    def save(self, path: str, background: bool = False):
+        """Writes a checkpoint of the Soup to the given path, which load()
+        can resume it from. The file is replaced atomically, so a crash
+        never leaves a partial checkpoint behind. This isn't available in
+        multiset mode.
+
+        Args:
+            path: The file to write the checkpoint to.
+            background: Whether to write the checkpoint on a background
+              thread, so that the Soup can keep stepping meanwhile. Errors are
+              then raised by the next save() or wait_for_save().
+        """
+        if isinstance(self._soup, MultisetHandle):
+            raise ValueError("save() is not supported in multiset mode")
+        self._soup.save(path, background)
+
+    def wait_for_save(self):
+        """Waits for a checkpoint being written in the background to finish,
+        raising any error in writing it.
+        """
+        if isinstance(self._soup, SoupHandle):
+            self._soup.wait_for_save()
+
+    def trace(self, path: str, steps_per_chunk: int = 64):
+        """Starts recording the Soup's population to a trace file, with the
+        copies of each distinct term and every reaction in each step, which
+        src/trace.py reads back. The file is compressed and written by a
+        background thread, so tracing costs the simulation little more than
+        the work of its reactions. This isn't available in multiset mode.
+
+        Args:
+            path: The file to write the trace to, which is replaced.
+            steps_per_chunk: The number of steps in each chunk of the trace,
+              which starts with a snapshot of the whole population. Readers
+              seek to a step by decoding its chunk, so smaller chunks are
+              quicker to seek in, and larger ones smaller on disk.
+        """
+        if isinstance(self._soup, MultisetHandle):
+            raise ValueError("trace() is not supported in multiset mode")
+        self._soup.trace(path, steps_per_chunk)
+
+    def stop_trace(self):
+        """Stops recording the trace started by trace(), if any, and waits
+        for the rest of it to be written, raising any error in writing it.
+        """
+        if isinstance(self._soup, SoupHandle):
+            self._soup.stop_trace()
 
     def __str__(self):
         """Returns a string representation of the Soup.
         """
-        return str([str(term) for term in self._soup])
-
-    def step(self):
-        """Performs one step of the Soup simulation, applying actions to
-        a random subset of terms in the Soup.
-        """
-        soup = []
-        random.shuffle(self._soup)
-        pre_count = self._count()
-        while len(self._soup) > 0:
-            term = self._soup.pop()
-            if random.random() < self.P_ACTION:
-                p = random.random()
-                if p < self.P_REDUCE:
-                    soup.append(reduce(term))
-                elif p < self.P_REDUCE + self.P_FISSION:
-                    soup.extend(self._fission(term))
-                else:
-                    if len(self._soup) == 0:
-                        soup.append(term)
-                    else:
-                        soup.append(parse(str(self._soup.pop()) + str(term)))
-            else:
-                soup.append(term)
-        self._soup = soup
-
-        # Insert any deficit back into the soup as atomic terms:
-        # There may occasionally be a sufficit from S terms.
-        post_count = self._count()
-        for c in self._alphabet:
-            if c not in pre_count:
-                pre_count[c] = 0
-            if c not in post_count:
-                post_count[c] = 0
-            deficit = pre_count[c] - post_count[c]
-            for _ in range(deficit):
-                self._soup.append(parse(c))
-
-    def immortals(self) -> List[Term]:
-        """Returns a list of all the terms that have no beta normal form.
+        return str(print_all(self.terms()))
 
-        Returns:
-            A list of all the terms that have no beta normal form.
+    def __len__(self):
+        return len(self._soup)
+
+    def counts(self) -> Dict[str, int]:
+        """Returns the number of each combinator in the Soup, which is kept up
+        to date incrementally rather than recounted.
+        """
+        return self._soup.counts()
+
+    def terms(self) -> List[Term]:
+        """Returns the terms currently in the Soup.
+        """
+        return self._soup.terms()
+
+    def multiplicities(self) -> Dict[Term, int]:
+        """Returns each distinct term in the Soup with its number of copies,
+        without listing every copy in multiset mode.
+        """
+        if isinstance(self._soup, MultisetHandle):
+            return self._soup.multiplicities()
+        multiplicities = {}
+        for term in self.terms():
+            multiplicities[term] = multiplicities.get(term, 0) + 1
+        return multiplicities
+
+    def stats(self) -> Dict[str, float]:
+        """Returns running totals of what the Soup has done, as kept by the
+        simulation: reactions of each kind, reductions by how they ended,
+        redexes contracted and atoms topped up of each combinator, and the
+        seconds spent in each phase of a step. These are cheap to keep and to
+        read, so sampling them costs next to nothing. This isn't available in
+        multiset mode.
+        """
+        if isinstance(self._soup, MultisetHandle):
+            raise ValueError("stats() is not supported in multiset mode")
+        return self._soup.stats()
+
+    def histogram(self) -> List[int]:
+        """Returns a histogram of the sizes of the terms in the Soup, where
+        bucket i counts the terms with between 2^i and 2^(i+1) - 1 leaves, and
+        the last bucket counts every larger term too. This takes time linear
+        in the number of terms. This isn't available in multiset mode.
+        """
+        if isinstance(self._soup, MultisetHandle):
+            raise ValueError("histogram() is not supported in multiset mode")
+        return self._soup.histogram()
+
+    def steps(self) -> int:
+        """Returns the number of steps simulated so far, including those
+        before the Soup was saved, if it was loaded from a checkpoint.
+        """
+        return self._soup.steps
+
+    def exhausted(self) -> int:
+        """Returns the number of reductions so far that ran out of budget, and
+        so were handled according to ON_EXHAUSTED instead.
         """
-        def has_beta_normal(term: Term) -> bool:
-            """Returns True if the given term has a beta normal form.
-            """
-            _, res = term.beta_normal()
-            return res
-        return [term for term in self._soup if not has_beta_normal(term)]
+        return self._soup.exhausted
 
-    def _count(self) -> Mapping[str, int]:
-        """Returns a count of each kind of combinator in the soup.
+    def step(self, n_steps: int = 1):
+        """Performs steps of the Soup simulation, applying actions to a random
+        subset of terms in the Soup in each one.
+
+        Args:
+            n_steps: The number of steps to perform.
+        """
+        self._soup.step(n_steps)
+
+    def run(self, duration: float, max_events: int = 0) -> int:
+        """Runs the Soup in continuous time instead of in steps, reacting one
+        term at a time, with one unit of time corresponding to a step. Terms
+        that can't react in some way, like a term in normal form being
+        reduced, are never picked for it, so each reaction costs the same
+        however large the Soup is. This isn't available in multiset mode.
+
+        Args:
+            duration: The time to simulate.
+            max_events: The most reactions to run, or 0 for no limit.
 
         Returns:
-            A dictionary mapping each combinator to the number of times it
-            appears in the term.
-        """
-        count: Mapping[str, int] = {}
-        for term in self._soup:
-            for c in str(term):
-                if c == "(" or c == ")":
-                    continue
-                if c in count:
-                    count[c] += 1
-                else:
-                    count[c] = 1
-        return count
-
-    # TODO: can we split inside the term too? Could be cool.
-    def _fission(self, term: Term) -> List[Term]:
-        """Splits the given term into two terms, if possible.
+            The number of reactions run, which over the time the call took
+            gives the rate of reactions per second.
+        """
+        if isinstance(self._soup, MultisetHandle):
+            raise ValueError("run() is not supported in multiset mode")
+        return self._soup.run(duration, max_events)
+
+    def detect(self, window: int = 32, min_growth: int = 64,
+               min_ratio: float = 2.0, min_before: int = 8):
+        """Starts watching the Soup for self-replicators, by how the copies of
+        each distinct term change from step to step, which costs time in
+        proportion to the reactions in each step rather than to the Soup.
+        Terms that grow fast enough are flagged, and listed by replicators().
+        This isn't available in multiset mode.
 
         Args:
-            term: The term to split.
+            window: The number of steps over which growth is measured.
+            min_growth: The fewest copies a term must gain over the window.
+            min_ratio: The least factor by which its copies must grow over
+              the window.
+            min_before: The fewest copies it must have at the start of the
+              window, so that the ratio means something.
+        """
+        if isinstance(self._soup, MultisetHandle):
+            raise ValueError("detect() is not supported in multiset mode")
+        self._soup.detect(window=window, min_growth=min_growth,
+                          min_ratio=min_ratio, min_before=min_before)
+
+    def replicators(self, start: int = 0) -> List[Replicator]:
+        """Returns the terms flagged as self-replicators since detect() was
+        called, in the order they were flagged, with the reactions that
+        produced their copies.
+
+        Args:
+            start: The number of replicators to skip, such as those already
+              returned by an earlier call.
+        """
+        if isinstance(self._soup, MultisetHandle):
+            return []
+        return self._soup.replicators(start)
+
+    def immortals(self, engine: str = "tree") -> List[Term]:
+        """Returns a list of all the terms that have no beta normal form.
+        With the tree engine, beta normal forms are memoised across calls, so
+        calling this every step mostly costs a cache lookup per term.
+
+        Args:
+            engine: "tree" to reduce with reduce(), up to Term.beta_normal's
+              cutoff, or "graph" to use graph reduction, up to graph_normal's
+              budget. Graph reduction is normal-order, so it finds normal
+              forms that the tree engine can miss.
 
         Returns:
-            The left child of the split, or the original term if it could not
-            be split.
-        """
-        # We can split a term anywhere that doesn't unbalance it's parentheses:
-        term_str = str(term)
-        splits = []
-        depth = 0
-        for i, c in enumerate(term_str):
-            if c == "(":
-                depth += 1
-            elif c == ")":
-                depth -= 1
-            elif depth == 0 and i > 0 and i < len(term_str) - 1:
-                splits.append(i)
-
-        # Each split point is split with probability P_BREAK:
-        for i in splits:
-            if random.random() < self.P_BREAK:
-                return [parse(term_str[:i]), parse(term_str[i:])]
-        return [term]
+            A list of all the terms that have no beta normal form.
+        """
+        # Each distinct term only needs checking once:
+        multiplicities = self.multiplicities()
+        terms = list(multiplicities)
+        if engine == "tree":
+            normals = beta_normal_all(terms)
+        elif engine == "graph":
+            normals = [graph_normal(term) for term in terms]
+        else:
+            raise ValueError(f"Unknown engine: {engine}")
+        return [term for term, normal in zip(terms, normals) if normal is None
+                for _ in range(multiplicities[term])]
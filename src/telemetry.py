@@ -0,0 +1,90 @@
+from .cffi import stats as term_stats
+from .soup import Soup
+from contextlib import contextmanager
+from typing import Dict, TextIO
+import csv
+import json
+import time
+
+class Telemetry:
+    """Samples a Soup's statistics every so many steps, and writes each sample
+    as a row of CSV or a line of JSON to a stream. Each sample has the step
+    and size of the Soup, what it did since the last sample, as differences
+    of its running totals, the histogram of its term sizes, the allocation
+    counts of the term library, and the time spent analysing it, which is
+    timed by the caller with analysing().
+
+    Sampling reads counters the simulation keeps anyway, apart from the
+    histogram, which walks the terms once, so it costs nothing between
+    samples and little at them.
+    """
+
+    FORMATS = ["jsonl", "csv"]
+
+    def __init__(self, soup: Soup, out: TextIO, format: str = "jsonl",
+                 every: int = 1):
+        """Creates a Telemetry for the given Soup.
+
+        Args:
+            soup: The Soup to sample, which can't be in multiset mode.
+            out: The stream to write samples to.
+            format: "jsonl" for a line of JSON per sample, or "csv" for a
+              header row followed by a row per sample.
+            every: The number of steps between samples.
+        """
+        if format not in self.FORMATS:
+            raise ValueError(f"Unknown format: {format}")
+        self._soup = soup
+        self._out = out
+        self._format = format
+        self._every = every
+        self._writer = None
+        self._last = soup.stats()
+        self._last_allocs = term_stats()["system_allocs"]
+        self._analyse = 0.0
+
+    @contextmanager
+    def analysing(self):
+        """Times the body of the with statement as analysing the Soup."""
+        start = time.perf_counter()
+        try:
+            yield
+        finally:
+            self._analyse += time.perf_counter() - start
+
+    def step(self, step: int):
+        """Writes a sample if the given step is a multiple of the sampling
+        interval, and does nothing otherwise."""
+        if step % self._every == 0:
+            self.write(step)
+
+    def write(self, step: int):
+        """Writes a sample now, for the given step."""
+        sample = self.sample(step)
+        if self._format == "jsonl":
+            self._out.write(json.dumps(sample) + "\n")
+        else:
+            if self._writer is None:
+                self._writer = csv.DictWriter(self._out, list(sample))
+                self._writer.writeheader()
+            self._writer.writerow(sample)
+        self._out.flush()
+
+    def sample(self, step: int) -> Dict[str, float]:
+        """Returns a sample for the given step, and starts the next interval
+        from now."""
+        stats = self._soup.stats()
+        memory = term_stats()
+        sample = {"step": step, "size": len(self._soup)}
+        for key, value in stats.items():
+            sample[key] = value - self._last[key]
+        sample["seconds_analyse"] = self._analyse
+        for i, count in enumerate(self._soup.histogram()):
+            sample[f"size_{1 << i}"] = count
+        sample["nodes_alive"] = memory["nodes_alive"]
+        sample["bytes_alive"] = memory["bytes_alive"]
+        sample["system_allocs"] = memory["system_allocs"] - self._last_allocs
+        self._last = stats
+        self._last_allocs = memory["system_allocs"]
+        self._analyse = 0.0
+        return sample
@@ -0,0 +1,249 @@
+from typing import BinaryIO, Dict, List, NamedTuple, Optional, Tuple
+import struct
+import zlib
+
+class Reaction(NamedTuple):
+    """A reaction recorded in a trace, with its inputs and outputs as terms.
+    """
+    kind: str # "fission", "fusion" or "reduction"
+    result: str # how the reduction ended, or "done" for other kinds
+    inputs: List[str]
+    outputs: List[str]
+
+class _Chunk(NamedTuple):
+    """The decoded contents of a chunk of a trace."""
+    nodes: Dict[int, Tuple[str, int, int]] # hash -> tag, left and right hashes
+    keyframe: Dict[int, int] # hash -> copies at the chunk's first step
+    changes: List[List[Tuple[int, int]]] # hash and change in copies per step
+    reactions: List[List[Tuple[int, int, List[int], List[int]]]]
+
+class Trace:
+    """Reads a population trace written by Soup.trace(), whose format is
+    described in src/c_lib/trace.h. Only the small header of each chunk is
+    read when the trace is opened, and reading a step decodes just the chunk
+    it falls in, so any step of a long trace can be read quickly.
+
+    Terms are returned as strings, apart from those whose strings would be
+    longer than MAX_LENGTH, which are returned as "#" and their structural
+    hash instead, as the terms of a soup can grow far too large to print.
+
+    A trace that is still being written, or whose writer died, can be read
+    too, up to its last complete chunk.
+    """
+
+    KINDS = ["fission", "fusion", "reduction"]
+    RESULTS = ["done", "out_of_steps", "out_of_nodes", "out_of_bytes"]
+    MAX_LENGTH = 10000
+
+    _MAGIC = b"COMBTRAC"
+    _VERSION = 1
+    _HEADER = struct.Struct("<8sII")
+    _CHUNK_HEADER = struct.Struct("<4sIQQQII")
+
+    def __init__(self, path: str):
+        """Opens the trace at the given path, raising ValueError if it isn't
+        a trace that can be read.
+        """
+        self._file: BinaryIO = open(path, "rb")
+        header = self._file.read(self._HEADER.size)
+        if len(header) < self._HEADER.size:
+            self.close()
+            raise ValueError(f"Not a trace: {path}")
+        magic, version, header_size = self._HEADER.unpack(header)
+        if magic != self._MAGIC or version != self._VERSION:
+            self.close()
+            raise ValueError(f"Not a trace that can be read: {path}")
+
+        # Each entry is the first step and number of steps of a chunk, and
+        # the offset, sizes and CRC-32 of its contents:
+        self._chunks: List[Tuple[int, int, int, int, int, int]] = []
+        end = self._file.seek(0, 2)
+        offset = header_size
+        while offset + self._CHUNK_HEADER.size <= end:
+            self._file.seek(offset)
+            magic, steps, first, raw, size, crc, _ = self._CHUNK_HEADER.unpack(
+                self._file.read(self._CHUNK_HEADER.size))
+            offset += self._CHUNK_HEADER.size
+            if magic != b"CHNK" or offset + size > end:
+                break
+            self._chunks.append((first, steps, offset, raw, size, crc))
+            offset += size
+        if not self._chunks:
+            self.close()
+            raise ValueError(f"Trace has no complete chunks: {path}")
+        self._cached: Optional[Tuple[int, _Chunk]] = None
+        self._strings: Dict[int, Optional[str]] = {}
+
+    def close(self):
+        self._file.close()
+
+    def __enter__(self) -> "Trace":
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    @property
+    def first_step(self) -> int:
+        """The first step the trace has the population at."""
+        return self._chunks[0][0]
+
+    @property
+    def last_step(self) -> int:
+        """The last step the trace has the population at."""
+        return max(first + steps for first, steps, *_ in self._chunks)
+
+    @property
+    def chunks(self) -> int:
+        """The number of complete chunks in the trace."""
+        return len(self._chunks)
+
+    def population(self, step: int) -> Dict[str, int]:
+        """Returns each distinct term in the soup after the given step, with
+        its number of copies.
+        """
+        index = self._find(step, first=True)
+        chunk = self._decode(index)
+        counts = dict(chunk.keyframe)
+        for changes in chunk.changes[:step - self._chunks[index][0]]:
+            for hash, change in changes:
+                counts[hash] = counts.get(hash, 0) + change
+        return {self._string(chunk, hash): count
+                for hash, count in counts.items() if count > 0}
+
+    def changes(self, step: int) -> Dict[str, int]:
+        """Returns the change in the number of copies of each term whose
+        number changed in the given step, which can't be the first step.
+        """
+        index = self._find(step, first=False)
+        chunk = self._decode(index)
+        changes = chunk.changes[step - self._chunks[index][0] - 1]
+        return {self._string(chunk, hash): change for hash, change in changes}
+
+    def reactions(self, step: int) -> List[Reaction]:
+        """Returns the reactions in the given step, which can't be the first
+        step, in the order the soup ran them.
+        """
+        index = self._find(step, first=False)
+        chunk = self._decode(index)
+        reactions = chunk.reactions[step - self._chunks[index][0] - 1]
+        return [Reaction(self.KINDS[kind], self.RESULTS[result],
+                         [self._string(chunk, hash) for hash in inputs],
+                         [self._string(chunk, hash) for hash in outputs])
+                for kind, result, inputs, outputs in reactions]
+
+    def _find(self, step: int, first: bool) -> int:
+        """Returns the index of the last chunk covering the given step, which
+        may be the chunk's first step if first is set. The last one is the
+        latest, if the soup was run between steps.
+        """
+        for index in reversed(range(len(self._chunks))):
+            start, steps = self._chunks[index][:2]
+            if start + (0 if first else 1) <= step <= start + steps:
+                return index
+        raise IndexError(f"Step {step} is not in the trace")
+
+    def _decode(self, index: int) -> _Chunk:
+        if self._cached is not None and self._cached[0] == index:
+            return self._cached[1]
+        _, steps, offset, raw, size, crc = self._chunks[index]
+        self._file.seek(offset)
+        data = self._file.read(size)
+        if len(data) != size or zlib.crc32(data) != crc:
+            raise ValueError(f"Chunk {index} of the trace is corrupt")
+        data = zlib.decompress(data)
+        if len(data) != raw:
+            raise ValueError(f"Chunk {index} of the trace is corrupt")
+
+        reader = _Reader(data)
+        chunk = _Chunk({}, {}, [], [])
+        reader.nodes(chunk.nodes)
+        for _ in range(reader.varint()):
+            hash = reader.u64()
+            chunk.keyframe[hash] = reader.varint()
+        for _ in range(steps):
+            reader.nodes(chunk.nodes)
+            chunk.changes.append([(reader.u64(), reader.change())
+                                  for _ in range(reader.varint())])
+            reactions = []
+            for _ in range(reader.varint()):
+                kind, result, inputs = reader.u8(), reader.u8(), reader.u8()
+                inputs = [reader.u64() for _ in range(inputs)]
+                outputs = [reader.u64() for _ in range(reader.u8())]
+                reactions.append((kind, result, inputs, outputs))
+            chunk.reactions.append(reactions)
+        self._cached = (index, chunk)
+        self._strings = {}
+        return chunk
+
+    def _string(self, chunk: _Chunk, hash: int) -> str:
+        """Returns the string of the term with the given hash, built without
+        recursion, as terms can be very deep.
+        """
+        stack = [hash]
+        while stack:
+            top = stack[-1]
+            if top in self._strings:
+                stack.pop()
+                continue
+            tag, left, right = chunk.nodes[top]
+            if tag != "@":
+                self._strings[top] = tag
+                stack.pop()
+                continue
+            missing = [h for h in (right, left) if h not in self._strings]
+            if missing:
+                stack.extend(missing)
+                continue
+            string = None
+            if self._strings[left] is not None and \
+                    self._strings[right] is not None:
+                string = self._strings[left]
+                if chunk.nodes[right][0] == "@":
+                    string += f"({self._strings[right]})"
+                else:
+                    string += self._strings[right]
+            if string is not None and len(string) > self.MAX_LENGTH:
+                string = None
+            self._strings[top] = string
+            stack.pop()
+        string = self._strings[hash]
+        return string if string is not None else f"#{hash:016x}"
+
+class _Reader:
+    """Reads the fields of a decompressed chunk in order."""
+
+    def __init__(self, data: bytes):
+        self._data = data
+        self._pos = 0
+
+    def u8(self) -> int:
+        self._pos += 1
+        return self._data[self._pos - 1]
+
+    def u64(self) -> int:
+        self._pos += 8
+        return int.from_bytes(self._data[self._pos - 8:self._pos], "little")
+
+    def varint(self) -> int:
+        value = shift = 0
+        while True:
+            byte = self._data[self._pos]
+            self._pos += 1
+            value |= (byte & 0x7F) << shift
+            if byte < 0x80:
+                return value
+            shift += 7
+
+    def change(self) -> int:
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def nodes(self, nodes: Dict[int, Tuple[str, int, int]]):
+        for _ in range(self.varint()):
+            hash = self.u64()
+            tag = chr(self.u8())
+            if tag == "@":
+                nodes[hash] = (tag, self.u64(), self.u64())
+            else:
+                nodes[hash] = (tag, 0, 0)
@@ -0,0 +1,24 @@
+from argparse import Namespace
+from src.cffi import beta_normal_all, parse, reduce
+from src.scripts.comb import beta_term
+
+def test_www_reduces_to_itself():
+    # W x y -> x y y with x = y = W gives back WWW, without it ever being in
+    # normal form:
+    term = parse("WWW")
+    assert reduce(term) == term
+    assert not term.is_beta_normal()
+    assert term.reduce() is None
+
+def test_beta_stops_at_terms_that_reduce_to_themselves(capsys):
+    for engine in ["tree", "graph"]:
+        beta_term(Namespace(term="WWW", engine=engine, max_steps=None))
+        assert capsys.readouterr().out.splitlines() == ["WWW", "  -> WWW"]
+
+def test_www_has_no_beta_normal_form():
+    # Asked twice, so that the second answer comes from the cache, for WWW
+    # and for a term that reduces to it:
+    for _ in range(2):
+        assert parse("WWW").beta_normal() == (None, False)
+        assert beta_normal_all([parse("I(WWW)"), parse("KSK")]) == \
+            [None, parse("S")]